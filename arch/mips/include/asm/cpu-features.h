@@ -164,6 +164,14 @@
 #define cpu_has_dsp		(cpu_data[0].ases & MIPS_ASE_DSP)
 #endif
 
+#ifndef cpu_has_mxu
+#ifdef CONFIG_JZRISC_MXU
+#define cpu_has_mxu		(cpu_data[0].ases & MIPS_ASE_MXU)
+#else
+#define cpu_has_mxu		0
+#endif
+#endif
+
 #ifndef cpu_has_mipsmt
 #define cpu_has_mipsmt		(cpu_data[0].ases & MIPS_ASE_MIPSMT)
 #endif
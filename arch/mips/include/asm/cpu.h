@@ -286,6 +286,7 @@ enum cpu_type_enum {
 #define MIPS_ASE_SMARTMIPS	0x00000008 /* SmartMIPS */
 #define MIPS_ASE_DSP		0x00000010 /* Signal Processing ASE */
 #define MIPS_ASE_MIPSMT		0x00000020 /* CPU supports MIPS MT */
+#define MIPS_ASE_MXU		0x00000040 /* Ingenic XBurst MXU SIMD */
 
 
 #endif /* _ASM_CPU_H */
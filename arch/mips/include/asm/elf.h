@@ -333,7 +333,10 @@ extern int dump_task_fpu(struct task_struct *, elf_fpregset_t *);
    instruction set this cpu supports.  This could be done in userspace,
    but it's not easy, and we've already done it here.  */
 
-#define ELF_HWCAP       (0)
+#define HWCAP_MIPS_MXU	(1 << 0)	/* Ingenic XBurst MXU SIMD */
+
+extern unsigned int elf_hwcap;
+#define ELF_HWCAP       (elf_hwcap)
 
 /* This yields a string that ld.so will use to load implementation
    specific libraries for optimization.  This is more specific in
@@ -0,0 +1,166 @@
+/*
+ * Ingenic XBurst MXU (media extension unit) context switching.
+ *
+ * MXU has fifteen 32-bit SIMD registers xr1-xr15 and a control register
+ * xr16 (MXU_CR).  A task becomes an MXU user the first time it is seen
+ * switching out with MXU_CR_EN set, which every MXU program sets before
+ * its first MXU instruction.  Only MXU users have their registers saved
+ * and restored; everybody else pays one read of MXU_CR per switch.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation;  either version 2 of the  License, or (at your
+ * option) any later version.
+ */
+#ifndef _ASM_MXU_H
+#define _ASM_MXU_H
+
+#include <linux/stringify.h>
+#include <asm/cpu-features.h>
+
+#define MXU_CR_EN	0x00000001	/* MXU instructions enabled */
+#define MXU_CR_RD_EN	0x00000002	/* rounding enabled */
+
+#ifdef CONFIG_JZRISC_MXU
+
+/*
+ * s32m2i xrN, $8 and s32i2m xrN, $8, hand assembled as the toolchain
+ * used for the kernel knows nothing of MXU.
+ */
+#define __mxu_m2i(xr)							\
+({									\
+	unsigned long __v;						\
+									\
+	__asm__ __volatile__(						\
+	"	.word	" __stringify(0x7008002e | ((xr) << 6)) "\n"	\
+	"	move	%0, $8\n"					\
+	: "=r" (__v) : : "$8");						\
+	__v;								\
+})
+
+#define __mxu_i2m(xr, val)						\
+do {									\
+	__asm__ __volatile__(						\
+	"	move	$8, %0\n"					\
+	"	.word	" __stringify(0x7008002f | ((xr) << 6)) "\n"	\
+	: : "r" (val) : "$8");						\
+} while (0)
+
+#define __mxu_save_xr(tsk, n)						\
+	((tsk)->thread.mxu.xr[(n) - 1] = __mxu_m2i(n))
+
+#define __mxu_restore_xr(tsk, n)					\
+	__mxu_i2m(n, (tsk)->thread.mxu.xr[(n) - 1])
+
+/* xr1-xr15 are only reachable with MXU enabled, so enable it first. */
+#define __save_mxu(tsk)							\
+do {									\
+	unsigned long __cr = __mxu_m2i(16);				\
+									\
+	__mxu_i2m(16, __cr | MXU_CR_EN);				\
+	__mxu_save_xr(tsk, 1);						\
+	__mxu_save_xr(tsk, 2);						\
+	__mxu_save_xr(tsk, 3);						\
+	__mxu_save_xr(tsk, 4);						\
+	__mxu_save_xr(tsk, 5);						\
+	__mxu_save_xr(tsk, 6);						\
+	__mxu_save_xr(tsk, 7);						\
+	__mxu_save_xr(tsk, 8);						\
+	__mxu_save_xr(tsk, 9);						\
+	__mxu_save_xr(tsk, 10);						\
+	__mxu_save_xr(tsk, 11);						\
+	__mxu_save_xr(tsk, 12);						\
+	__mxu_save_xr(tsk, 13);						\
+	__mxu_save_xr(tsk, 14);						\
+	__mxu_save_xr(tsk, 15);						\
+	__mxu_i2m(16, __cr);						\
+	(tsk)->thread.mxu.cr = __cr;					\
+} while (0)
+
+#define __restore_mxu(tsk)						\
+do {									\
+	__mxu_i2m(16, MXU_CR_EN);					\
+	__mxu_restore_xr(tsk, 1);					\
+	__mxu_restore_xr(tsk, 2);					\
+	__mxu_restore_xr(tsk, 3);					\
+	__mxu_restore_xr(tsk, 4);					\
+	__mxu_restore_xr(tsk, 5);					\
+	__mxu_restore_xr(tsk, 6);					\
+	__mxu_restore_xr(tsk, 7);					\
+	__mxu_restore_xr(tsk, 8);					\
+	__mxu_restore_xr(tsk, 9);					\
+	__mxu_restore_xr(tsk, 10);					\
+	__mxu_restore_xr(tsk, 11);					\
+	__mxu_restore_xr(tsk, 12);					\
+	__mxu_restore_xr(tsk, 13);					\
+	__mxu_restore_xr(tsk, 14);					\
+	__mxu_restore_xr(tsk, 15);					\
+	__mxu_i2m(16, (tsk)->thread.mxu.cr);				\
+} while (0)
+
+/* Don't let the next task see what the last MXU user left behind. */
+#define __clear_mxu()							\
+do {									\
+	__mxu_i2m(16, MXU_CR_EN);					\
+	__mxu_i2m(1, 0);						\
+	__mxu_i2m(2, 0);						\
+	__mxu_i2m(3, 0);						\
+	__mxu_i2m(4, 0);						\
+	__mxu_i2m(5, 0);						\
+	__mxu_i2m(6, 0);						\
+	__mxu_i2m(7, 0);						\
+	__mxu_i2m(8, 0);						\
+	__mxu_i2m(9, 0);						\
+	__mxu_i2m(10, 0);						\
+	__mxu_i2m(11, 0);						\
+	__mxu_i2m(12, 0);						\
+	__mxu_i2m(13, 0);						\
+	__mxu_i2m(14, 0);						\
+	__mxu_i2m(15, 0);						\
+	__mxu_i2m(16, 0);						\
+} while (0)
+
+/* New program image: not an MXU user until it enables MXU itself. */
+#define init_mxu()							\
+do {									\
+	if (cpu_has_mxu) {						\
+		clear_thread_flag(TIF_USEDMXU);				\
+		__clear_mxu();						\
+	}								\
+} while (0)
+
+/*
+ * Save the live MXU state of current into tsk if current is, or has
+ * just become, an MXU user.  tsk is current on a switch, the child on
+ * fork.
+ */
+#define save_mxu(tsk)							\
+do {									\
+	if (cpu_has_mxu &&						\
+	    (test_thread_flag(TIF_USEDMXU) ||				\
+	     (__mxu_m2i(16) & MXU_CR_EN))) {				\
+		set_tsk_thread_flag(tsk, TIF_USEDMXU);			\
+		__save_mxu(tsk);					\
+	}								\
+} while (0)
+
+#define __mxu_switch_to(prev, next)					\
+do {									\
+	if (cpu_has_mxu) {						\
+		save_mxu(prev);						\
+		if (test_tsk_thread_flag(next, TIF_USEDMXU))		\
+			__restore_mxu(next);				\
+		else if (test_tsk_thread_flag(prev, TIF_USEDMXU))	\
+			__clear_mxu();					\
+	}								\
+} while (0)
+
+#else
+
+#define init_mxu()			do { } while (0)
+#define save_mxu(tsk)			do { (void) (tsk); } while (0)
+#define __mxu_switch_to(prev, next)	do { (void) (prev); } while (0)
+
+#endif /* CONFIG_JZRISC_MXU */
+
+#endif /* _ASM_MXU_H */
@@ -101,6 +101,13 @@ struct mips_dsp_state {
 	unsigned int    dspcontrol;
 };
 
+#define NUM_MXU_REGS	15
+
+struct xburst_mxu_state {
+	unsigned long	xr[NUM_MXU_REGS];	/* xr1-xr15 */
+	unsigned long	cr;			/* xr16, MXU_CR */
+};
+
 #define INIT_CPUMASK { \
 	{0,} \
 }
@@ -204,6 +211,11 @@ struct thread_struct {
 	/* Saved state of the DSP ASE, if available. */
 	struct mips_dsp_state dsp;
 
+#ifdef CONFIG_JZRISC_MXU
+	/* Saved state of the XBurst MXU, if the task enabled it. */
+	struct xburst_mxu_state mxu;
+#endif
+
 	/* Saved watch register state, if available. */
 	union mips_watch_reg_state watch;
 
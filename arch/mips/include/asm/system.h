@@ -20,6 +20,7 @@
 #include <asm/cmpxchg.h>
 #include <asm/cpu-features.h>
 #include <asm/dsp.h>
+#include <asm/mxu.h>
 #include <asm/watch.h>
 #include <asm/war.h>
 
@@ -68,6 +69,7 @@ do {									\
 	__mips_mt_fpaff_switch_to(prev);				\
 	if (cpu_has_dsp)						\
 		__save_dsp(prev);					\
+	__mxu_switch_to(prev, next);					\
 	(last) = resume(prev, next, task_thread_info(next));		\
 } while (0)
 
@@ -591,7 +591,8 @@ static int mmc_read_proc (char *page, char **start, off_t off,
         return len;
 }
 
-#ifndef CONFIG_ANDROID_PMEM	/* /dev/pmem instead /proc/jz/imem on android platform */
+/* /dev/pmem (android) or /dev/jzmem instead of /proc/jz/imem */
+#if !defined(CONFIG_ANDROID_PMEM) && !defined(CONFIG_JZ_CMEM)
 
 /***********************************************************************
  * IPU memory management (used by mplayer and other apps)
@@ -1015,7 +1016,7 @@ static int imem1_write_proc(struct file *file, const char *buffer, unsigned long
 	return count;
 }
 
-#endif	/* #ifndef CONFIG_ANDROID_PMEM */
+#endif	/* !CONFIG_ANDROID_PMEM && !CONFIG_JZ_CMEM */
 
 static int fpu_write_proc(struct file *file, const char *buffer, unsigned long count, void *data)
 {
@@ -1076,7 +1077,7 @@ static int idle_write_proc(struct file *file, const char *buffer, unsigned long
 static int __init jz_proc_init(void)
 {
 	struct proc_dir_entry *res;
-#ifndef CONFIG_ANDROID_PMEM
+#if !defined(CONFIG_ANDROID_PMEM) && !defined(CONFIG_JZ_CMEM)
 	unsigned int virt_addr, i;
 #endif
 
@@ -1138,7 +1139,7 @@ static int __init jz_proc_init(void)
 		res->data = NULL;
 	}
 
-#ifndef CONFIG_ANDROID_PMEM
+#if !defined(CONFIG_ANDROID_PMEM) && !defined(CONFIG_JZ_CMEM)
 	/*
 	 * Reserve a 16MB memory for IPU on JZ4760.
 	 */
@@ -1194,7 +1195,7 @@ static int __init jz_proc_init(void)
         else
            printk("NOT enough memory for imem1\n");
 
-#endif	/* #ifdef CONFIG_ANDROID_PMEM */
+#endif	/* !CONFIG_ANDROID_PMEM && !CONFIG_JZ_CMEM */
 
 	/* fpu */
 	res = create_proc_entry("fpu", 0644, proc_jz_root);
@@ -1,7 +1,7 @@
 /*
  * linux/arch/mips/jz4760b/cpufreq.c
  *
- * cpufreq driver for JZ4760B 
+ * cpufreq driver for JZ4760B
  *
  * Copyright (c) 2006-2008  Ingenic Semiconductor Inc.
  * Author: <lhhuang@ingenic.cn>
@@ -14,513 +14,557 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/init.h>
+#include <linux/sched.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
 
 #include <linux/cpufreq.h>
 
 #include <asm/jzsoc.h>
 #include <asm/processor.h>
+#include <asm/cacheops.h>
 
 #define dprintk(msg...) cpufreq_debug_printk(CPUFREQ_DEBUG_DRIVER, \
 						"cpufreq-jz4760b", msg)
 
-#undef CHANGE_PLL
+/* CPU cycles needed to wait 500ns after changing the clock dividers */
+#define PLL_WAIT_500NS (cpm_get_clock(CGU_CCLK) / 2000000)
 
-#define PLL_UNCHANGED 0
-#define PLL_GOES_UP   1
-#define PLL_GOES_DOWN 2
+/*
+ * PLL0 runs from the 12MHz EXTAL with N = 2 and NO = 2 for every
+ * operating point, so the output is 6MHz * PLLM.
+ */
+#define JZ_PLL_N		2
+#define JZ_PLL_OD		1
+#define JZ_PLL_STEP		(JZ_EXTAL / (JZ_PLL_N << JZ_PLL_OD) * 2)
+
+/* Highest DDR/AHB clock any operating point may run at, Hz */
+#define JZ_MAX_MCLK		200000000
+
+/* DDRC_CTRL_RDC must only be set while the DDR clock is above 60MHz */
+#define JZ_RDC_MIN_MCLK		60000000
 
-#define PLL_WAIT_500NS (500*(__cpm_get_cclk()/1000000000))
+/*
+ * Operating points.  Bus clocks (H, H2, P, M and S) all run at
+ * PLL / bdiv and are kept at or below JZ_MAX_MCLK.
+ */
+struct jz4760b_opp {
+	unsigned int pll;	/* PLL0 output, MHz */
+	unsigned int cdiv;	/* CCLK = PLL / cdiv */
+	unsigned int bdiv;	/* bus clocks = PLL / bdiv */
+};
+
+static const struct jz4760b_opp jz4760b_opps[] = {
+	{ 360, 2, 4 },
+	{ 360, 1, 3 },
+	{ 420, 1, 3 },
+	{ 480, 1, 3 },
+	{ 528, 1, 3 },
+	{ 576, 1, 3 },
+	{ 624, 1, 4 },
+	{ 672, 1, 4 },
+	{ 720, 1, 4 },
+};
+
+#define JZ_NR_OPPS	ARRAY_SIZE(jz4760b_opps)
+
+static struct cpufreq_frequency_table jz4760b_freq_table[JZ_NR_OPPS + 1];
 
 /* Saved the boot-time parameters */
 static struct {
-	/* SDRAM parameters */
-	unsigned int mclk;  /* memory clock, KHz */
-	unsigned int tras;  /* RAS pulse width, cycles of mclk */
-	unsigned int rcd;   /* RAS to CAS Delay, cycles of mclk */
-	unsigned int tpc;   /* RAS Precharge time, cycles of mclk */
-	unsigned int trwl;  /* Write Precharge Time, cycles of mclk */
-	unsigned int trc;   /* RAS Cycle Time, cycles of mclk */
-	unsigned int rtcor; /* Refresh Time Constant */
-	unsigned int sdram_initialized;
-
-	/* LCD parameters */
-	unsigned int lcdpix_clk; /* LCD Pixel clock, Hz */
-	unsigned int lcd_clks_initialized;
+	/* DDR parameters */
+	unsigned int mclk;	/* memory clock, KHz */
+	u32 timing1;		/* DDRC_TIMING1, cycles of mclk */
+	u32 timing2;		/* DDRC_TIMING2, cycles of mclk */
+	u32 refcnt;		/* DDRC_REFCNT */
+	unsigned int pll;	/* PLL0 output, Hz */
+	int pll_locked;		/* PLL1 is fed from PLL0, PLL0 must not move */
 } boot_config;
 
-struct jz4760b_freq_percpu_info {
-	struct cpufreq_frequency_table table[7];
+/*
+ * A DDRC timing field.  The boot loader programmed the field for the
+ * boot-time mclk; it is rescaled from there for every operating point.
+ */
+struct jz_dram_field {
+	unsigned int lsb;
+	u32 mask;
+	unsigned int max;
+};
+
+static const struct jz_dram_field jz_timing1_fields[] = {
+	{ DDRC_TIMING1_TRAS_BIT, DDRC_TIMING1_TRAS_MASK, 15 },
+	{ DDRC_TIMING1_TRTP_BIT, DDRC_TIMING1_TRTP_MASK, 3 },
+	{ DDRC_TIMING1_TRP_BIT,  DDRC_TIMING1_TRP_MASK,  7 },
+	{ DDRC_TIMING1_TRCD_BIT, DDRC_TIMING1_TRCD_MASK, 7 },
+	{ DDRC_TIMING1_TRC_BIT,  DDRC_TIMING1_TRC_MASK,  15 },
+	{ DDRC_TIMING1_TRRD_BIT, DDRC_TIMING1_TRRD_MASK, 3 },
+	{ DDRC_TIMING1_TWR_BIT,  DDRC_TIMING1_TWR_MASK,  5 },
+	{ DDRC_TIMING1_TWTR_BIT, DDRC_TIMING1_TWTR_MASK, 3 },
 };
 
-static struct jz4760b_freq_percpu_info jz4760b_freq_table;
+static const struct jz_dram_field jz_timing2_fields[] = {
+	{ DDRC_TIMING2_TRFC_BIT,   DDRC_TIMING2_TRFC_MASK,   15 },
+	{ DDRC_TIMING2_TMINSR_BIT, DDRC_TIMING2_TMINSR_MASK, 15 },
+	{ DDRC_TIMING2_TXP_BIT,    DDRC_TIMING2_TXP_MASK,    7 },
+	{ DDRC_TIMING2_TMRD_BIT,   DDRC_TIMING2_TMRD_MASK,   3 },
+};
 
 /*
- * This contains the registers value for an operating point.
- * If only part of a register needs to change then there is
- * a mask value for that register.
- * When going to a new operating point the current register
- * value is ANDed with the ~mask and ORed with the new value.
+ * Peripheral clocks divided down from PLL0.  Their dividers are
+ * recomputed whenever PLL0 moves so the peripheral keeps running at
+ * (or just below) the rate its driver asked for.
  */
-struct dpm_regs {
-	u32 cpccr;        /* Clock Freq Control Register */
-	u32 cpccr_mask;   /* Clock Freq Control Register mask */
-	u32 cppcr;        /* PLL1 Control Register */
-	u32 cppcr_mask;   /* PLL1 Control Register mask */
-	u32 pll_up_flag;  /* New PLL freq is higher than current or not */
+struct jz_pll_child {
+	unsigned long reg;	/* divider register */
+	u32 sel_mask;		/* clock source select bits ... */
+	u32 sel_pll0;		/* ... and their value when fed from PLL0 */
+	u32 div_mask;		/* divider field, lsb is bit 0 */
+	unsigned int rate;	/* nominal rate, Hz */
+	u32 div;		/* divider last programmed by us */
+};
+
+static struct jz_pll_child jz_pll_children[] = {
+	{ CPM_LPCDR,  LPCDR_LPCS, 0,          LPCDR_PIXDIV_MASK },
+	{ CPM_MSCCDR, MSCCDR_MCS, MSCCDR_MCS, MSCCDR_MSCDIV_MASK },
+	{ CPM_SSICDR, SSICDR_SCS, SSICDR_SCS, SSICDR_SSIDIV_MASK },
+	{ CPM_CIMCDR, 0,          0,          CIMCDR_CIMDIV_MASK },
 };
 
 extern jz_clocks_t jz_clocks;
 
 static void jz_update_clocks(void)
 {
-	/* Next clocks must be updated if we have changed 
+	/* Next clocks must be updated if we have changed
 	 * the PLL or divisors.
 	 */
-	jz_clocks.cclk = __cpm_get_cclk();
-	jz_clocks.hclk = __cpm_get_hclk();
-	jz_clocks.mclk = __cpm_get_mclk();
-	jz_clocks.pclk = __cpm_get_pclk();
-	jz_clocks.pixclk = __cpm_get_pixclk();
-	jz_clocks.i2sclk = __cpm_get_i2sclk();
-	jz_clocks.usbclk = __cpm_get_usbclk();
-	jz_clocks.mscclk = __cpm_get_mscclk(0);
-}
-
-static void
-jz_init_boot_config(void)
-{
-	if (!boot_config.lcd_clks_initialized) {
-		/* the first time to scale pll */
-		boot_config.lcdpix_clk = __cpm_get_pixclk();
-		boot_config.lcd_clks_initialized = 1;
-	}
+	jz_clocks.cclk = cpm_get_clock(CGU_CCLK);
+	jz_clocks.hclk = cpm_get_clock(CGU_HCLK);
+	jz_clocks.pclk = cpm_get_clock(CGU_PCLK);
+	jz_clocks.mclk = cpm_get_clock(CGU_MCLK);
+	jz_clocks.h1clk = cpm_get_clock(CGU_H2CLK);
+	jz_clocks.pixclk = cpm_get_clock(CGU_LPCLK);
+	jz_clocks.mscclk = cpm_get_clock(CGU_MSCCLK);
+}
 
-	if (!boot_config.sdram_initialized) {
-		/* the first time to scale frequencies */
-		unsigned int dmcr, rtcor;
-		unsigned int tras, rcd, tpc, trwl, trc;
-		
-		dmcr = REG_EMC_DMCR;
-		rtcor = REG_EMC_RTCOR;
-
-		tras = (dmcr >> 13) & 0x7;
-		rcd = (dmcr >> 11) & 0x3;
-		tpc = (dmcr >> 8) & 0x7;
-		trwl = (dmcr >> 5) & 0x3;
-		trc = (dmcr >> 2) & 0x7;
-
-		boot_config.mclk = __cpm_get_mclk() / 1000;
-		boot_config.tras = tras + 4;
-		boot_config.rcd = rcd + 1;
-		boot_config.tpc = tpc + 1;
-		boot_config.trwl = trwl + 1;
-		boot_config.trc = trc * 2 + 1;
-		boot_config.rtcor = rtcor;
-
-		boot_config.sdram_initialized = 1;
+static unsigned int jz_div_to_field(unsigned int div)
+{
+	switch (div) {
+	case 1: return 0;
+	case 2: return 1;
+	case 3: return 2;
+	case 4: return 3;
+	case 6: return 4;
+	default: return 5;	/* 8 */
 	}
 }
 
-static void jz_update_dram_rtcor(unsigned int new_mclk)
+static unsigned int jz_field_to_div(unsigned int val)
 {
-	unsigned int rtcor;
-	
-	new_mclk /= 1000;
-	rtcor = boot_config.rtcor * new_mclk / boot_config.mclk;
-	rtcor--;
-
-	if (rtcor < 1) rtcor = 1;
-	if (rtcor > 255) rtcor = 255;
+	static const unsigned int div[] = {1, 2, 3, 4, 6, 8};
 
-	REG_EMC_RTCOR = rtcor;
-	REG_EMC_RTCNT = rtcor;
+	return val < ARRAY_SIZE(div) ? div[val] : 1;
 }
 
-static void jz_update_dram_dmcr(unsigned int new_mclk)
+/* PLL0 output as seen by the peripheral dividers (pll0 or pll0/2) */
+static unsigned int jz_pll_src(unsigned int pll)
 {
-	unsigned int dmcr;
-	unsigned int tras, rcd, tpc, trwl, trc;
-	unsigned int valid_time, new_time; /* ns */
+	return (REG_CPM_CPCCR & CPCCR_PCS) ? pll : pll / 2;
+}
 
-	new_mclk /= 1000;
-	tras = boot_config.tras * new_mclk / boot_config.mclk;
-	rcd = boot_config.rcd * new_mclk / boot_config.mclk;
-	tpc = boot_config.tpc * new_mclk / boot_config.mclk;
-	trwl = boot_config.trwl * new_mclk / boot_config.mclk;
-	trc = boot_config.trc * new_mclk / boot_config.mclk;
+static unsigned int jz_opp_mclk(const struct jz4760b_opp *opp)
+{
+	return opp->pll * 1000 / opp->bdiv;	/* KHz */
+}
 
-	/* Validation checking */
-	valid_time = (boot_config.tras * 1000000) / boot_config.mclk;
-	new_time = (tras * 1000000) / new_mclk;
-	if (new_time < valid_time) tras += 1;
+static void __init jz_init_boot_config(void)
+{
+	boot_config.mclk = cpm_get_clock(CGU_MCLK) / 1000;
+	boot_config.timing1 = REG_DDRC_TIMING1;
+	boot_config.timing2 = REG_DDRC_TIMING2;
+	boot_config.refcnt = REG_DDRC_REFCNT;
+	boot_config.pll = cpm_get_pllout();
+
+	/* PLL1 divided down from PLL0 would move with it */
+	boot_config.pll_locked = (REG_CPM_CPPCR1 & CPPCR1_PLL1ON) &&
+				 (REG_CPM_CPPCR1 & CPPCR1_P1SCS);
+}
 
-	valid_time = (boot_config.rcd * 1000000) / boot_config.mclk;
-	new_time = (rcd * 1000000) / new_mclk;
-	if (new_time < valid_time) rcd += 1;
+/*
+ * Rescale one DDRC timing register from the boot-time mclk to new_mclk.
+ * Fields hold a cycle count minus one (or 2n + 1 for tRAS); scaling
+ * (val + 1) and rounding up covers both encodings.  When slowing down
+ * a field never gets larger than the boot value.
+ */
+static int jz_scale_dram_reg(u32 boot, const struct jz_dram_field *f,
+			     int nr, unsigned int new_mclk, u32 *reg)
+{
+	unsigned int val, scaled;
+	int i;
+
+	*reg = boot;
+	for (i = 0; i < nr; i++) {
+		val = (boot & f[i].mask) >> f[i].lsb;
+		if (val == 0)
+			continue;
+
+		scaled = DIV_ROUND_UP((val + 1) * new_mclk, boot_config.mclk);
+		if (new_mclk <= boot_config.mclk && scaled > val)
+			scaled = val;
+		if (scaled > f[i].max)
+			return -ERANGE;
+
+		*reg = (*reg & ~f[i].mask) | (scaled << f[i].lsb);
+	}
 
-	valid_time = (boot_config.tpc * 1000000) / boot_config.mclk;
-	new_time = (tpc * 1000000) / new_mclk;
-	if (new_time < valid_time) tpc += 1;
+	return 0;
+}
 
-	valid_time = (boot_config.trwl * 1000000) / boot_config.mclk;
-	new_time = (trwl * 1000000) / new_mclk;
-	if (new_time < valid_time) trwl += 1;
+static int jz_calc_dram_timing(unsigned int new_mclk, u32 *t1, u32 *t2)
+{
+	if (jz_scale_dram_reg(boot_config.timing1, jz_timing1_fields,
+			      ARRAY_SIZE(jz_timing1_fields), new_mclk, t1))
+		return -ERANGE;
 
-	valid_time = (boot_config.trc * 1000000) / boot_config.mclk;
-	new_time = (trc * 1000000) / new_mclk;
-	if (new_time < valid_time) trc += 2;
+	return jz_scale_dram_reg(boot_config.timing2, jz_timing2_fields,
+				 ARRAY_SIZE(jz_timing2_fields), new_mclk, t2);
+}
 
-	tras = (tras < 4) ? 4: tras;
-	tras = (tras > 11) ? 11: tras;
-	tras -= 4;
+/* The refresh interval is rounded down so it never exceeds tREFI */
+static int jz_calc_dram_refcnt(unsigned int new_mclk, u32 *refcnt)
+{
+	unsigned int con;
 
-	rcd = (rcd < 1) ? 1: rcd;
-	rcd = (rcd > 4) ? 4: rcd;
-	rcd -= 1;
+	con = (boot_config.refcnt & DDRC_REFCNT_CON_MASK) >> DDRC_REFCNT_CON_BIT;
+	con = (con + 1) * new_mclk / boot_config.mclk;
+	if (con < 2 || con > 256)
+		return -ERANGE;
 
-	tpc = (tpc < 1) ? 1: tpc;
-	tpc = (tpc > 8) ? 8: tpc;
-	tpc -= 1;
+	*refcnt = (boot_config.refcnt & ~DDRC_REFCNT_CON_MASK) |
+		  ((con - 1) << DDRC_REFCNT_CON_BIT);
+	return 0;
+}
 
-	trwl = (trwl < 1) ? 1: trwl;
-	trwl = (trwl > 4) ? 4: trwl;
-	trwl -= 1;
+static void jz_update_dram_refcnt(unsigned int new_mclk)
+{
+	u32 refcnt;
 
-	trc = (trc < 1) ? 1: trc;
-	trc = (trc > 15) ? 15: trc;
-	trc /= 2;	
+	if (!jz_calc_dram_refcnt(new_mclk, &refcnt))
+		REG_DDRC_REFCNT = refcnt;
+}
 
-	dmcr = REG_EMC_DMCR;
-	
-	dmcr &= ~(EMC_DMCR_TRAS_MASK | EMC_DMCR_RCD_MASK | EMC_DMCR_TPC_MASK | EMC_DMCR_TRWL_MASK | EMC_DMCR_TRC_MASK);
-	dmcr |= ((tras << EMC_DMCR_TRAS_BIT) | (rcd << EMC_DMCR_RCD_BIT) | (tpc << EMC_DMCR_TPC_BIT) | (trwl << EMC_DMCR_TRWL_BIT) | (trc << EMC_DMCR_TRC_BIT));
+static void jz_update_dram_timing(unsigned int new_mclk)
+{
+	u32 t1, t2;
 
-	REG_EMC_DMCR = dmcr;
+	if (!jz_calc_dram_timing(new_mclk, &t1, &t2)) {
+		REG_DDRC_TIMING1 = t1;
+		REG_DDRC_TIMING2 = t2;
+	}
 }
 
 static void jz_update_dram_prev(unsigned int cur_mclk, unsigned int new_mclk)
-{	
-	/* No risk, no fun: run with interrupts on! */
+{
 	if (new_mclk > cur_mclk) {
-		/* We're going FASTER, so first update TRAS, RCD, TPC, TRWL
-		 * and TRC of DMCR before changing the frequency.
-		 */
-		jz_update_dram_dmcr(new_mclk);
-	} else {
-		/* We're going SLOWER: first update RTCOR value
+		/* We're going FASTER, so first stretch the timings
 		 * before changing the frequency.
 		 */
-		jz_update_dram_rtcor(new_mclk);
+		jz_update_dram_timing(new_mclk);
+	} else if (new_mclk < cur_mclk) {
+		/* We're going SLOWER: first shorten the refresh
+		 * interval before changing the frequency.
+		 */
+		jz_update_dram_refcnt(new_mclk);
 	}
 }
 
 static void jz_update_dram_post(unsigned int cur_mclk, unsigned int new_mclk)
-{	
-	/* No risk, no fun: run with interrupts on! */
+{
 	if (new_mclk > cur_mclk) {
-		/* We're going FASTER, so update RTCOR
-		 * after changing the frequency 
+		/* We're going FASTER, so update the refresh interval
+		 * after changing the frequency
 		 */
-		jz_update_dram_rtcor(new_mclk);
-	} else {
-		/* We're going SLOWER: so update TRAS, RCD, TPC, TRWL
-		 * and TRC of DMCR after changing the frequency.
+		jz_update_dram_refcnt(new_mclk);
+	} else if (new_mclk < cur_mclk) {
+		/* We're going SLOWER: so tighten the timings
+		 * after changing the frequency.
 		 */
-		jz_update_dram_dmcr(new_mclk);
+		jz_update_dram_timing(new_mclk);
 	}
 }
 
-static void jz_scale_divisors(struct dpm_regs *regs)
+static void jz_scale_divisors(unsigned int cdiv, unsigned int bdiv)
 {
-	unsigned int cpccr;
-	unsigned int cur_mclk, new_mclk;
-	int div[] = {1, 2, 3, 4, 6, 8, 12, 16, 24, 32};
-	unsigned int tmp = 0, wait = PLL_WAIT_500NS; 
+	unsigned int cpccr, bus;
+	unsigned int tmp, wait = PLL_WAIT_500NS;
 
-	cpccr = REG_CPM_CPCCR;
-	cpccr &= ~((unsigned long)regs->cpccr_mask);
-	cpccr |= regs->cpccr;
-	cpccr |= CPM_CPCCR_CE;       /* update immediately */
-
-	cur_mclk = __cpm_get_mclk();
-	new_mclk = __cpm_get_pllout() / div[(cpccr & CPM_CPCCR_MDIV_MASK) >> CPM_CPCCR_MDIV_BIT];
+	bus = jz_div_to_field(bdiv);
 
-	/* Update some DRAM parameters before changing frequency */
-	jz_update_dram_prev(cur_mclk, new_mclk);
+	cpccr = REG_CPM_CPCCR;
+	cpccr &= ~(CPCCR_CDIV_MASK | CPCCR_HDIV_MASK | CPCCR_H2DIV_MASK |
+		   CPCCR_PDIV_MASK | CPCCR_MDIV_MASK | CPCCR_SDIV_MASK);
+	cpccr |= (jz_div_to_field(cdiv) << CPCCR_CDIV_LSB) |
+		(bus << CPCCR_HDIV_LSB) | (bus << CPCCR_H2DIV_LSB) |
+		(bus << CPCCR_PDIV_LSB) | (bus << CPCCR_MDIV_LSB) |
+		(bus << CPCCR_SDIV_LSB);
+	cpccr |= CPCCR_CE;       /* update immediately */
 
 	/* update register to change the clocks.
 	 * align this code to a cache line.
 	 */
 	__asm__ __volatile__(
+		".set push\n\t"
 		".set noreorder\n\t"
 		".align 5\n"
-		"sw %1,0(%0)\n\t"
-		"li %3,0\n\t"
+		"sw %2,0(%1)\n\t"
+		"li %0,0\n\t"
 		"1:\n\t"
-		"bne %3,%2,1b\n\t"
-		"addi %3, 1\n\t"
+		"bne %0,%3,1b\n\t"
+		"addi %0, 1\n\t"
 		"nop\n\t"
 		"nop\n\t"
 		"nop\n\t"
 		"nop\n\t"
-		".set reorder\n\t"
-		:
-		: "r" (CPM_CPCCR), "r" (cpccr), "r" (wait), "r" (tmp));
-
-	/* Update some other DRAM parameters after changing frequency */
-	jz_update_dram_post(cur_mclk, new_mclk);
+		".set pop\n\t"
+		: "=&r" (tmp)
+		: "r" (CPM_CPCCR), "r" (cpccr), "r" (wait)
+		: "memory");
 }
 
-#ifdef CHANGE_PLL
-/* Maintain the LCD clock and pixel clock */
-static void jz_scale_lcd_divisors(struct dpm_regs *regs)
-{	
-	unsigned int new_pll, new_lcd_div, new_lcdpix_div;
-	unsigned int cpccr;
-	unsigned int tmp = 0, wait = PLL_WAIT_500NS; 
-
-	if (!boot_config.lcd_clks_initialized) return;
-
-	new_pll = __cpm_get_pllout();
-	new_lcd_div = new_pll / boot_config.lcd_clk;
-	new_lcdpix_div = new_pll / boot_config.lcdpix_clk;
-
-	if (new_lcd_div < 1)
-		new_lcd_div = 1;
-	if (new_lcd_div > 16)
-		new_lcd_div = 16;
-
-	if (new_lcdpix_div < 1)
-		new_lcdpix_div = 1;
-	if (new_lcdpix_div > 512)
-		new_lcdpix_div = 512;
-
-//	REG_CPM_CPCCR2 = new_lcdpix_div - 1;
+/*
+ * Record the rate of every PLL0 child whose divider was changed behind
+ * our back (or never seen), before PLL0 moves away from cur_pll.
+ */
+static void jz_save_lcd_divisors(unsigned int cur_pll)
+{
+	struct jz_pll_child *c;
+	u32 reg, div;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(jz_pll_children); i++) {
+		c = &jz_pll_children[i];
+		reg = INREG32(c->reg);
+		div = reg & c->div_mask;
+		if ((reg & c->sel_mask) != c->sel_pll0)
+			continue;
+		if (c->rate && div == c->div)
+			continue;
+
+		c->rate = jz_pll_src(cur_pll) / (div + 1);
+		c->div = div;
+	}
+}
 
-	cpccr = REG_CPM_CPCCR;
-	cpccr &= ~CPM_CPCCR_LDIV_MASK;
-	cpccr |= ((new_lcd_div - 1) << CPM_CPCCR_LDIV_BIT);
-	cpccr |= CPM_CPCCR_CE;       /* update immediately */
+/*
+ * Maintain the LCD pixel clock (and the other PLL0 children) across a
+ * PLL change.  Dividers round up so a clock never ends up faster than
+ * the rate its driver programmed.
+ */
+static void jz_scale_lcd_divisors(unsigned int new_pll)
+{
+	struct jz_pll_child *c;
+	unsigned int src = jz_pll_src(new_pll);
+	u32 reg, div;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(jz_pll_children); i++) {
+		c = &jz_pll_children[i];
+		reg = INREG32(c->reg);
+		if ((reg & c->sel_mask) != c->sel_pll0 || !c->rate)
+			continue;
+
+		div = DIV_ROUND_UP(src, c->rate) - 1;
+		if (div > c->div_mask)
+			div = c->div_mask;
+
+		OUTREG32(c->reg, (reg & ~c->div_mask) | div);
+		c->div = div;
+	}
 
-	/* update register to change the clocks.
-	 * align this code to a cache line.
-	 */
-	__asm__ __volatile__(
-		".set noreorder\n\t"
-		".align 5\n"
-		"sw %1,0(%0)\n\t"
-		"li %3,0\n\t"
-		"1:\n\t"
-		"bne %3,%2,1b\n\t"
-		"addi %3, 1\n\t"
-		"nop\n\t"
-		"nop\n\t"
-		"nop\n\t"
-		"nop\n\t"
-		".set reorder\n\t"
-		:
-		: "r" (CPM_CPCCR), "r" (cpccr), "r" (wait), "r" (tmp));
+	SETREG32(CPM_CPCCR, CPCCR_CE);
 }
 
-static void jz_scale_pll(struct dpm_regs *regs)
+/*
+ * Relock PLL0 at a new frequency.  The system runs from EXTAL while the
+ * PLL is bypassed, so the whole sequence is pulled into the I-cache
+ * first and touches nothing but CPM registers: no instruction fetch or
+ * data access may reach DDR while it is clocked that slowly.
+ */
+static void jz_scale_pll(unsigned int new_pll)
 {
-	unsigned int cppcr;
-	unsigned int cur_mclk, new_mclk, new_pll;
-	int div[] = {1, 2, 3, 4, 6, 8, 12, 16, 24, 32};
-	int od[] = {1, 2, 2, 4};
+	unsigned int cppcr, tmp;
+	unsigned long flags, addr;
 
-	cppcr = REG_CPM_CPPCR;
-	cppcr &= ~(regs->cppcr_mask | CPM_CPPCR_PLLS | CPM_CPPCR_PLLEN | CPM_CPPCR_PLLST_MASK);
-	regs->cppcr &= ~CPM_CPPCR_PLLEN;
-	cppcr |= (regs->cppcr | 0xff);
+	cppcr = REG_CPM_CPPCR0;
+	cppcr &= ~(CPPCR0_PLLM_MASK | CPPCR0_PLLN_MASK | CPPCR0_PLLOD_MASK |
+		   CPPCR0_PLLEN | CPPCR0_PLLBP);
+	cppcr |= ((new_pll * 1000000 / JZ_PLL_STEP) << CPPCR0_PLLM_LSB) |
+		(JZ_PLL_N << CPPCR0_PLLN_LSB) |
+		(JZ_PLL_OD << CPPCR0_PLLOD_LSB) |
+		CPPCR0_PLLBP;
 
-	/* Update some DRAM parameters before changing frequency */
-	new_pll = JZ_EXTAL * ((cppcr>>23)+2) / ((((cppcr>>18)&0x1f)+2) * od[(cppcr>>16)&0x03]);
-	cur_mclk = __cpm_get_mclk();
-	new_mclk = new_pll / div[(REG_CPM_CPCCR>>16) & 0xf];
+	local_irq_save(flags);
 
-	/*
-	 * Update some SDRAM parameters
-	 */
-	jz_update_dram_prev(cur_mclk, new_mclk);
-
-	/* 
-	 * Update PLL, align code to cache line.
-	 */
-	cppcr |= CPM_CPPCR_PLLEN;
 	__asm__ __volatile__(
+		".set push\n\t"
 		".set noreorder\n\t"
-		".align 5\n"
-		"sw %1,0(%0)\n\t"
-		"nop\n\t"
+		".set mips32\n\t"
+		"la %0, 2f\n\t"
+		"cache %6, 0(%0)\n\t"
+		"cache %6, 32(%0)\n\t"
+		"cache %6, 64(%0)\n\t"
+		"b 2f\n\t"
 		"nop\n\t"
+		".align 5\n"
+		"2:\n\t"
+		"sw %3, 0(%2)\n\t"		/* bypass, PLL off, new M/N/OD */
+		"or %1, %3, %5\n\t"
+		"sw %1, 0(%2)\n\t"		/* PLL on, start relocking */
+		"3:\n\t"
+		"lw %0, 0(%2)\n\t"
+		"and %0, %0, %7\n\t"
+		"beqz %0, 3b\n\t"
 		"nop\n\t"
+		"xor %1, %1, %4\n\t"
+		"sw %1, 0(%2)\n\t"		/* leave bypass */
+		"lw %0, 0(%2)\n\t"
 		"nop\n\t"
 		"nop\n\t"
 		"nop\n\t"
 		"nop\n\t"
-		".set reorder\n\t"
-		:
-		: "r" (CPM_CPPCR), "r" (cppcr));
+		".set pop\n\t"
+		: "=&r" (addr), "=&r" (tmp)
+		: "r" (CPM_CPPCR0), "r" (cppcr), "r" (CPPCR0_PLLBP),
+		  "r" (CPPCR0_PLLEN), "i" (Fill), "r" (CPPCR0_PLLS)
+		: "memory");
 
-	/* Update some other DRAM parameters after changing frequency */
-	jz_update_dram_post(cur_mclk, new_mclk);
+	local_irq_restore(flags);
 }
-#endif
 
-static void jz4760b_transition(struct dpm_regs *regs)
+/*
+ * Move from cur to new in up to two steps, retiming DRAM around each
+ * one for the mclk it actually runs at.  The PLL and dividers are
+ * ordered so that no clock overshoots the faster of the two points.
+ */
+static void jz4760b_transition(const struct jz4760b_opp *cur,
+			       const struct jz4760b_opp *new)
 {
-	/*
-	 * Get and save some boot-time conditions.
-	 */
-	jz_init_boot_config();
+	struct jz4760b_opp mid;
+	unsigned int cur_mclk = jz_opp_mclk(cur);
+	unsigned int new_mclk = jz_opp_mclk(new);
+	unsigned int mid_mclk;
 
-#ifdef CHANGE_PLL
-	/* 
-	 * Disable LCD before scaling pll.
-	 * LCD and LCD pixel clocks should not be changed even if the PLL 
-	 * output frequency has been changed.
-	 */
-	REG_LCD_CTRL &= ~LCD_CTRL_ENA;
-
-	/*
-	 * Stop module clocks before scaling PLL
-	 */
-	__cpm_stop_eth();
-	__cpm_stop_aic(1);
-	__cpm_stop_aic(2);
-#endif
-
-	/* ... add more as necessary */
-
-	if (regs->pll_up_flag == PLL_GOES_UP) {
-		/* the pll frequency is going up, so change dividors first */
-		jz_scale_divisors(regs);
-#ifdef CHANGE_PLL
-		jz_scale_pll(regs);
-#endif
-	}
-	else if (regs->pll_up_flag == PLL_GOES_DOWN) {
-		/* the pll frequency is going down, so change pll first */
-#ifdef CHANGE_PLL
-		jz_scale_pll(regs);
-#endif
-		jz_scale_divisors(regs);
-	}
-	else {
+	if (new->pll == cur->pll) {
 		/* the pll frequency is unchanged, so change divisors only */
-		jz_scale_divisors(regs);
+		jz_update_dram_prev(cur_mclk, new_mclk);
+		jz_scale_divisors(new->cdiv, new->bdiv);
+		jz_update_dram_post(cur_mclk, new_mclk);
+		goto out;
 	}
 
-#ifdef CHANGE_PLL
-	/*
-	 * Restart module clocks before scaling PLL
-	 */
-	__cpm_start_eth();
-	__cpm_start_aic(1);
-	__cpm_start_aic(2);
+	jz_save_lcd_divisors(cpm_get_pllout());
 
-	/* ... add more as necessary */
+	if (new->pll > cur->pll) {
+		/* the pll frequency is going up, so change dividers first */
+		mid.pll = cur->pll;
+		mid.cdiv = new->cdiv;
+		mid.bdiv = new->bdiv;
+		mid_mclk = jz_opp_mclk(&mid);
 
-	/* Scale the LCD divisors after scaling pll */
-	if (regs->pll_up_flag != PLL_UNCHANGED) {
-		jz_scale_lcd_divisors(regs);
-	}
+		jz_update_dram_prev(cur_mclk, mid_mclk);
+		jz_scale_divisors(new->cdiv, new->bdiv);
+		jz_scale_lcd_divisors(new->pll * 1000000);
+		jz_update_dram_post(cur_mclk, mid_mclk);
 
-	/* Enable LCD controller */
-	REG_LCD_CTRL &= ~LCD_CTRL_DIS;
-	REG_LCD_CTRL |= LCD_CTRL_ENA;
-#endif
+		jz_update_dram_prev(mid_mclk, new_mclk);
+		jz_scale_pll(new->pll);
+		jz_update_dram_post(mid_mclk, new_mclk);
+	} else {
+		/* the pll frequency is going down, so change pll first */
+		mid.pll = new->pll;
+		mid.cdiv = cur->cdiv;
+		mid.bdiv = cur->bdiv;
+		mid_mclk = jz_opp_mclk(&mid);
+
+		jz_update_dram_prev(cur_mclk, mid_mclk);
+		jz_scale_pll(new->pll);
+		jz_scale_lcd_divisors(new->pll * 1000000);
+		jz_update_dram_post(cur_mclk, mid_mclk);
+
+		jz_update_dram_prev(mid_mclk, new_mclk);
+		jz_scale_divisors(new->cdiv, new->bdiv);
+		jz_update_dram_post(mid_mclk, new_mclk);
+	}
 
+out:
 	/* Update system clocks */
 	jz_update_clocks();
 }
 
-extern unsigned int idle_times;
-static unsigned int jz4760b_freq_get(unsigned int cpu)
+/* Describe the running hardware as an operating point */
+static void jz_get_cur_opp(struct jz4760b_opp *opp)
 {
-	return  (__cpm_get_cclk() / 1000);
+	opp->pll = cpm_get_pllout() / 1000000;
+	opp->cdiv = jz_field_to_div(__cpm_get_cdiv());
+	opp->bdiv = jz_field_to_div(__cpm_get_mdiv());
 }
 
-static unsigned int index_to_divisor(unsigned int index, struct dpm_regs *regs)
+static int __init jz_opp_valid(const struct jz4760b_opp *opp)
 {
-	int n2FR[33] = {
-		0, 0, 1, 2, 3, 0, 4, 0, 5, 0, 0, 0, 6, 0, 0, 0,
-		7, 0, 0, 0, 0, 0, 0, 0, 8, 0, 0, 0, 0, 0, 0, 0,
-		9
-	};
-	int div[4] = {1, 2, 2, 2}; /* divisors of I:S:P:M */
-	unsigned int div_of_cclk, new_freq, i;
-
-	regs->pll_up_flag = PLL_UNCHANGED;
-	regs->cpccr_mask = CPM_CPCCR_CDIV_MASK | CPM_CPCCR_HDIV_MASK | CPM_CPCCR_PDIV_MASK | CPM_CPCCR_MDIV_MASK;
-
-	new_freq = jz4760b_freq_table.table[index].frequency;
-
-	do {
-		div_of_cclk = __cpm_get_pllout() / (1000 * new_freq);
-	} while (div_of_cclk==0);
-
-	if(div_of_cclk == 1 || div_of_cclk == 2 || div_of_cclk == 4) {
-		for(i = 1; i<4; i++) {
-			div[i] = 3;
-		}
-	} else {
-		for(i = 1; i<4; i++) {
-			div[i] = 2;
-		}
-	}
-
-	for(i = 0; i<4; i++) {
-		div[i] *= div_of_cclk;
-	}
-
-	dprintk("divisors of I:S:P:M = %d:%d:%d:%d\n", div[0], div[1], div[2], div[3]);
-
-	regs->cpccr = 
-		(n2FR[div[0]] << CPM_CPCCR_CDIV_BIT) | 
-		(n2FR[div[1]] << CPM_CPCCR_HDIV_BIT) | 
-		(n2FR[div[2]] << CPM_CPCCR_PDIV_BIT) |
-		(n2FR[div[3]] << CPM_CPCCR_MDIV_BIT);
-
-	return  div_of_cclk;
+	unsigned int mclk = jz_opp_mclk(opp);
+	u32 t1, t2, refcnt;
+
+	if (opp->pll * 1000000 % JZ_PLL_STEP)
+		return 0;
+	if (boot_config.pll_locked &&
+	    opp->pll * 1000000 != boot_config.pll)
+		return 0;
+	if (mclk * 1000 > JZ_MAX_MCLK)
+		return 0;
+	if ((REG_DDRC_CTRL & DDRC_CTRL_RDC) && mclk * 1000 < JZ_RDC_MIN_MCLK)
+		return 0;
+
+	return !jz_calc_dram_timing(mclk, &t1, &t2) &&
+	       !jz_calc_dram_refcnt(mclk, &refcnt);
 }
 
-static void jz4760b_set_cpu_divider_index(unsigned int cpu, unsigned int index)
+static unsigned int jz4760b_freq_get(unsigned int cpu)
 {
-	unsigned long divisor, old_divisor;
-	struct cpufreq_freqs freqs;
-	struct dpm_regs regs;
-
-	old_divisor = __cpm_get_pllout() /  __cpm_get_cclk();
-	divisor = index_to_divisor(index, &regs);
-
-	freqs.old = __cpm_get_cclk() / 1000;
-	freqs.new =  __cpm_get_pllout() / (1000 * divisor);
-	freqs.cpu = cpu;
-
-	cpufreq_notify_transition(&freqs, CPUFREQ_PRECHANGE);
-
-	if (old_divisor != divisor)
-		jz4760b_transition(&regs);
-
-	cpufreq_notify_transition(&freqs, CPUFREQ_POSTCHANGE);
+	return cpm_get_clock(CGU_CCLK) / 1000;
 }
 
 static int jz4760b_freq_target(struct cpufreq_policy *policy,
 			  unsigned int target_freq,
 			  unsigned int relation)
 {
+	struct jz4760b_opp cur;
+	struct cpufreq_freqs freqs;
 	unsigned int new_index = 0;
 
 	if (cpufreq_frequency_table_target(policy,
-					   &jz4760b_freq_table.table[0],
+					   &jz4760b_freq_table[0],
 					   target_freq, relation, &new_index))
 		return -EINVAL;
 
-	jz4760b_set_cpu_divider_index(policy->cpu, new_index);
+	jz_get_cur_opp(&cur);
 
-	dprintk("new frequency is %d KHz (REG_CPM_CPCCR:0x%x)\n", __cpm_get_cclk() / 1000, REG_CPM_CPCCR);
+	freqs.old = jz4760b_freq_get(policy->cpu);
+	freqs.new = jz4760b_freq_table[new_index].frequency;
+	freqs.cpu = policy->cpu;
+
+	if (freqs.old == freqs.new &&
+	    cur.bdiv == jz4760b_opps[new_index].bdiv)
+		return 0;
+
+	cpufreq_notify_transition(&freqs, CPUFREQ_PRECHANGE);
+	jz4760b_transition(&cur, &jz4760b_opps[new_index]);
+	cpufreq_notify_transition(&freqs, CPUFREQ_POSTCHANGE);
+
+	dprintk("new frequency is %d KHz (REG_CPM_CPCCR:0x%x REG_CPM_CPPCR0:0x%x)\n",
+		jz4760b_freq_get(policy->cpu), REG_CPM_CPCCR, REG_CPM_CPPCR0);
 
 	return 0;
 }
@@ -528,65 +572,243 @@ static int jz4760b_freq_target(struct cpufreq_policy *policy,
 static int jz4760b_freq_verify(struct cpufreq_policy *policy)
 {
 	return cpufreq_frequency_table_verify(policy,
-					      &jz4760b_freq_table.table[0]);
+					      &jz4760b_freq_table[0]);
 }
 
 static int __init jz4760b_cpufreq_driver_init(struct cpufreq_policy *policy)
 {
-
-	struct cpufreq_frequency_table *table =	&jz4760b_freq_table.table[0];
-	unsigned int MAX_FREQ;
+	struct cpufreq_frequency_table *table =	&jz4760b_freq_table[0];
+	int i, nr_valid = 0;
 
 	dprintk(KERN_INFO "Jz4760b cpufreq driver\n");
 
 	if (policy->cpu != 0)
 		return -EINVAL;
 
-	policy->cur = MAX_FREQ = __cpm_get_cclk() / 1000; /* in kHz. Current and max frequency is determined by u-boot */
+	if (REG_CPM_CPPSR & (CPPSR_PLLBP | CPPSR_PLLOFF))
+		return -ENODEV;
+
+	jz_init_boot_config();
+
+	for (i = 0; i < JZ_NR_OPPS; i++) {
+		table[i].index = i;
+		if (jz_opp_valid(&jz4760b_opps[i])) {
+			table[i].frequency = jz4760b_opps[i].pll * 1000 /
+					     jz4760b_opps[i].cdiv;
+			nr_valid++;
+		} else {
+			table[i].frequency = CPUFREQ_ENTRY_INVALID;
+			dprintk("skipping %u MHz / %u: DDR cannot be retimed\n",
+				jz4760b_opps[i].pll, jz4760b_opps[i].cdiv);
+		}
+	}
+	table[i].index = i;
+	table[i].frequency = CPUFREQ_TABLE_END;
+
+	if (!nr_valid)
+		return -ENODEV;
+
+	policy->cur = jz4760b_freq_get(policy->cpu);
 	policy->governor = CPUFREQ_DEFAULT_GOVERNOR;
+	policy->cpuinfo.transition_latency = 500000; /* in 10^(-9) s = nanoseconds */
 
-	policy->cpuinfo.min_freq = MAX_FREQ/8;
-	policy->cpuinfo.max_freq = MAX_FREQ;
-	policy->cpuinfo.transition_latency = 100000; /* in 10^(-9) s = nanoseconds */
-
-	table[0].index = 0;
-	table[0].frequency = MAX_FREQ/8;
-	table[1].index = 1;
-	table[1].frequency = MAX_FREQ/6;
-	table[2].index = 2;
-	table[2].frequency = MAX_FREQ/4;
-	table[3].index = 3;
-	table[3].frequency = MAX_FREQ/3;
-	table[4].index = 4;
-	table[4].frequency = MAX_FREQ/2;
-	table[5].index = 5;
-	table[5].frequency = MAX_FREQ;
-	table[6].index = 6;
-	table[6].frequency = CPUFREQ_TABLE_END;
-
-#ifdef CONFIG_CPU_FREQ_STAT_DETAILS
 	cpufreq_frequency_table_get_attr(table, policy->cpu); /* for showing /sys/devices/system/cpu/cpuX/cpufreq/stats/ */
-#endif
 
 	return  cpufreq_frequency_table_cpuinfo(policy, table);
 }
 
+static int jz4760b_cpufreq_driver_exit(struct cpufreq_policy *policy)
+{
+	cpufreq_frequency_table_put_attr(policy->cpu);
+	return 0;
+}
+
+static struct freq_attr *jz4760b_cpufreq_attr[] = {
+	&cpufreq_freq_attr_scaling_available_freqs,
+	NULL,
+};
+
 static struct cpufreq_driver cpufreq_jz4760b_driver = {
 //	.flags		= CPUFREQ_STICKY,
 	.init		= jz4760b_cpufreq_driver_init,
+	.exit		= jz4760b_cpufreq_driver_exit,
 	.verify		= jz4760b_freq_verify,
 	.target		= jz4760b_freq_target,
 	.get		= jz4760b_freq_get,
 	.name		= "jz4760b",
+	.attr		= jz4760b_cpufreq_attr,
+};
+
+/*
+ * Performance profiles: /proc/jz/cpufreq_profile
+ *
+ * Every open file descriptor is one profile.  Writing a frequency in
+ * KHz (or "max") raises the cpufreq floor to at least that value for
+ * as long as the descriptor stays open; writing 0 drops it.  Since the
+ * descriptor is inherited across fork() and exec(), a launcher can do
+ *
+ *	exec 9>/proc/jz/cpufreq_profile; echo max >&9; exec emulator
+ *
+ * and the floor lasts exactly as long as the emulator runs, while the
+ * governor is free to idle the menu low the rest of the time.
+ */
+struct jz_profile {
+	struct list_head list;
+	pid_t tgid;
+	char comm[TASK_COMM_LEN];
+	unsigned int min_freq;	/* KHz */
+};
+
+static LIST_HEAD(jz_profiles);
+static DEFINE_MUTEX(jz_profile_lock);
+static unsigned int jz_profile_min;	/* KHz, highest floor in use */
+
+static void jz_profile_update(void)
+{
+	struct jz_profile *p;
+	unsigned int min = 0;
+
+	mutex_lock(&jz_profile_lock);
+	list_for_each_entry(p, &jz_profiles, list)
+		min = max(min, p->min_freq);
+	jz_profile_min = min;
+	mutex_unlock(&jz_profile_lock);
+
+	cpufreq_update_policy(0);
+}
+
+static int jz_profile_policy_notifier(struct notifier_block *nb,
+				      unsigned long val, void *data)
+{
+	struct cpufreq_policy *policy = data;
+	unsigned int min = jz_profile_min;
+
+	if (val != CPUFREQ_ADJUST || !min)
+		return 0;
+
+	if (min > policy->cpuinfo.max_freq)
+		min = policy->cpuinfo.max_freq;
+	cpufreq_verify_within_limits(policy, min, policy->cpuinfo.max_freq);
+
+	return 0;
+}
+
+static struct notifier_block jz_profile_nb = {
+	.notifier_call = jz_profile_policy_notifier,
+};
+
+static int jz_profile_show(struct seq_file *m, void *v)
+{
+	struct jz_profile *p;
+
+	mutex_lock(&jz_profile_lock);
+	seq_printf(m, "floor: %u\n", jz_profile_min);
+	list_for_each_entry(p, &jz_profiles, list)
+		if (p->min_freq)
+			seq_printf(m, "%d %s %u\n", p->tgid, p->comm,
+				   p->min_freq);
+	mutex_unlock(&jz_profile_lock);
+
+	return 0;
+}
+
+static int jz_profile_open(struct inode *inode, struct file *file)
+{
+	struct jz_profile *p;
+	int ret;
+
+	ret = single_open(file, jz_profile_show, NULL);
+	if (ret || !(file->f_mode & FMODE_WRITE))
+		return ret;
+
+	p = kzalloc(sizeof(*p), GFP_KERNEL);
+	if (!p) {
+		single_release(inode, file);
+		return -ENOMEM;
+	}
+
+	p->tgid = current->tgid;
+	get_task_comm(p->comm, current);
+
+	mutex_lock(&jz_profile_lock);
+	list_add_tail(&p->list, &jz_profiles);
+	mutex_unlock(&jz_profile_lock);
+
+	((struct seq_file *)file->private_data)->private = p;
+	return 0;
+}
+
+static ssize_t jz_profile_write(struct file *file, const char __user *buffer,
+				size_t count, loff_t *ppos)
+{
+	struct jz_profile *p = ((struct seq_file *)file->private_data)->private;
+	char buf[16];
+	unsigned long freq;
+
+	if (!p)
+		return -EBADF;
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, buffer, count))
+		return -EFAULT;
+	buf[count] = '\0';
+	strstrip(buf);
+
+	if (!strcmp(buf, "max"))
+		freq = UINT_MAX;
+	else if (strict_strtoul(buf, 0, &freq))
+		return -EINVAL;
+
+	p->min_freq = freq;
+	jz_profile_update();
+
+	return count;
+}
+
+static int jz_profile_release(struct inode *inode, struct file *file)
+{
+	struct jz_profile *p = ((struct seq_file *)file->private_data)->private;
+
+	if (p) {
+		mutex_lock(&jz_profile_lock);
+		list_del(&p->list);
+		mutex_unlock(&jz_profile_lock);
+
+		if (p->min_freq)
+			jz_profile_update();
+		kfree(p);
+	}
+
+	return single_release(inode, file);
+}
+
+static const struct file_operations jz_profile_fops = {
+	.owner		= THIS_MODULE,
+	.open		= jz_profile_open,
+	.read		= seq_read,
+	.write		= jz_profile_write,
+	.llseek		= seq_lseek,
+	.release	= jz_profile_release,
 };
 
 static int __init jz4760b_cpufreq_init(void)
 {
-	return cpufreq_register_driver(&cpufreq_jz4760b_driver);
+	int ret;
+
+	ret = cpufreq_register_driver(&cpufreq_jz4760b_driver);
+	if (ret)
+		return ret;
+
+	cpufreq_register_notifier(&jz_profile_nb, CPUFREQ_POLICY_NOTIFIER);
+	proc_create("jz/cpufreq_profile", 0644, NULL, &jz_profile_fops);
+
+	return 0;
 }
 
 static void __exit jz4760b_cpufreq_exit(void)
 {
+	remove_proc_entry("jz/cpufreq_profile", NULL);
+	cpufreq_unregister_notifier(&jz_profile_nb, CPUFREQ_POLICY_NOTIFIER);
 	cpufreq_unregister_driver(&cpufreq_jz4760b_driver);
 }
 
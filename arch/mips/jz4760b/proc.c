@@ -560,6 +560,8 @@ static int mmc_read_proc (char *page, char **start, off_t off,
 
 #ifndef CONFIG_ANDROID_PMEM	/* /dev/pmem instead /proc/jz/imem on android platform */
 
+#ifndef CONFIG_JZ_CMEM		/* /dev/jzmem instead of /proc/jz/imem */
+
 /***********************************************************************
  * IPU memory management (used by mplayer and other apps)
  *
@@ -935,6 +937,8 @@ static int imem_read_proc(char *page, char **start, off_t off,
 	return len;
 }
 
+#endif	/* !CONFIG_JZ_CMEM */
+
 static int div_write_proc(struct file *file, const char *buffer, unsigned long count, void *data)
 {
 #define Index_Writeback_Inv_D_PRIV	0x1c
@@ -1053,6 +1057,8 @@ L1:
 
 	local_irq_restore(cpuflags);
 }
+#ifndef CONFIG_JZ_CMEM
+
 static int imem_write_proc(struct file *file, const char *buffer, unsigned long count, void *data)
 {
 	unsigned int val;
@@ -1285,7 +1291,9 @@ static int imem2_write_proc(struct file *file, const char *buffer, unsigned long
 	return count;
 }
 
-#endif	/* #ifndef CONFIG_ANDROID_PMEM */
+#endif	/* ADD_IMEM2 */
+
+#endif	/* !CONFIG_JZ_CMEM */
 
 static int fpu_write_proc(struct file *file, const char *buffer, unsigned long count, void *data)
 {
@@ -1299,7 +1307,7 @@ static int fpu_write_proc(struct file *file, const char *buffer, unsigned long c
 	return count;
 }
 
-#endif
+#endif	/* #ifndef CONFIG_ANDROID_PMEM */
 
 /*
  * /proc/jz/xxx entry
@@ -1308,7 +1316,7 @@ static int fpu_write_proc(struct file *file, const char *buffer, unsigned long c
 static int __init jz_proc_init(void)
 {
 	struct proc_dir_entry *res;
-#ifndef CONFIG_ANDROID_PMEM
+#ifndef CONFIG_JZ_CMEM
 	unsigned int virt_addr, i;
 #endif
 
@@ -1368,8 +1376,7 @@ static int __init jz_proc_init(void)
 		res->data = NULL;
 	}
 
-//#ifndef CONFIG_ANDROID_PMEM
-#if 1
+#ifndef CONFIG_JZ_CMEM
 	/*
 	 * Reserve a 16MB memory for IPU on JZ4760B.
 	 */
@@ -1452,7 +1459,7 @@ static int __init jz_proc_init(void)
         else
            printk("NOT enough memory for imem2\n");
  #endif
-#endif	/* #ifdef CONFIG_ANDROID_PMEM */
+#endif	/* !CONFIG_JZ_CMEM */
 
 	/* fpu */
 	res = create_proc_entry("fpu", 0644, proc_jz_root);
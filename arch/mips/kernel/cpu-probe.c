@@ -19,6 +19,7 @@
 
 #include <asm/bugs.h>
 #include <asm/cpu.h>
+#include <asm/elf.h>
 #include <asm/fpu.h>
 #include <asm/mipsregs.h>
 #include <asm/system.h>
@@ -909,6 +910,11 @@ static inline void cpu_probe_ingenic(struct cpuinfo_mips *c, unsigned int cpu)
 
 		__cpu_name[cpu] = "Ingenic JZRISC";
 
+#ifdef CONFIG_JZRISC_MXU
+		c->ases |= MIPS_ASE_MXU;
+		elf_hwcap |= HWCAP_MIPS_MXU;
+#endif
+
 		if (__cpu_has_fpu())
 		{
 			unsigned int tmp,mask;
@@ -931,6 +937,8 @@ static inline void cpu_probe_ingenic(struct cpuinfo_mips *c, unsigned int cpu)
 
 const char *__cpu_name[NR_CPUS];
 
+unsigned int elf_hwcap __read_mostly;
+
 __cpuinit void cpu_probe(void)
 {
 	struct cpuinfo_mips *c = &current_cpu_data;
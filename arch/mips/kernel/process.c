@@ -31,6 +31,7 @@
 #include <asm/bootinfo.h>
 #include <asm/cpu.h>
 #include <asm/dsp.h>
+#include <asm/mxu.h>
 #include <asm/fpu.h>
 #include <asm/pgtable.h>
 #include <asm/system.h>
@@ -97,6 +98,7 @@ void start_thread(struct pt_regs * regs, unsigned long pc, unsigned long sp)
 	clear_fpu_owner();
 	if (cpu_has_dsp)
 		__init_dsp();
+	init_mxu();
 	regs->cp0_epc = pc;
 	regs->regs[29] = sp;
 	current_thread_info()->addr_limit = USER_DS;
@@ -128,6 +130,8 @@ int copy_thread(unsigned long clone_flags, unsigned long usp,
 	if (cpu_has_dsp)
 		save_dsp(p);
 
+	save_mxu(p);
+
 	preempt_enable();
 
 	/* set up new TSS. */
@@ -221,6 +221,19 @@ static void __cpuinit set_prefetch_parameters(void)
 			}
 			break;
 
+		case CPU_JZRISC:
+			/*
+			 * XBurst has no streamed cache state, so use the plain
+			 * Load hint.  PrepareForStore needs no fill, so a short
+			 * store bias keeps the small D-cache from thrashing.
+			 */
+			pref_bias_clear_store = 64;
+			pref_bias_copy_load = 128;
+			pref_bias_copy_store = 64;
+			pref_src_mode = Pref_Load;
+			pref_dst_mode = Pref_PrepareForStore;
+			break;
+
 		default:
 			pref_bias_clear_store = 128;
 			pref_bias_copy_load = 256;
@@ -245,6 +258,12 @@ static void __cpuinit set_prefetch_parameters(void)
 	half_copy_loop_size = min(16 * copy_word_size,
 				  max(cache_line_size >> 1,
 				      4 * copy_word_size));
+
+	/* XBurst: two 32 byte lines per loop, halves the branch overhead */
+	if (current_cpu_type() == CPU_JZRISC && cache_line_size == 32) {
+		half_clear_loop_size = cache_line_size;
+		half_copy_loop_size = cache_line_size;
+	}
 }
 
 static void __cpuinit build_clear_store(u32 **buf, int off)
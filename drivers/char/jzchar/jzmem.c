@@ -0,0 +1,383 @@
+/*
+ * linux/drivers/char/jzchar/jzmem.c
+ *
+ * Physically contiguous memory for the video decoders and the IPU.
+ *
+ * A pool is reserved at boot and handed out in whole pages through
+ * /dev/jzmem, replacing the /proc/jz/imem text protocol.  Every buffer
+ * is owned by the file it was allocated through, so the buffers of a
+ * client are released when it closes the device or dies.
+ *
+ *  This program is free software; you can redistribute	 it and/or modify it
+ *  under  the terms of	 the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the	License, or (at your
+ *  option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/errno.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/miscdevice.h>
+#include <linux/genalloc.h>
+
+#include <asm/io.h>
+#include <asm/uaccess.h>
+
+#include "jzmem.h"
+
+#define JZMEM_CHUNK_ORDER	(MAX_ORDER - 1)
+
+struct jzmem_buf {
+	struct list_head list;
+	unsigned long phys;
+	unsigned long size;
+	unsigned int flags;
+	atomic_t maps;			/* vmas still mapping it */
+};
+
+struct jzmem_client {
+	struct list_head bufs;
+};
+
+static struct gen_pool *jzmem_pool;
+static unsigned long jzmem_total, jzmem_free;
+
+/* protects every client's buffer list and jzmem_free */
+static DEFINE_MUTEX(jzmem_lock);
+
+/*
+ * Find the buffer of client holding [phys, phys + size), called with
+ * jzmem_lock held.
+ */
+static struct jzmem_buf *jzmem_find(struct jzmem_client *client,
+				    unsigned long phys, unsigned long size)
+{
+	struct jzmem_buf *buf;
+
+	list_for_each_entry(buf, &client->bufs, list) {
+		if (phys >= buf->phys && phys - buf->phys < buf->size &&
+		    size <= buf->size - (phys - buf->phys))
+			return buf;
+	}
+
+	return NULL;
+}
+
+static void jzmem_release_buf(struct jzmem_buf *buf)
+{
+	list_del(&buf->list);
+	gen_pool_free(jzmem_pool, buf->phys, buf->size);
+	jzmem_free += buf->size;
+	kfree(buf);
+}
+
+static int jzmem_alloc(struct jzmem_client *client, struct jzmem_alloc *req)
+{
+	struct jzmem_buf *buf;
+	unsigned long size = PAGE_ALIGN(req->size);
+	void *virt;
+
+	if (!size || size > jzmem_total)
+		return -EINVAL;
+
+	buf = kmalloc(sizeof(*buf), GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	buf->phys = gen_pool_alloc(jzmem_pool, size);
+	if (!buf->phys) {
+		kfree(buf);
+		return -ENOMEM;
+	}
+	buf->size = size;
+	buf->flags = req->flags & JZMEM_CACHED;
+	atomic_set(&buf->maps, 0);
+
+	/*
+	 * Don't hand out what the last owner left behind, and don't leave
+	 * dirty lines that could later land on top of uncached writes.
+	 */
+	virt = phys_to_virt(buf->phys);
+	memset(virt, 0, size);
+	dma_cache_wback_inv((unsigned long)virt, size);
+
+	mutex_lock(&jzmem_lock);
+	list_add(&buf->list, &client->bufs);
+	jzmem_free -= size;
+	mutex_unlock(&jzmem_lock);
+
+	req->phys = buf->phys;
+	return 0;
+}
+
+static int jzmem_free_buf(struct jzmem_client *client, unsigned long phys)
+{
+	struct jzmem_buf *buf;
+	int ret = 0;
+
+	mutex_lock(&jzmem_lock);
+	buf = jzmem_find(client, phys, 0);
+	if (!buf || buf->phys != phys)
+		ret = -EINVAL;
+	else if (atomic_read(&buf->maps))
+		ret = -EBUSY;
+	else
+		jzmem_release_buf(buf);
+	mutex_unlock(&jzmem_lock);
+
+	return ret;
+}
+
+static int jzmem_sync(struct jzmem_client *client, struct jzmem_sync *req)
+{
+	unsigned long virt;
+	int ret = 0;
+
+	mutex_lock(&jzmem_lock);
+	if (!jzmem_find(client, req->phys, req->size)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	virt = (unsigned long)phys_to_virt(req->phys);
+	switch (req->op) {
+	case JZMEM_SYNC_CLEAN:
+		dma_cache_wback(virt, req->size);
+		break;
+	case JZMEM_SYNC_INV:
+		dma_cache_inv(virt, req->size);
+		break;
+	case JZMEM_SYNC_FLUSH:
+		dma_cache_wback_inv(virt, req->size);
+		break;
+	default:
+		ret = -EINVAL;
+	}
+out:
+	mutex_unlock(&jzmem_lock);
+	return ret;
+}
+
+/*
+ * fops routines
+ */
+
+static int jzmem_open(struct inode *inode, struct file *filp)
+{
+	struct jzmem_client *client;
+
+	client = kmalloc(sizeof(*client), GFP_KERNEL);
+	if (!client)
+		return -ENOMEM;
+
+	INIT_LIST_HEAD(&client->bufs);
+	filp->private_data = client;
+
+	return 0;
+}
+
+static int jzmem_release(struct inode *inode, struct file *filp)
+{
+	struct jzmem_client *client = filp->private_data;
+	struct jzmem_buf *buf, *next;
+
+	/* every vma holds the file, so nothing is mapped any more */
+	mutex_lock(&jzmem_lock);
+	list_for_each_entry_safe(buf, next, &client->bufs, list)
+		jzmem_release_buf(buf);
+	mutex_unlock(&jzmem_lock);
+
+	kfree(client);
+	return 0;
+}
+
+static int jzmem_ioctl(struct inode *inode, struct file *filp,
+		       unsigned int cmd, unsigned long arg)
+{
+	struct jzmem_client *client = filp->private_data;
+	void __user *argp = (void __user *)arg;
+
+	/* user copies stay outside jzmem_lock, a fault takes mmap_sem */
+	switch (cmd) {
+	case JZMEM_IOC_ALLOC: {
+		struct jzmem_alloc req;
+		int ret;
+
+		if (copy_from_user(&req, argp, sizeof(req)))
+			return -EFAULT;
+		ret = jzmem_alloc(client, &req);
+		if (ret)
+			return ret;
+		if (copy_to_user(argp, &req, sizeof(req))) {
+			jzmem_free_buf(client, req.phys);
+			return -EFAULT;
+		}
+		return 0;
+	}
+	case JZMEM_IOC_FREE: {
+		unsigned int phys;
+
+		if (get_user(phys, (unsigned int __user *)argp))
+			return -EFAULT;
+		return jzmem_free_buf(client, phys);
+	}
+	case JZMEM_IOC_SYNC: {
+		struct jzmem_sync req;
+
+		if (copy_from_user(&req, argp, sizeof(req)))
+			return -EFAULT;
+		return jzmem_sync(client, &req);
+	}
+	case JZMEM_IOC_INFO: {
+		struct jzmem_info info;
+
+		mutex_lock(&jzmem_lock);
+		info.total = jzmem_total;
+		info.free = jzmem_free;
+		mutex_unlock(&jzmem_lock);
+
+		if (copy_to_user(argp, &info, sizeof(info)))
+			return -EFAULT;
+		return 0;
+	}
+	}
+
+	return -ENOTTY;
+}
+
+static void jzmem_vma_open(struct vm_area_struct *vma)
+{
+	struct jzmem_buf *buf = vma->vm_private_data;
+
+	atomic_inc(&buf->maps);
+}
+
+static void jzmem_vma_close(struct vm_area_struct *vma)
+{
+	struct jzmem_buf *buf = vma->vm_private_data;
+
+	atomic_dec(&buf->maps);
+}
+
+static struct vm_operations_struct jzmem_vm_ops = {
+	.open	= jzmem_vma_open,
+	.close	= jzmem_vma_close,
+};
+
+/*
+ * The mmap offset is the physical address returned by JZMEM_IOC_ALLOC;
+ * the range must lie inside one buffer of this file.
+ */
+static int jzmem_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct jzmem_client *client = filp->private_data;
+	unsigned long phys = vma->vm_pgoff << PAGE_SHIFT;
+	unsigned long size = vma->vm_end - vma->vm_start;
+	struct jzmem_buf *buf;
+	int ret;
+
+	mutex_lock(&jzmem_lock);
+	buf = jzmem_find(client, phys, size);
+	if (!buf) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (!(buf->flags & JZMEM_CACHED))
+		vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+	vma->vm_flags |= VM_IO | VM_RESERVED;
+
+	ret = remap_pfn_range(vma, vma->vm_start, vma->vm_pgoff,
+			      size, vma->vm_page_prot);
+	if (ret)
+		goto out;
+
+	vma->vm_ops = &jzmem_vm_ops;
+	vma->vm_private_data = buf;
+	jzmem_vma_open(vma);
+out:
+	mutex_unlock(&jzmem_lock);
+	return ret;
+}
+
+static const struct file_operations jzmem_fops = {
+	.owner		= THIS_MODULE,
+	.open		= jzmem_open,
+	.release	= jzmem_release,
+	.ioctl		= jzmem_ioctl,
+	.mmap		= jzmem_mmap,
+};
+
+static struct miscdevice jzmem_dev = {
+	.minor	= MISC_DYNAMIC_MINOR,
+	.name	= "jzmem",
+	.fops	= &jzmem_fops,
+};
+
+/*
+ * Reserve the pool in chunks of the largest order the page allocator
+ * hands out; a buffer never straddles two chunks.
+ */
+static int __init jzmem_reserve(unsigned long size)
+{
+	while (size) {
+		unsigned int order = min(get_order(size), JZMEM_CHUNK_ORDER);
+		unsigned long virt, chunk, i;
+
+		virt = __get_free_pages(GFP_KERNEL | __GFP_NOWARN, order);
+		if (!virt)
+			break;
+
+		chunk = PAGE_SIZE << order;
+		for (i = 0; i < chunk; i += PAGE_SIZE)
+			SetPageReserved(virt_to_page((void *)(virt + i)));
+
+		if (gen_pool_add(jzmem_pool, virt_to_phys((void *)virt),
+				 chunk, -1)) {
+			free_pages(virt, order);
+			break;
+		}
+
+		printk("jzmem: %luKB at 0x%08lx\n", chunk >> 10,
+		       (unsigned long)virt_to_phys((void *)virt));
+
+		jzmem_total += chunk;
+		size -= min(size, chunk);
+	}
+
+	jzmem_free = jzmem_total;
+	return jzmem_total ? 0 : -ENOMEM;
+}
+
+static int __init jzmem_init(void)
+{
+	int ret;
+
+	jzmem_pool = gen_pool_create(PAGE_SHIFT, -1);
+	if (!jzmem_pool)
+		return -ENOMEM;
+
+	ret = jzmem_reserve(CONFIG_JZ_CMEM_SIZE << 20);
+	if (ret) {
+		printk("jzmem: NOT enough memory for the pool\n");
+		gen_pool_destroy(jzmem_pool);
+		return ret;
+	}
+
+	ret = misc_register(&jzmem_dev);
+	if (ret)
+		return ret;
+
+	printk("Total %luMB memory was reserved for /dev/jzmem\n",
+	       jzmem_total >> 20);
+	return 0;
+}
+
+/* the pool is never given back, the driver cannot be unloaded */
+device_initcall(jzmem_init);
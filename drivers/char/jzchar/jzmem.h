@@ -0,0 +1,62 @@
+/*
+ * linux/drivers/char/jzchar/jzmem.h
+ *
+ * Userspace ABI of /dev/jzmem, the physically contiguous memory allocator
+ * used by the video decoders and the IPU.
+ *
+ *  This program is free software; you can redistribute	 it and/or modify it
+ *  under  the terms of	 the GNU General  Public License as published by the
+ *  Free Software Foundation;  either version 2 of the	License, or (at your
+ *  option) any later version.
+ */
+
+#ifndef __JZMEM_H__
+#define __JZMEM_H__
+
+/*
+ * Usage:
+ *
+ *	fd = open("/dev/jzmem", O_RDWR);
+ *	a.size = len; a.flags = JZMEM_CACHED;
+ *	ioctl(fd, JZMEM_IOC_ALLOC, &a);		// a.phys is the buffer
+ *	p = mmap(0, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, a.phys);
+ *	...
+ *	ioctl(fd, JZMEM_IOC_FREE, &a.phys);	// or just close(fd)
+ *
+ * Buffers belong to the file they were allocated through and are freed
+ * when it is closed, so a client that dies cannot leak them.  Only the
+ * owner's buffers can be mapped or synced, and a buffer cannot be freed
+ * while it is still mapped.
+ */
+
+/* jzmem_alloc.flags */
+#define JZMEM_CACHED		(1 << 0)	/* map cacheable, sync by hand */
+
+struct jzmem_alloc {
+	unsigned int size;	/* in: bytes, rounded up to pages */
+	unsigned int flags;	/* in: JZMEM_* */
+	unsigned int phys;	/* out: physical address, also the mmap offset */
+};
+
+/* jzmem_sync.op */
+#define JZMEM_SYNC_CLEAN	1	/* write back, before the device reads */
+#define JZMEM_SYNC_INV		2	/* invalidate, after the device wrote */
+#define JZMEM_SYNC_FLUSH	3	/* write back and invalidate */
+
+struct jzmem_sync {
+	unsigned int phys;	/* start, anywhere inside an owned buffer */
+	unsigned int size;	/* bytes, must not run past that buffer */
+	unsigned int op;	/* JZMEM_SYNC_* */
+};
+
+struct jzmem_info {
+	unsigned int total;	/* bytes reserved at boot */
+	unsigned int free;	/* bytes not allocated */
+};
+
+#define JZMEM_IOC_ALLOC		_IOWR('J', 1, struct jzmem_alloc)
+#define JZMEM_IOC_FREE		_IOW('J', 2, unsigned int)
+#define JZMEM_IOC_SYNC		_IOW('J', 3, struct jzmem_sync)
+#define JZMEM_IOC_INFO		_IOR('J', 4, struct jzmem_info)
+
+#endif /* __JZMEM_H__ */
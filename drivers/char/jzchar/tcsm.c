@@ -1,7 +1,8 @@
 /*
  * linux/drivers/char/jzchar/tcsm.c
  *
- * Virtual device driver with tricky appoach to manage TCSM 
+ * Virtual device driver with tricky appoach to manage TCSM, plus mmap of
+ * the TCSM scratchpad and a small allocator for kernel users.
  *
  * Copyright (C) 2006  Ingenic Semiconductor Inc.
  *
@@ -24,9 +25,12 @@
 #include <linux/delay.h>
 #include <linux/fs.h>
 #include <linux/spinlock.h>
+#include <linux/genalloc.h>
+#include <linux/jz_tcsm.h>
 
 #include <asm/mipsregs.h>
 #include <asm/mipsmtregs.h>
+#include <asm/addrspace.h>
 
 #include <asm/irq.h>
 #include <asm/thread_info.h>
@@ -39,6 +43,128 @@ MODULE_AUTHOR("Jianli Wei<jlwei@ingenic.cn>");
 MODULE_DESCRIPTION("Virtual Driver of TCSM");
 MODULE_LICENSE("GPL");
 
+/*
+ * TCSM1 is the scratchpad the CPU can reach on the AHB1 bus.  It is
+ * either mapped whole by one process through mmap(), or carved up for
+ * kernel users by jz_tcsm_alloc(), never both at once.
+ */
+#if defined(CONFIG_SOC_JZ4760) || defined(CONFIG_SOC_JZ4760B) || defined(CONFIG_SOC_JZ4770)
+#define TCSM_BASE		TCSM1_BASE
+#define TCSM_SIZE		0x4000	/* 16KB */
+#define TCSM_ALLOC_ORDER	5	/* cache line sized pieces */
+#endif
+
+static DEFINE_SPINLOCK(tcsm_lock);
+static int tcsm_power_users;		/* open files and kernel users */
+
+#ifdef TCSM_BASE
+static struct gen_pool *tcsm_pool;
+static struct file *tcsm_owner;		/* file that mapped TCSM to user */
+static unsigned int tcsm_used;		/* bytes handed to kernel users */
+#endif
+
+/* Called with tcsm_lock held. */
+static void tcsm_power_get(void)
+{
+	if (tcsm_power_users++)
+		return;
+
+#ifdef CONFIG_SOC_JZ4760B
+	REG_CPM_CLKGR1 &= ~(CLKGR1_AUX | CLKGR1_OSD );
+#endif
+
+#ifdef CONFIG_SOC_JZ4770
+	REG_CPM_CLKGR1 &= ~ (CLKGR1_AUX | CLKGR1_VPU);
+#endif
+
+#if defined(CONFIG_SOC_JZ4760) || defined(CONFIG_SOC_JZ4760B)
+	REG_CPM_CLKGR1 &= ~ (CLKGR1_AHB1 | CLKGR1_CABAC | CLKGR1_SRAM | CLKGR1_DCT | CLKGR1_DBLK | CLKGR1_MC | CLKGR1_ME);
+	REG_CPM_LCR &= ~(1 << 30);
+	while(REG_CPM_LCR & LCR_PDAHB1S);
+	REG_CPM_CLKGR1 |= (CLKGR1_ME);
+#endif
+}
+
+/* Called with tcsm_lock held. */
+static void tcsm_power_put(void)
+{
+	if (--tcsm_power_users)
+		return;
+
+#ifdef CONFIG_SOC_JZ4760B
+	REG_CPM_CLKGR1 |= (CLKGR1_AUX | CLKGR1_OSD);
+#endif
+
+#ifdef CONFIG_SOC_JZ4770
+	REG_CPM_CLKGR1 |= (CLKGR1_AUX | CLKGR1_VPU);
+#endif
+
+#if defined(CONFIG_SOC_JZ4760) || defined(CONFIG_SOC_JZ4760B)
+	REG_CPM_CLKGR1 |= (CLKGR1_AHB1 | CLKGR1_CABAC | CLKGR1_SRAM | CLKGR1_DCT | CLKGR1_DBLK | CLKGR1_MC | CLKGR1_ME);
+	REG_CPM_LCR |= (1 << 30);
+#endif
+}
+
+/*
+ * Kernel allocation API
+ */
+
+/**
+ * jz_tcsm_alloc - get a piece of the TCSM scratchpad
+ * @size: bytes, rounded up to a cache line
+ *
+ * Returns an uncached kernel address, or NULL when TCSM is full or is
+ * mapped by a process.  May be called from atomic context.
+ */
+void *jz_tcsm_alloc(size_t size)
+{
+#ifdef TCSM_BASE
+	unsigned long flags, addr = 0;
+
+	spin_lock_irqsave(&tcsm_lock, flags);
+	if (tcsm_pool && !tcsm_owner) {
+		size = ALIGN(size, 1 << TCSM_ALLOC_ORDER);
+		addr = gen_pool_alloc(tcsm_pool, size);
+		if (addr) {
+			if (!tcsm_used)
+				tcsm_power_get();
+			tcsm_used += size;
+		}
+	}
+	spin_unlock_irqrestore(&tcsm_lock, flags);
+
+	return (void *)addr;
+#else
+	return NULL;
+#endif
+}
+EXPORT_SYMBOL(jz_tcsm_alloc);
+
+/**
+ * jz_tcsm_free - give back a piece got from jz_tcsm_alloc()
+ * @addr: address returned by jz_tcsm_alloc()
+ * @size: size passed to jz_tcsm_alloc()
+ */
+void jz_tcsm_free(void *addr, size_t size)
+{
+#ifdef TCSM_BASE
+	unsigned long flags;
+
+	if (!addr)
+		return;
+
+	size = ALIGN(size, 1 << TCSM_ALLOC_ORDER);
+
+	spin_lock_irqsave(&tcsm_lock, flags);
+	gen_pool_free(tcsm_pool, (unsigned long)addr, size);
+	tcsm_used -= size;
+	if (!tcsm_used)
+		tcsm_power_put();
+	spin_unlock_irqrestore(&tcsm_lock, flags);
+#endif
+}
+EXPORT_SYMBOL(jz_tcsm_free);
+
 /*
  * fops routines
  */
@@ -48,6 +174,7 @@ static int tcsm_release(struct inode *inode, struct file *filp);
 static ssize_t tcsm_read(struct file *filp, char *buf, size_t size, loff_t *l);
 static ssize_t tcsm_write(struct file *filp, const char *buf, size_t size, loff_t *l);
 static int tcsm_ioctl (struct inode *inode, struct file *filp, unsigned int cmd, unsigned long arg);
+static int tcsm_mmap(struct file *filp, struct vm_area_struct *vma);
 
 static struct file_operations tcsm_fops = 
 {
@@ -56,26 +183,17 @@ static struct file_operations tcsm_fops =
 	read:		tcsm_read,
 	write:		tcsm_write,
 	ioctl:		tcsm_ioctl,
+	mmap:		tcsm_mmap,
 };
 
 static int tcsm_open(struct inode *inode, struct file *filp)
 {
   struct pt_regs *info = task_pt_regs(current);
+  unsigned long flags;
 
-#ifdef CONFIG_SOC_JZ4760B
-  REG_CPM_CLKGR1 &= ~(CLKGR1_AUX | CLKGR1_OSD );
-#endif
-
-#ifdef CONFIG_SOC_JZ4770
-  REG_CPM_CLKGR1 &= ~ (CLKGR1_AUX | CLKGR1_VPU);
-#endif
-
-#if defined(CONFIG_SOC_JZ4760) || defined(CONFIG_SOC_JZ4760B)
-  REG_CPM_CLKGR1 &= ~ (CLKGR1_AHB1 | CLKGR1_CABAC | CLKGR1_SRAM | CLKGR1_DCT | CLKGR1_DBLK | CLKGR1_MC | CLKGR1_ME);
-  REG_CPM_LCR &= ~(1 << 30);
-  while(REG_CPM_LCR & LCR_PDAHB1S);
-  REG_CPM_CLKGR1 |= (CLKGR1_ME);
-#endif
+  spin_lock_irqsave(&tcsm_lock, flags);
+  tcsm_power_get();
+  spin_unlock_irqrestore(&tcsm_lock, flags);
  
   info->cp0_status &= ~0x10;// clear UM bit
   info->cp0_status |= 0x08000000; // set RP bit   a tricky
@@ -86,19 +204,15 @@ static int tcsm_open(struct inode *inode, struct file *filp)
 static int tcsm_release(struct inode *inode, struct file *filp)
 {
   struct pt_regs *info = task_pt_regs(current);
+  unsigned long flags;
 
-#ifdef CONFIG_SOC_JZ4760B
-  REG_CPM_CLKGR1 |= (CLKGR1_AUX | CLKGR1_OSD);
-#endif
-
-#ifdef CONFIG_SOC_JZ4770
-  REG_CPM_CLKGR1 |= (CLKGR1_AUX | CLKGR1_VPU);
-#endif
-
-#if defined(CONFIG_SOC_JZ4760) || defined(CONFIG_SOC_JZ4760B)
-  REG_CPM_CLKGR1 |= (CLKGR1_AHB1 | CLKGR1_CABAC | CLKGR1_SRAM | CLKGR1_DCT | CLKGR1_DBLK | CLKGR1_MC | CLKGR1_ME);
-  REG_CPM_LCR |= (1 << 30);
+  spin_lock_irqsave(&tcsm_lock, flags);
+#ifdef TCSM_BASE
+  if (tcsm_owner == filp)
+	  tcsm_owner = NULL;
 #endif
+  tcsm_power_put();
+  spin_unlock_irqrestore(&tcsm_lock, flags);
 
   info->cp0_status |= 0x10;// set UM bit
   info->cp0_status &= ~0x08000000; // clear RP bit  a tricky
@@ -108,21 +222,50 @@ static int tcsm_release(struct inode *inode, struct file *filp)
 
 static ssize_t tcsm_read(struct file *filp, char *buf, size_t size, loff_t *l)
 {
-	printk("tcsm: read is not implemented\n");
-	return -1;
+	return -EINVAL;
 }
 
 static ssize_t tcsm_write(struct file *filp, const char *buf, size_t size, loff_t *l)
 {
-	printk("tcsm: write is not implemented\n");
-	return -1;
+	return -EINVAL;
 }
 
 static int tcsm_ioctl(struct inode *inode, struct file *filp, unsigned int cmd, unsigned long arg)
 {
+	return -ENOTTY;
+}
+
+/*
+ * Map TCSM uncached at offset 0.  The first file to map it owns it until
+ * closed; other processes and kernel users are refused meanwhile.
+ */
+static int tcsm_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+#ifdef TCSM_BASE
+	unsigned long size = vma->vm_end - vma->vm_start;
+	unsigned long flags;
 	int ret = 0;
-	printk("tcsm: ioctl is not implemented\n");
-	return ret;
+
+	if (vma->vm_pgoff || size > PAGE_ALIGN(TCSM_SIZE))
+		return -EINVAL;
+
+	spin_lock_irqsave(&tcsm_lock, flags);
+	if (tcsm_used || (tcsm_owner && tcsm_owner != filp))
+		ret = -EBUSY;
+	else
+		tcsm_owner = filp;
+	spin_unlock_irqrestore(&tcsm_lock, flags);
+	if (ret)
+		return ret;
+
+	vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+	vma->vm_flags |= VM_IO | VM_RESERVED;
+
+	return remap_pfn_range(vma, vma->vm_start, CPHYSADDR(TCSM_BASE) >> PAGE_SHIFT,
+			       size, vma->vm_page_prot);
+#else
+	return -ENODEV;
+#endif
 }
 
 /*
@@ -133,6 +276,13 @@ static int __init tcsm_init(void)
 {
 	int ret;
 
+#ifdef TCSM_BASE
+	tcsm_pool = gen_pool_create(TCSM_ALLOC_ORDER, -1);
+	if (!tcsm_pool)
+		return -ENOMEM;
+	gen_pool_add(tcsm_pool, TCSM_BASE, TCSM_SIZE, -1);
+#endif
+
 	ret = jz_register_chrdev(TCSM_MINOR, "tcsm", &tcsm_fops, NULL);
 	if (ret < 0) {
 		return ret;
@@ -145,6 +295,9 @@ static int __init tcsm_init(void)
 static void __exit tcsm_exit(void)
 {
 	jz_unregister_chrdev(TCSM_MINOR, "tcsm");
+#ifdef TCSM_BASE
+	gen_pool_destroy(tcsm_pool);
+#endif
 }
 
 module_init(tcsm_init);
@@ -0,0 +1,588 @@
+/*
+ *  drivers/cpufreq/cpufreq_deadline.c
+ *
+ *  Frame-deadline cpufreq governor, for handhelds whose foreground
+ *  workload is paced by the display and the audio DMA ring.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/cpufreq.h>
+#include <linux/cpu.h>
+#include <linux/jiffies.h>
+#include <linux/kernel_stat.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/tick.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+
+/*
+ * The governor looks for the lowest frequency at which every frame is
+ * still queued before the next vsync and the audio ring never runs dry.
+ *
+ * Display drivers report the slack left in the frame period when a
+ * frame is queued (cpufreq_deadline_frame()), audio drivers report DMA
+ * underruns (cpufreq_deadline_underrun()).  Every sampling period the
+ * busiest frame of the window is projected onto the frequency at which
+ * it would use target_load percent of the period.  A missed frame or an
+ * underrun jumps straight to policy->max.  Going down is gradual: one
+ * step down the frequency table per down_delay samples, so a single
+ * light window cannot drop a game to policy->min.  Windows without
+ * frames fall back to CPU load, as ondemand does, so a UI that never
+ * pans still scales.
+ *
+ * All times here are in uS.
+ */
+
+#define DEF_SAMPLING_RATE			(100000)
+#define MIN_SAMPLING_RATE_RATIO			(2)
+#define MIN_LATENCY_MULTIPLIER			(100)
+#define DEF_TARGET_LOAD				(80)
+#define MIN_TARGET_LOAD				(20)
+#define MAX_TARGET_LOAD				(100)
+#define DEF_DOWN_DELAY				(10)
+#define MAX_FRAME_LOAD				(400)
+#define TRANSITION_LATENCY_LIMIT		(10 * 1000 * 1000)
+
+static unsigned int min_sampling_rate;
+
+/* Deadline events collected since the last sample, under dl_lock */
+struct dl_window {
+	unsigned int frames;
+	unsigned int missed;
+	unsigned int underruns;
+	unsigned int max_load;		/* busiest frame, percent of period */
+	int min_slack;
+};
+
+static struct dl_info_s {
+	struct cpufreq_policy *cur_policy;
+	struct delayed_work work;
+	struct work_struct boost;
+	cputime64_t prev_cpu_idle;
+	cputime64_t prev_cpu_wall;
+	unsigned int hold;		/* samples left before the next step down */
+	/*
+	 * serializes governor limit changes with the sampling and boost
+	 * work.
+	 */
+	struct mutex timer_mutex;
+} dl_info;
+
+static DEFINE_SPINLOCK(dl_lock);
+static struct dl_window dl_win;
+
+/* Exported through sysfs */
+static struct dl_stats {
+	unsigned long frames;
+	unsigned long missed;
+	unsigned long underruns;
+	unsigned long boosts;
+	unsigned int frame_load;	/* busiest frame of the last sample */
+	int frame_slack;		/* least slack of the last sample */
+} dl_stats;
+
+/*
+ * dl_mutex protects data in dl_tuners from concurrent changes and
+ * dl_enable in governor start/stop.
+ */
+static DEFINE_MUTEX(dl_mutex);
+static unsigned int dl_enable;
+
+static struct workqueue_struct *kdeadline_wq;
+
+static struct dl_tuners {
+	unsigned int sampling_rate;
+	unsigned int target_load;
+	unsigned int down_delay;
+} dl_tuners_ins = {
+	.sampling_rate = DEF_SAMPLING_RATE,
+	.target_load = DEF_TARGET_LOAD,
+	.down_delay = DEF_DOWN_DELAY,
+};
+
+/************************** producer hooks ************************/
+
+/**
+ * cpufreq_deadline_frame - report a frame handed to the display
+ * @slack_us: time left until the frame's deadline, negative if missed
+ * @period_us: frame period
+ *
+ * May be called from any context.
+ */
+void cpufreq_deadline_frame(int slack_us, unsigned int period_us)
+{
+	unsigned long flags;
+	unsigned int load;
+
+	if (!period_us)
+		return;
+
+	if (slack_us >= (int)period_us)
+		load = 0;
+	else
+		load = min((period_us - slack_us) * 100 / period_us,
+			   (unsigned int)MAX_FRAME_LOAD);
+
+	spin_lock_irqsave(&dl_lock, flags);
+	if (!dl_win.frames || slack_us < dl_win.min_slack)
+		dl_win.min_slack = slack_us;
+	if (load > dl_win.max_load)
+		dl_win.max_load = load;
+	dl_win.frames++;
+	dl_stats.frames++;
+
+	if (slack_us < 0) {
+		dl_win.missed++;
+		dl_stats.missed++;
+		if (dl_info.cur_policy)
+			queue_work(kdeadline_wq, &dl_info.boost);
+	}
+	spin_unlock_irqrestore(&dl_lock, flags);
+}
+EXPORT_SYMBOL_GPL(cpufreq_deadline_frame);
+
+/**
+ * cpufreq_deadline_underrun - report an audio playback underrun
+ *
+ * May be called from any context.
+ */
+void cpufreq_deadline_underrun(void)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dl_lock, flags);
+	dl_win.underruns++;
+	dl_stats.underruns++;
+	if (dl_info.cur_policy)
+		queue_work(kdeadline_wq, &dl_info.boost);
+	spin_unlock_irqrestore(&dl_lock, flags);
+}
+EXPORT_SYMBOL_GPL(cpufreq_deadline_underrun);
+
+/************************** sysfs interface ************************/
+static ssize_t show_sampling_rate_min(struct cpufreq_policy *policy, char *buf)
+{
+	return sprintf(buf, "%u\n", min_sampling_rate);
+}
+
+#define define_one_ro(_name)		\
+static struct freq_attr _name =		\
+__ATTR(_name, 0444, show_##_name, NULL)
+
+define_one_ro(sampling_rate_min);
+
+/* cpufreq_deadline Governor Tunables */
+#define show_one(file_name, object)					\
+static ssize_t show_##file_name						\
+(struct cpufreq_policy *unused, char *buf)				\
+{									\
+	return sprintf(buf, "%u\n", dl_tuners_ins.object);		\
+}
+show_one(sampling_rate, sampling_rate);
+show_one(target_load, target_load);
+show_one(down_delay, down_delay);
+
+static ssize_t store_sampling_rate(struct cpufreq_policy *unused,
+		const char *buf, size_t count)
+{
+	unsigned int input;
+	int ret;
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1)
+		return -EINVAL;
+
+	mutex_lock(&dl_mutex);
+	dl_tuners_ins.sampling_rate = max(input, min_sampling_rate);
+	mutex_unlock(&dl_mutex);
+
+	return count;
+}
+
+static ssize_t store_target_load(struct cpufreq_policy *unused,
+		const char *buf, size_t count)
+{
+	unsigned int input;
+	int ret;
+	ret = sscanf(buf, "%u", &input);
+
+	if (ret != 1 || input > MAX_TARGET_LOAD || input < MIN_TARGET_LOAD)
+		return -EINVAL;
+
+	mutex_lock(&dl_mutex);
+	dl_tuners_ins.target_load = input;
+	mutex_unlock(&dl_mutex);
+
+	return count;
+}
+
+static ssize_t store_down_delay(struct cpufreq_policy *unused,
+		const char *buf, size_t count)
+{
+	unsigned int input;
+	int ret;
+	ret = sscanf(buf, "%u", &input);
+	if (ret != 1)
+		return -EINVAL;
+
+	mutex_lock(&dl_mutex);
+	dl_tuners_ins.down_delay = input;
+	mutex_unlock(&dl_mutex);
+
+	return count;
+}
+
+#define define_one_rw(_name) \
+static struct freq_attr _name = \
+__ATTR(_name, 0644, show_##_name, store_##_name)
+
+define_one_rw(sampling_rate);
+define_one_rw(target_load);
+define_one_rw(down_delay);
+
+/* Deadline statistics */
+#define show_stat(file_name, object, fmt)				\
+static ssize_t show_##file_name						\
+(struct cpufreq_policy *unused, char *buf)				\
+{									\
+	return sprintf(buf, fmt "\n", dl_stats.object);			\
+}
+show_stat(frames, frames, "%lu");
+show_stat(missed_frames, missed, "%lu");
+show_stat(underruns, underruns, "%lu");
+show_stat(boosts, boosts, "%lu");
+show_stat(frame_load, frame_load, "%u");
+show_stat(frame_slack_us, frame_slack, "%d");
+
+define_one_ro(frames);
+define_one_ro(missed_frames);
+define_one_ro(underruns);
+define_one_ro(boosts);
+define_one_ro(frame_load);
+define_one_ro(frame_slack_us);
+
+static struct attribute *dl_attributes[] = {
+	&sampling_rate_min.attr,
+	&sampling_rate.attr,
+	&target_load.attr,
+	&down_delay.attr,
+	&frames.attr,
+	&missed_frames.attr,
+	&underruns.attr,
+	&boosts.attr,
+	&frame_load.attr,
+	&frame_slack_us.attr,
+	NULL
+};
+
+static struct attribute_group dl_attr_group = {
+	.attrs = dl_attributes,
+	.name = "deadline",
+};
+
+/************************** sysfs end ************************/
+
+static inline cputime64_t get_cpu_idle_time_jiffy(unsigned int cpu,
+							cputime64_t *wall)
+{
+	cputime64_t idle_time;
+	cputime64_t cur_wall_time;
+	cputime64_t busy_time;
+
+	cur_wall_time = jiffies64_to_cputime64(get_jiffies_64());
+	busy_time = cputime64_add(kstat_cpu(cpu).cpustat.user,
+			kstat_cpu(cpu).cpustat.system);
+
+	busy_time = cputime64_add(busy_time, kstat_cpu(cpu).cpustat.irq);
+	busy_time = cputime64_add(busy_time, kstat_cpu(cpu).cpustat.softirq);
+	busy_time = cputime64_add(busy_time, kstat_cpu(cpu).cpustat.steal);
+	busy_time = cputime64_add(busy_time, kstat_cpu(cpu).cpustat.nice);
+
+	idle_time = cputime64_sub(cur_wall_time, busy_time);
+	if (wall)
+		*wall = cur_wall_time;
+
+	return idle_time;
+}
+
+static inline cputime64_t get_cpu_idle_time(unsigned int cpu, cputime64_t *wall)
+{
+	u64 idle_time = get_cpu_idle_time_us(cpu, wall);
+
+	if (idle_time == -1ULL)
+		return get_cpu_idle_time_jiffy(cpu, wall);
+
+	return idle_time;
+}
+
+/* CPU load in percent since the last call */
+static unsigned int dl_cpu_load(unsigned int cpu)
+{
+	cputime64_t cur_wall_time, cur_idle_time;
+	unsigned int idle_time, wall_time;
+
+	cur_idle_time = get_cpu_idle_time(cpu, &cur_wall_time);
+
+	wall_time = (unsigned int) cputime64_sub(cur_wall_time,
+			dl_info.prev_cpu_wall);
+	dl_info.prev_cpu_wall = cur_wall_time;
+
+	idle_time = (unsigned int) cputime64_sub(cur_idle_time,
+			dl_info.prev_cpu_idle);
+	dl_info.prev_cpu_idle = cur_idle_time;
+
+	if (unlikely(!wall_time || wall_time < idle_time))
+		return 0;
+
+	return 100 * (wall_time - idle_time) / wall_time;
+}
+
+/* The highest table frequency below policy->cur, or freq if none is */
+static unsigned int dl_next_lower(struct cpufreq_policy *policy,
+				  unsigned int freq)
+{
+	struct cpufreq_frequency_table *table;
+	unsigned int lower = 0;
+	int i;
+
+	table = cpufreq_frequency_get_table(policy->cpu);
+	if (!table)
+		return freq;
+
+	for (i = 0; table[i].frequency != CPUFREQ_TABLE_END; i++) {
+		unsigned int f = table[i].frequency;
+
+		if (f == CPUFREQ_ENTRY_INVALID || f >= policy->cur ||
+		    f < policy->min)
+			continue;
+		if (f > lower)
+			lower = f;
+	}
+
+	return lower ? lower : freq;
+}
+
+static void dl_check_cpu(struct cpufreq_policy *policy)
+{
+	struct dl_window win;
+	unsigned int load, cpu_load, freq_next;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dl_lock, flags);
+	win = dl_win;
+	memset(&dl_win, 0, sizeof(dl_win));
+	dl_stats.frame_load = win.max_load;
+	dl_stats.frame_slack = win.min_slack;
+	spin_unlock_irqrestore(&dl_lock, flags);
+
+	cpu_load = dl_cpu_load(policy->cpu);
+
+	if (win.missed || win.underruns) {
+		/* the boost work normally got here first */
+		dl_info.hold = dl_tuners_ins.down_delay;
+		if (policy->cur != policy->max)
+			__cpufreq_driver_target(policy, policy->max,
+				CPUFREQ_RELATION_H);
+		return;
+	}
+
+	load = win.frames ? win.max_load : cpu_load;
+	freq_next = policy->cur * load / dl_tuners_ins.target_load;
+
+	if (freq_next > policy->cur) {
+		__cpufreq_driver_target(policy, freq_next, CPUFREQ_RELATION_L);
+		return;
+	}
+
+	/* if we cannot reduce the frequency anymore, break out early */
+	if (policy->cur == policy->min)
+		return;
+
+	if (dl_info.hold) {
+		dl_info.hold--;
+		return;
+	}
+
+	/* one step at a time, unless the target is closer than that */
+	freq_next = max(freq_next, dl_next_lower(policy, freq_next));
+	dl_info.hold = dl_tuners_ins.down_delay;
+	__cpufreq_driver_target(policy, freq_next, CPUFREQ_RELATION_L);
+}
+
+static void do_dl_timer(struct work_struct *work)
+{
+	struct cpufreq_policy *policy;
+	int delay = usecs_to_jiffies(dl_tuners_ins.sampling_rate);
+
+	mutex_lock(&dl_info.timer_mutex);
+	policy = dl_info.cur_policy;
+	if (policy) {
+		dl_check_cpu(policy);
+		queue_delayed_work(kdeadline_wq, &dl_info.work, delay);
+	}
+	mutex_unlock(&dl_info.timer_mutex);
+}
+
+/* A deadline was missed: don't wait for the next sample */
+static void do_dl_boost(struct work_struct *work)
+{
+	struct cpufreq_policy *policy;
+
+	mutex_lock(&dl_info.timer_mutex);
+	policy = dl_info.cur_policy;
+	if (policy) {
+		dl_info.hold = dl_tuners_ins.down_delay;
+		if (policy->cur != policy->max) {
+			dl_stats.boosts++;
+			__cpufreq_driver_target(policy, policy->max,
+				CPUFREQ_RELATION_H);
+		}
+	}
+	mutex_unlock(&dl_info.timer_mutex);
+}
+
+static inline void dl_timer_init(void)
+{
+	int delay = usecs_to_jiffies(dl_tuners_ins.sampling_rate);
+
+	INIT_DELAYED_WORK_DEFERRABLE(&dl_info.work, do_dl_timer);
+	queue_delayed_work(kdeadline_wq, &dl_info.work, delay);
+}
+
+static inline void dl_timer_exit(void)
+{
+	cancel_delayed_work_sync(&dl_info.work);
+	cancel_work_sync(&dl_info.boost);
+}
+
+static int cpufreq_governor_dl(struct cpufreq_policy *policy,
+				   unsigned int event)
+{
+	unsigned int cpu = policy->cpu;
+	unsigned long flags;
+	int rc;
+
+	switch (event) {
+	case CPUFREQ_GOV_START:
+		if ((!cpu_online(cpu)) || (!policy->cur))
+			return -EINVAL;
+
+		mutex_lock(&dl_mutex);
+
+		/* frame and audio events are system wide: one policy only */
+		if (dl_enable) {
+			mutex_unlock(&dl_mutex);
+			return -EBUSY;
+		}
+
+		rc = sysfs_create_group(&policy->kobj, &dl_attr_group);
+		if (rc) {
+			mutex_unlock(&dl_mutex);
+			return rc;
+		}
+
+		dl_enable++;
+		dl_info.prev_cpu_idle = get_cpu_idle_time(cpu,
+					&dl_info.prev_cpu_wall);
+		dl_info.hold = 0;
+		mutex_init(&dl_info.timer_mutex);
+
+		{
+			unsigned int latency;
+			/* policy latency is in nS. Convert it to uS first */
+			latency = policy->cpuinfo.transition_latency / 1000;
+			if (latency == 0)
+				latency = 1;
+			/* Bring kernel and HW constraints together */
+			min_sampling_rate = max(min_sampling_rate,
+					MIN_LATENCY_MULTIPLIER * latency);
+			dl_tuners_ins.sampling_rate =
+				max(min_sampling_rate,
+				    dl_tuners_ins.sampling_rate);
+		}
+
+		spin_lock_irqsave(&dl_lock, flags);
+		memset(&dl_win, 0, sizeof(dl_win));
+		dl_info.cur_policy = policy;
+		spin_unlock_irqrestore(&dl_lock, flags);
+		mutex_unlock(&dl_mutex);
+
+		dl_timer_init();
+		break;
+
+	case CPUFREQ_GOV_STOP:
+		spin_lock_irqsave(&dl_lock, flags);
+		dl_info.cur_policy = NULL;
+		spin_unlock_irqrestore(&dl_lock, flags);
+
+		dl_timer_exit();
+
+		mutex_lock(&dl_mutex);
+		sysfs_remove_group(&policy->kobj, &dl_attr_group);
+		mutex_destroy(&dl_info.timer_mutex);
+		dl_enable--;
+		mutex_unlock(&dl_mutex);
+
+		break;
+
+	case CPUFREQ_GOV_LIMITS:
+		mutex_lock(&dl_info.timer_mutex);
+		if (policy->max < policy->cur)
+			__cpufreq_driver_target(policy,
+				policy->max, CPUFREQ_RELATION_H);
+		else if (policy->min > policy->cur)
+			__cpufreq_driver_target(policy,
+				policy->min, CPUFREQ_RELATION_L);
+		mutex_unlock(&dl_info.timer_mutex);
+		break;
+	}
+	return 0;
+}
+
+#ifndef CONFIG_CPU_FREQ_DEFAULT_GOV_DEADLINE
+static
+#endif
+struct cpufreq_governor cpufreq_gov_deadline = {
+	.name			= "deadline",
+	.governor		= cpufreq_governor_dl,
+	.max_transition_latency = TRANSITION_LATENCY_LIMIT,
+	.owner			= THIS_MODULE,
+};
+
+static int __init cpufreq_gov_dl_init(void)
+{
+	int err;
+
+	/* For correct statistics, we need 10 ticks for each measure */
+	min_sampling_rate = MIN_SAMPLING_RATE_RATIO * jiffies_to_usecs(10);
+
+	INIT_WORK(&dl_info.boost, do_dl_boost);
+
+	kdeadline_wq = create_singlethread_workqueue("kdeadline");
+	if (!kdeadline_wq) {
+		printk(KERN_ERR "Creation of kdeadline failed\n");
+		return -EFAULT;
+	}
+	err = cpufreq_register_governor(&cpufreq_gov_deadline);
+	if (err)
+		destroy_workqueue(kdeadline_wq);
+
+	return err;
+}
+
+MODULE_DESCRIPTION("'cpufreq_deadline' - A cpufreq governor driven by "
+	"display frame deadlines and audio underruns");
+MODULE_LICENSE("GPL");
+
+#ifdef CONFIG_CPU_FREQ_DEFAULT_GOV_DEADLINE
+fs_initcall(cpufreq_gov_dl_init);
+#else
+module_init(cpufreq_gov_dl_init);
+#endif
@@ -29,10 +29,10 @@
 #include <linux/input.h>
 #include <linux/rtc.h>
 #include <linux/gpio_keys.h>
+#include <linux/hrtimer.h>
+#include <linux/spinlock.h>
 //#include <linux/wakelock.h>
 
-#include <linux/semaphore.h>
-
 #include <asm/gpio.h>
 #include <asm/jzsoc.h>
 
@@ -46,8 +46,11 @@
 #define dprintk(x...)
 #endif
 
-/* Timer interval */
-#define SCAN_INTERVAL	5
+/* Scan period, a key must read the same on 4 scans in a row to change */
+static unsigned int scan_period_us = 1000;
+module_param(scan_period_us, uint, 0644);
+MODULE_PARM_DESC(scan_period_us, "Key scan period in microseconds");
+
 #define MAX_KEY_NUM     12
 
 //#define KERNEL_HIBERNATE_TIME (10*HZ)
@@ -59,16 +62,21 @@
 #define ENDCALL_CHANNEL 3
 #endif
 
-//static struct timer_list kbd_timer[KEY_NUM];
-//static int current_key[KEY_NUM];
-
-static struct timer_list *kbd_timer;
 static struct timer_list endcall_timer;
-static int *current_key;
 
+/*
+ * Scanner state, one bit per button.  stable holds the reported state,
+ * cnt0/cnt1 form a 2-bit vertical counter per key that counts scans
+ * disagreeing with stable; it wraps to zero on the 4th and flips the key.
+ */
+static struct hrtimer scan_timer;
+static DEFINE_SPINLOCK(scan_lock);
+static unsigned long stable, cnt0, cnt1;
+static int scanning;
+
+static struct platform_device *keypad_pdev;
 static struct input_dev *ginput;
 static int endcall_index;
-struct semaphore sem;
 struct workqueue_struct *endcall_wqueue;
 struct work_struct endcall_irq_work;
 //static struct wake_lock delay_wake_lock;
@@ -105,56 +113,64 @@ static void gpio_keys_shutdown(struct platform_device *pdev)
 }
 #endif
 
-static void button_timer_callback(unsigned long data)
+static inline ktime_t scan_period(void)
 {
-	int gpio;
-	int code;
-	int active_low;
-	struct platform_device *pdev = (struct platform_device *)data;
-	struct input_dev *input = platform_get_drvdata(pdev);
-	struct gpio_keys_platform_data *key_data = 
-		(struct gpio_keys_platform_data*)pdev->dev.platform_data;
+	return ktime_set(0, (scan_period_us ? scan_period_us : 1) * NSEC_PER_USEC);
+}
+
+/* Kick the scanner, it keeps running while any key is down or bouncing. */
+static void keypad_start_scan(void)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&scan_lock, flags);
+	if (!scanning) {
+		scanning = 1;
+		hrtimer_start(&scan_timer, scan_period(), HRTIMER_MODE_REL);
+	}
+	spin_unlock_irqrestore(&scan_lock, flags);
+}
+
+static enum hrtimer_restart keypad_scan(struct hrtimer *timer)
+{
+	struct input_dev *input = platform_get_drvdata(keypad_pdev);
+	struct gpio_keys_platform_data *key_data = keypad_pdev->dev.platform_data;
 	struct gpio_keys_button *board_buttons = key_data->buttons;
+	unsigned long raw = 0, delta, toggle;
+	enum hrtimer_restart ret = HRTIMER_RESTART;
+	int i;
 
-	static int button_pressed[MAX_KEY_NUM] = { 0, 0, 0, 0, 0 };
-	int state, i;
-	down(&sem);
-
-	for (i = 0; i < key_data->nbuttons; i++) {
-		if (1 == current_key[i]) {
-			gpio = board_buttons[i].gpio;
-			code = board_buttons[i].code;
-			active_low = board_buttons[i].active_low;
-
-			state = __gpio_get_pin(gpio);
-
-			if (active_low ^ state) {
-				if(button_pressed[i] != 1) {
-					/* button pressed */
-					button_pressed[i] = 1;
-					input_report_key(input, code, 1);
-//					wake_lock_timeout(&delay_wake_lock,5*HZ);
-					input_sync(input);
-					printk("gpio %d down, code:%d \n",
-								gpio, code);
-				}
-				mod_timer(&kbd_timer[i],
-					  jiffies + SCAN_INTERVAL);
-			} else {
-				/* button released */
-				if (1 == button_pressed[i]) {
-					input_report_key(input, code, 0);
-//					wake_lock_timeout(&delay_wake_lock,5*HZ);
-					input_sync(input);
-					button_pressed[i] = 0;
-					current_key[i] = 0;
-					printk("gpio %d up, code:%d \n",
-								gpio, code);
-				}
-			}
-		}
+	for (i = 0; i < key_data->nbuttons; i++)
+		if (board_buttons[i].active_low ^ __gpio_get_pin(board_buttons[i].gpio))
+			raw |= 1UL << i;
+
+	spin_lock(&scan_lock);
+
+	delta = raw ^ stable;
+	cnt1 = (cnt1 ^ cnt0) & delta;
+	cnt0 = ~cnt0 & delta;
+	toggle = delta & ~(cnt0 | cnt1);
+	stable ^= toggle;
+
+	if (toggle) {
+		for (i = 0; i < key_data->nbuttons; i++)
+			if (toggle & (1UL << i))
+				input_report_key(input, board_buttons[i].code,
+						 (stable >> i) & 1);
+		input_sync(input);
+	}
+
+	if (!stable && !(delta & ~toggle)) {
+		/* all keys up and settled, wait for the next press irq */
+		scanning = 0;
+		ret = HRTIMER_NORESTART;
+	} else {
+		hrtimer_forward_now(timer, scan_period());
 	}
-	up(&sem);
+
+	spin_unlock(&scan_lock);
+
+	return ret;
 }
 
 static inline void endcall_report(struct gpio_keys_button *button)
@@ -175,8 +191,7 @@ static inline void endcall_report(struct gpio_keys_button *button)
 
 
 	if(button->active_low ^ state) {
-		current_key[endcall_index] = 1;
-		mod_timer(&kbd_timer[endcall_index], jiffies + SCAN_INTERVAL);
+		keypad_start_scan();
 		mod_timer(&endcall_timer, jiffies + KERNEL_HIBERNATE_TIME); 
 		last_time = rtc_read_reg(RTC_RTCSR); 
 		dprintk("%x\n",last_time);
@@ -235,21 +250,7 @@ static irqreturn_t jz_endcall_interrupt(int irq, void *arg)
 
 static irqreturn_t jz_gpio_interrupt(int irq, void *dev_id)
 {
-	int i;
-	struct platform_device *pdev = dev_id;
-	struct gpio_keys_platform_data *pdata = pdev->dev.platform_data;
-
-	for (i = 0; i < pdata->nbuttons; i++) {
-		struct gpio_keys_button *button = &pdata->buttons[i];
-		int gpio = button->gpio;
-
-		if (irq == (gpio + IRQ_GPIO_0) ) {
-			current_key[i] = 1;
-			/* start timer */
-			mod_timer(&kbd_timer[i], jiffies + SCAN_INTERVAL);
-			break;
-		}
-	}
+	keypad_start_scan();
 
 	return IRQ_HANDLED;
 }
@@ -304,24 +305,16 @@ static int __devinit gpio_keys_probe(struct platform_device *pdev)
 		return -ENOMEM;
 	ginput = input;
 
-	if (pdata->nbuttons < 1) {
-		printk("%s %d no key register in!\n",__FUNCTION__, __LINE__);
+	if (pdata->nbuttons < 1 || pdata->nbuttons > MAX_KEY_NUM) {
+		printk("%s %d bad number of keys (%d)!\n",__FUNCTION__, __LINE__,
+		       pdata->nbuttons);
 		return -EINVAL;
 	}
 
-	current_key = kzalloc(sizeof(int) * pdata->nbuttons, GFP_KERNEL);
-	if (!current_key) {
-		printk("%s %d no memory alloc for key!\n",__FUNCTION__, __LINE__);
-		return -ENOMEM;
-	}
-
-	kbd_timer = kzalloc(sizeof(struct timer_list) * pdata->nbuttons, GFP_KERNEL);
-	if (!kbd_timer) {
-		printk("%s %d no memory alloc for key timer!\n",__FUNCTION__, __LINE__);
-		return -ENOMEM;
-	}
+	keypad_pdev = pdev;
+	hrtimer_init(&scan_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	scan_timer.function = keypad_scan;
 
-	sema_init(&sem,1);
 	endcall_wqueue = create_workqueue("endcall_queue");
 	if (!endcall_wqueue) {
 		BUG();	
@@ -359,11 +352,6 @@ static int __devinit gpio_keys_probe(struct platform_device *pdev)
 		int irq;
 		unsigned int type = button->type ?: EV_KEY;
 
-		/* Init timer */
-		setup_timer(&kbd_timer[i],
-			    button_timer_callback,
-			    (unsigned long)pdev);
-
 		irq = IRQ_GPIO_0 + button->gpio;
 		if (irq < 0) {
 			error = irq;
@@ -445,15 +433,12 @@ static int __devexit gpio_keys_remove(struct platform_device *pdev)
 		free_irq(irq, pdev);
 	}
 
+	hrtimer_cancel(&scan_timer);
+
 	input_unregister_device(input);
 
 	platform_device_unregister(pdev);
 
-	if (current_key)
-		kfree(current_key);
-	if (kbd_timer)
-		kfree(kbd_timer);
-
 	return 0;
 }
 
@@ -1,6 +1,21 @@
 /* ****************************************************************
  * @ func   : L009 Game Keypad Driver
  * @ author : maddrone@gmail.com
+ *
+ * Buttons are interrupt driven: each GPIO is armed for the edge opposite
+ * to its current level, the first edge is reported at once and the pin
+ * is then left alone for debounce_ms before it is sampled and re-armed.
+ *
+ * State changes are published through an input device (evdev/joydev,
+ * d-pad on ABS_X/ABS_Y) and through /dev/keypad:
+ *  - read() of sizeof(int) returns the current state word (bit n set
+ *    while umido_button[n] is pressed), as it always did;
+ *  - read() of one or more struct umido_event returns the queued state
+ *    changes of this opener, blocking unless O_NONBLOCK;
+ *  - poll() reports POLLIN while changes are queued.
+ * If the irqs cannot be had the pins are polled instead: an event read
+ * samples them and returns the changes since the last one, or -EAGAIN,
+ * and poll() always reports POLLIN.
  * ****************************************************************/
 #include <linux/module.h>
 #include <linux/kernel.h>
@@ -30,9 +45,19 @@
 #include <linux/sched.h>
 #include <linux/miscdevice.h>
 #include <linux/proc_fs.h>
+#include <linux/interrupt.h>
+#include <linux/input.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/time.h>
+#include <linux/timer.h>
 
 static unsigned int key_value;
 
+static unsigned int debounce_ms = 10;
+module_param(debounce_ms, uint, 0644);
+MODULE_PARM_DESC(debounce_ms, "Button debounce time in milliseconds");
+
 unsigned int umido_button[] = 
 {
 	UMIDO_KEY_UP,
@@ -51,18 +76,257 @@ unsigned int umido_button[] =
 	
 #define TOTAL_BUTTON_NUM sizeof(umido_button)/sizeof(unsigned int)
 
+/* input codes for the buttons after the d-pad, in umido_button order */
+static unsigned int umido_code[] =
+{
+	BTN_A,
+	BTN_B,
+	BTN_X,
+	BTN_Y,
+	BTN_START,
+	BTN_SELECT,
+	BTN_TL,
+	BTN_TR,
+};
+
+#define DPAD_UP		(1 << 0)
+#define DPAD_DOWN	(1 << 1)
+#define DPAD_LEFT	(1 << 2)
+#define DPAD_RIGHT	(1 << 3)
+#define DPAD_NUM	4
+
+/* START and SELECT are active high, everything else active low */
+#define button_active_high(i)	((i) == 8 || (i) == 9)
+
+struct umido_event {
+	unsigned int state;	/* state word after the change */
+	unsigned int tv_sec;	/* time of the change */
+	unsigned int tv_usec;
+};
+
+#define UMIDO_EVENT_NUM	32
+
+struct umido_client {
+	struct list_head node;
+	unsigned int head, tail;
+	struct umido_event buf[UMIDO_EVENT_NUM];
+};
+
+static DEFINE_SPINLOCK(umido_lock);
+static DECLARE_WAIT_QUEUE_HEAD(umido_wait);
+static LIST_HEAD(umido_clients);
+
+static struct input_dev *umido_input;
+static struct timer_list debounce_timer;
+static unsigned int key_state;		/* debounced state word */
+static unsigned int debouncing;		/* pins with their irq disabled */
+static int irq_mode;			/* all button irqs requested */
+
+static unsigned int umido_sample(void)
+{
+	unsigned int state = 0;
+	int i;
+
+	for (i = 0; i < TOTAL_BUTTON_NUM; i++) {
+		int level = __gpio_get_pin(umido_button[i]) != 0;
+
+		if (level == button_active_high(i))
+			state |= 1 << i;
+	}
+
+	return state;
+}
+
+/* Arm the edge that leaves the given state of button i. */
+static void umido_arm_edge(int i, unsigned int state)
+{
+	int pressed = (state >> i) & 1;
+
+	if (pressed == button_active_high(i))
+		__gpio_as_irq_fall_edge(umido_button[i]);
+	else
+		__gpio_as_irq_rise_edge(umido_button[i]);
+}
+
+/* Publish a new state word, called with umido_lock held. */
+static void umido_report(unsigned int state)
+{
+	struct umido_client *client;
+	struct umido_event ev;
+	struct timeval tv;
+	unsigned int changed = state ^ key_state;
+	int i;
+
+	if (!changed)
+		return;
+
+	key_state = state;
+
+	do_gettimeofday(&tv);
+	ev.state = state;
+	ev.tv_sec = tv.tv_sec;
+	ev.tv_usec = tv.tv_usec;
+
+	list_for_each_entry(client, &umido_clients, node) {
+		client->buf[client->head] = ev;
+		client->head = (client->head + 1) % UMIDO_EVENT_NUM;
+		/* drop the oldest change if the reader falls behind */
+		if (client->head == client->tail)
+			client->tail = (client->tail + 1) % UMIDO_EVENT_NUM;
+	}
+	wake_up_interruptible(&umido_wait);
+
+	if (changed & (DPAD_LEFT | DPAD_RIGHT))
+		input_report_abs(umido_input, ABS_X,
+				 !!(state & DPAD_RIGHT) - !!(state & DPAD_LEFT));
+	if (changed & (DPAD_UP | DPAD_DOWN))
+		input_report_abs(umido_input, ABS_Y,
+				 !!(state & DPAD_DOWN) - !!(state & DPAD_UP));
+	for (i = DPAD_NUM; i < TOTAL_BUTTON_NUM; i++)
+		if (changed & (1 << i))
+			input_report_key(umido_input, umido_code[i - DPAD_NUM],
+					 (state >> i) & 1);
+	input_sync(umido_input);
+}
+
+static irqreturn_t umido_interrupt(int irq, void *dev_id)
+{
+	int i = (int)dev_id;
+
+	spin_lock(&umido_lock);
+
+	/*
+	 * The pin was armed for the edge leaving its last state, so it just
+	 * toggled.  Report that now and ignore its bounces for a while.
+	 */
+	disable_irq_nosync(irq);
+	__gpio_ack_irq(umido_button[i]);
+	debouncing |= 1 << i;
+	umido_report(key_state ^ (1 << i));
+
+	mod_timer(&debounce_timer, jiffies + msecs_to_jiffies(debounce_ms) + 1);
+
+	spin_unlock(&umido_lock);
+
+	return IRQ_HANDLED;
+}
+
+static void umido_debounce_timer(unsigned long data)
+{
+	unsigned long flags;
+	unsigned int state, pins;
+	int i;
+
+	spin_lock_irqsave(&umido_lock, flags);
+
+	pins = debouncing;
+	state = umido_sample();
+	umido_report((key_state & ~pins) | (state & pins));
+
+	for (i = 0; i < TOTAL_BUTTON_NUM; i++) {
+		if (!(pins & (1 << i)))
+			continue;
+		umido_arm_edge(i, key_state);
+		enable_irq(IRQ_GPIO_0 + umido_button[i]);
+	}
+
+	/*
+	 * A pin that moved again before it was re-armed missed its edge:
+	 * keep it quiet and give it another look.
+	 */
+	pins &= umido_sample() ^ key_state;
+	for (i = 0; i < TOTAL_BUTTON_NUM; i++) {
+		if (!(pins & (1 << i)))
+			continue;
+		disable_irq_nosync(IRQ_GPIO_0 + umido_button[i]);
+		__gpio_ack_irq(umido_button[i]);
+	}
+	debouncing = pins;
+	if (pins)
+		mod_timer(&debounce_timer, jiffies + 1);
+
+	spin_unlock_irqrestore(&umido_lock, flags);
+}
+
 static int key_open(struct inode *inode, struct file *filp)
 {
+	struct umido_client *client;
+
 	//is_powerkey_coming_now = true;
-	printk (KERN_ALERT "key_open\n");
+	client = kzalloc(sizeof(*client), GFP_KERNEL);
+	if (!client)
+		return -ENOMEM;
+
+	spin_lock_irq(&umido_lock);
+	list_add_tail(&client->node, &umido_clients);
+	spin_unlock_irq(&umido_lock);
+
+	filp->private_data = client;
 	key_value = 0;
 	return 0;
 }
 
 static int key_release(struct inode *inode, struct file *filp)
 {
+	struct umido_client *client = filp->private_data;
+
 	//is_powerkey_coming_now = false;
-	printk(KERN_ALERT "key_release\n");
+	spin_lock_irq(&umido_lock);
+	list_del(&client->node);
+	spin_unlock_irq(&umido_lock);
+
+	kfree(client);
+	return 0;
+}
+
+static ssize_t key_read_events(struct umido_client *client, struct file *filp,
+			       char __user *buf, size_t count)
+{
+	struct umido_event ev;
+	size_t done = 0;
+	int ret;
+
+	/* without irqs nothing queues changes, sample them here and never block */
+	if (!irq_mode) {
+		spin_lock_irq(&umido_lock);
+		umido_report(umido_sample());
+		spin_unlock_irq(&umido_lock);
+	}
+
+	if (client->head == client->tail &&
+	    (!irq_mode || (filp->f_flags & O_NONBLOCK)))
+		return -EAGAIN;
+
+	ret = wait_event_interruptible(umido_wait, client->head != client->tail);
+	if (ret)
+		return ret;
+
+	while (done + sizeof(ev) <= count) {
+		spin_lock_irq(&umido_lock);
+		if (client->head == client->tail) {
+			spin_unlock_irq(&umido_lock);
+			break;
+		}
+		ev = client->buf[client->tail];
+		client->tail = (client->tail + 1) % UMIDO_EVENT_NUM;
+		spin_unlock_irq(&umido_lock);
+
+		if (copy_to_user(buf + done, &ev, sizeof(ev)))
+			return -EFAULT;
+		done += sizeof(ev);
+	}
+
+	return done;
+}
+
+static unsigned int key_poll(struct file *filp, poll_table *wait)
+{
+	struct umido_client *client = filp->private_data;
+
+	poll_wait(filp, &umido_wait, wait);
+
+	if (client->head != client->tail || !irq_mode)
+		return POLLIN | POLLRDNORM;
 	return 0;
 }
 
@@ -90,26 +354,13 @@ EXPORT_SYMBOL_GPL(umido_gamepad_set_key_value);
 
 static ssize_t key_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos)
 {
-	int i = 0;
-	key_value = 0;
-	
-	for(i = 0; i < TOTAL_BUTTON_NUM; i++)
-	{
+	if (count >= sizeof(struct umido_event))
+		return key_read_events(filp->private_data, filp, buf, count);
 
-		if(i == 8 || i == 9)
-		{
-			if(__gpio_get_pin(umido_button[i]) != 0)
-				key_value |= 1 << i;
-		}
-		else
-		{
-			if(__gpio_get_pin(umido_button[i]) == 0)
-			{
-				//printk("%d \n",i);
-				key_value |= 1 << i;
-			}
-		}
-	}
+	if (irq_mode)
+		key_value = key_state;
+	else
+		key_value = umido_sample();
   
 #if 0 //adc key
 
@@ -145,6 +396,7 @@ static struct file_operations keypad_fops = {
     owner:              THIS_MODULE,
     open:               key_open,
     read:               key_read,
+    poll:               key_poll,
     release:            key_release,
 };
 
@@ -155,12 +407,79 @@ static struct miscdevice keypad_device = {
 };
 
 
+static int __init umido_input_init(void)
+{
+	struct input_dev *input;
+	int i, ret;
+
+	input = input_allocate_device();
+	if (!input)
+		return -ENOMEM;
+
+	input->name = "umido-gamepad";
+	input->phys = "umido-gamepad/input0";
+	input->id.bustype = BUS_HOST;
+	input->id.vendor = 0x0001;
+	input->id.product = 0x0001;
+	input->id.version = 0x0100;
+
+	input->evbit[0] = BIT(EV_KEY) | BIT(EV_ABS) | BIT(EV_SYN);
+	input_set_abs_params(input, ABS_X, -1, 1, 0, 0);
+	input_set_abs_params(input, ABS_Y, -1, 1, 0, 0);
+	for (i = 0; i < ARRAY_SIZE(umido_code); i++)
+		set_bit(umido_code[i], input->keybit);
+
+	ret = input_register_device(input);
+	if (ret) {
+		input_free_device(input);
+		return ret;
+	}
+
+	umido_input = input;
+	return 0;
+}
+
+static int __init umido_irq_init(void)
+{
+	int i, ret;
+
+	for (i = 0; i < TOTAL_BUTTON_NUM; i++) {
+		umido_arm_edge(i, key_state);
+		ret = request_irq(IRQ_GPIO_0 + umido_button[i], umido_interrupt,
+				  IRQF_DISABLED, "umido-gamepad", (void *)i);
+		if (ret)
+			goto fail;
+	}
+
+	return 0;
+
+fail:
+	printk("kernel : keypad irq %d request failed, polling instead\n",
+	       IRQ_GPIO_0 + umido_button[i]);
+	__gpio_as_func0(umido_button[i]);
+	__gpio_as_input(umido_button[i]);
+	while (--i >= 0) {
+		free_irq(IRQ_GPIO_0 + umido_button[i], (void *)i);
+		__gpio_as_func0(umido_button[i]);
+		__gpio_as_input(umido_button[i]);
+	}
+	return ret;
+}
+
 static int __init keypad_init(void)
 {
 	int i,ret;
 
 	printk("umido gamepade ==================== init \n");
 
+	setup_timer(&debounce_timer, umido_debounce_timer, 0);
+
+	ret = umido_input_init();
+	if (ret < 0) {
+		printk("kernel : keypad input device register failed!\n");
+		return ret;
+	}
+
 	ret = misc_register(&keypad_device);
 	if(ret<0)
 		printk("kernel : keypad register failed!\n");
@@ -180,6 +499,9 @@ static int __init keypad_init(void)
 	       }
        }
 
+	key_state = umido_sample();
+	irq_mode = umido_irq_init() == 0;
+
 	return 0;
 }
 
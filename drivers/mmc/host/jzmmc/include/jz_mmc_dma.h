@@ -24,8 +24,7 @@ int jz_mmc_dma_register(struct jz_mmc_dma *dma);
 int jz_mmc_start_dma(struct jz_mmc_host *host);
 void jz_mmc_stop_dma(struct jz_mmc_host *host);
 
-void jz_mmc_start_normal_dma(struct jz_mmc_host *host, unsigned long phyaddr, int count, int mode, int ds);
-int jz_mmc_start_scatter_dma(int chan, struct jz_mmc_host *host,
-			      struct scatterlist *sg, unsigned int sg_len, int mode);
+int jz_mmc_prepare_dma(struct jz_mmc_host *host);
+void jz_mmc_kick_dma(struct jz_mmc_host *host);
 
 #endif /* __JZ_MMC_DMA_H__ */
@@ -12,22 +12,16 @@
 #define __JZ_MMC_HOST_H__
 
 #include <linux/semaphore.h>
+#include <linux/completion.h>
 #include <asm/jzsoc.h>
 #include <linux/device.h>
 
 #define JZ_MSC_USE_DMA 1
 
-/* NOTE: when not use bounce buffer, we will force to use descriptor(see following code) */
-#define USE_DMA_DESC
+/* DMA always runs from a descriptor chain built from the request's sg list */
 //#define USE_DMA_UNCACHE
 //#define MSC_DEBUG_DMA
 
-#ifndef CONFIG_MMC_BLOCK_BOUNCE
-#ifndef USE_DMA_DESC
-#define USE_DMA_DESC
-#endif
-#endif
-
 
 #if defined(CONFIG_SOC_JZ4760) || defined(CONFIG_SOC_JZ4760B) || defined(CONFIG_SOC_JZ4770)
 
@@ -39,6 +33,13 @@
 
 #endif
 
+/*
+ * The descriptors live in one page, and a segment takes at most two of
+ * them (the 64-byte burst part and a word-sized tail).
+ */
+#define JZ_MSC_DMA_DESC_NUM	(PAGE_SIZE / sizeof(JZ_MSC_DMA_DESC))
+#define JZ_MSC_MAX_SEGS		(JZ_MSC_DMA_DESC_NUM / 2)
+
 #define MMC_CLOCK_MIN    400000      /* 400 kHz for initial setup */
 #define MMC_CLOCK_FAST  20000000      /* 20 MHz for maximum for normal operation */
 
@@ -64,6 +65,16 @@
  */
 #define SD_CLOCK_24M   24000000
 
+/*
+ * SD high-speed bus clock, only used when the jzmmc_highspeed parameter
+ * is set. A card that shows CRC errors above 24MHZ falls back to
+ * SD_CLOCK_24M until it is removed, see jz_mmc_hs_fallback().
+ *
+ * Twice SD_CLOCK_24M, so on JZ4760(B) one MSCCLK serves both rates and
+ * only CLKRT differs between hosts.
+ */
+#define SD_CLOCK_HS    (2 * SD_CLOCK_24M)
+
 struct jz_mmc_host {
 	struct mmc_host *mmc;
 	struct semaphore mutex;
@@ -86,17 +97,29 @@ struct jz_mmc_host {
 		int dir;
 		int channel;
 	} dma;
-#ifdef USE_DMA_DESC
 #ifdef MSC_DEBUG_DMA
 	int num_desc;
 	int last_direction;
 #endif
 	JZ_MSC_DMA_DESC *dma_desc;
-#endif
 	wait_queue_head_t data_wait_queue;
 	volatile int data_ack;
 	volatile int data_err;
 
+	/* command, busy and transfer-done interrupts, see jz_mmc_wait_irq() */
+	struct completion irq_done;
+	volatile unsigned int irq_wait;
+
+	/* data mapped and chained before the command, see jz_mmc_data_prepare() */
+	int dma_ready;
+	volatile int dma_kick;	/* write DMA to start on END_CMD_RES */
+
+	/* SD high-speed state, see jz_mmc_set_clock() */
+	int hs_allowed;			/* jzmmc_highspeed was set at probe */
+	int hs_failed;			/* current card fell back to 24MHZ */
+	unsigned int hs_retries;	/* requests failed at high speed */
+	unsigned int bus_clock;		/* Hz actually on the bus */
+
 	/* PIO states */
 	volatile int transfer_end;
 
@@ -126,4 +149,6 @@ struct jz_mmc_host {
 
 void jz_mmc_finish_request(struct jz_mmc_host *host, struct mmc_request *mrq);
 
+extern int jzmmc_highspeed;
+
 #endif /* __JZ_MMC_HOST_H__ */
@@ -89,7 +89,6 @@ void jz_mmc_stop_dma(struct jz_mmc_host *host)
 		}							\
 	} while (0)
 
-#ifdef USE_DMA_DESC
 static int sg_to_desc(struct scatterlist *sgentry, JZ_MSC_DMA_DESC *first_desc,
 		      int *desc_pos /* IN OUT */, int mode, int ctrl_id,
 		      struct jz_mmc_host *host) {
@@ -126,6 +125,10 @@ static int sg_to_desc(struct scatterlist *sgentry, JZ_MSC_DMA_DESC *first_desc,
 	burst4_dma_addr = max_burst_dma_addr + max_burst_len;
 	burst4_len = dma_len & 63;
 
+	/* out of descriptors, fall back to PIO mode */
+	if (pos + !!max_burst_len + !!burst4_len > JZ_MSC_DMA_DESC_NUM)
+		return -1;
+
 	if (max_burst_len) {
 		desc = first_desc + pos;
 		next = (dma_desc_phys_addr + (pos + 1) * (sizeof(JZ_MSC_DMA_DESC))) >> 4;
@@ -191,18 +194,10 @@ static int sg_to_desc(struct scatterlist *sgentry, JZ_MSC_DMA_DESC *first_desc,
 #define JZ_MSC_RECORD_DESC_NUM(num)	do {  } while(0)
 #endif
 
-int jz_mmc_start_scatter_dma(int chan, struct jz_mmc_host *host,
-			      struct scatterlist *sg, unsigned int sg_len, int mode) {
-	int i = 0;
-	int desc_pos = 0;
-	dma_addr_t dma_desc_phy_addr = 0;
-	struct mmc_data *data = host->curr_mrq->data;
-	struct scatterlist *sgentry;
-	JZ_MSC_DMA_DESC *desc;
-	JZ_MSC_DMA_DESC *desc_first;
-	unsigned long flags;
+/* Wait for the channel to go idle, called before a new chain is built */
+static void jz_mmc_wait_dma_idle(int chan, struct jz_mmc_host *host)
+{
 	unsigned long start_time = jiffies;
-	int ret = 0;
 
 	while (REG_DMAC_DMACR(chan / HALF_DMA_NUM) & (DMAC_DMACR_HLT | DMAC_DMACR_AR)) {
 		if (jiffies - start_time > 10) { /* 100ms */
@@ -220,16 +215,16 @@ int jz_mmc_start_scatter_dma(int chan, struct jz_mmc_host *host,
 			break;
 		}
 	}
+}
 
-	REG_DMAC_DCCSR(chan) |= DMAC_DCCSR_DES8;
-	REG_DMAC_DCCSR(chan) &= ~DMAC_DCCSR_NDES;
-
-	/* Setup request source */
-	if (DMA_MODE_WRITE == mode) {
-		MSC_SET_OUT_REQ_SRC(host->pdev_id, REG_DMAC_DRSR(chan));
-	} else {
-		MSC_SET_IN_REQ_SRC(host->pdev_id, REG_DMAC_DRSR(chan));
-	}
+/* Turn the sg list into a descriptor chain in host->dma_desc */
+static int jz_mmc_build_scatter_dma(struct jz_mmc_host *host,
+				    struct scatterlist *sg, unsigned int sg_len, int mode) {
+	int i = 0;
+	int desc_pos = 0;
+	struct scatterlist *sgentry;
+	JZ_MSC_DMA_DESC *desc;
+	int ret = 0;
 
 #ifdef MSC_DEBUG_DMA
 	if (DMA_MODE_WRITE == mode) {
@@ -240,121 +235,61 @@ int jz_mmc_start_scatter_dma(int chan, struct jz_mmc_host *host,
 #endif
 
 	desc = host->dma_desc;
-	JZ_MSC_RECORD_DESC_NUM(desc_pos);
-	desc_first = desc;
-
-	dma_desc_phy_addr  = CPHYSADDR((unsigned long)desc);
 
-	memset(desc, 0, PAGE_SIZE);
+	/* every segment takes at most two descriptors */
+	memset(desc, 0, min_t(unsigned int, 2 * sg_len, JZ_MSC_DMA_DESC_NUM) * sizeof(JZ_MSC_DMA_DESC));
 
-	desc_pos = 0;
-	flags = claim_dma_lock();
-	for_each_sg(data->sg, sgentry, host->dma.len, i) {
+	for_each_sg(sg, sgentry, sg_len, i) {
 		ret = sg_to_desc(sgentry, desc, &desc_pos, mode, host->pdev_id, host);
 		if (ret < 0)
-			goto out;
+			return ret;
 	}
+	JZ_MSC_RECORD_DESC_NUM(desc_pos);
 
 	desc = desc + (desc_pos - 1);
 	desc->dcmd |= DMAC_DCMD_TIE;
 	desc->dcmd &= ~DMAC_DCMD_LINK;
 	desc->ddadr &= ~0xff000000;
 
-	dma_cache_wback_inv((unsigned long)desc_first, desc_pos * sizeof(JZ_MSC_DMA_DESC));
-
-        /* Setup DMA descriptor address */
-	REG_DMAC_DDA(chan) = dma_desc_phy_addr;
-
-	/* DMA doorbell set -- start DMA now ... */
-	REG_DMAC_DMADBSR(chan / HALF_DMA_NUM) = 1 << (chan - (chan / HALF_DMA_NUM) * HALF_DMA_NUM) ;
-
-	/* Enable DMA */
-	REG_DMAC_DMACR(chan / HALF_DMA_NUM) |= DMAC_DMACR_DMAE;
-
-	REG_DMAC_DCCSR(chan) |= DMAC_DCCSR_EN;
-
- out:
-	release_dma_lock(flags);
-	return ret;
+	dma_cache_wback_inv((unsigned long)host->dma_desc, desc_pos * sizeof(JZ_MSC_DMA_DESC));
 
+	return 0;
 }
-#else
-void jz_mmc_start_normal_dma(struct jz_mmc_host *host, unsigned long phyaddr, int count, int mode, int ds)
+
+/*
+ * Start the chain built by jz_mmc_prepare_dma(). Only register writes,
+ * so jz_mmc_irq() may call it the moment a write command is answered.
+ */
+void jz_mmc_kick_dma(struct jz_mmc_host *host)
 {
-	unsigned long flags;
-	unsigned long start_time = jiffies;
 	int chan = host->dma.channel;
-	u32 dma_cmd = 0;
-	u32 src_addr = 0;
-	u32 dst_addr = 0;
-	u32 req_src = 0;
-
-	while (REG_DMAC_DMACR(chan / HALF_DMA_NUM) & (DMAC_DMACR_HLT | DMAC_DMACR_AR)) {
-		if (jiffies - start_time > 10) { /* 100ms */
-			printk("DMAC unavailable! REG_DMAC_DMACR(%d) = 0x%08x\n", chan / HALF_DMA_NUM, REG_DMAC_DMACR(chan / HALF_DMA_NUM));
-			jz_mmc_stop_dma(host);
-			break;
-		}
-	}
-
-	start_time = jiffies;
-	while (REG_DMAC_DCCSR(chan) & (DMAC_DCCSR_HLT | DMAC_DCCSR_TT | DMAC_DCCSR_AR)) {
-		if (jiffies - start_time > 10) { /* 100ms */
-			printk("DMA channel %d unavailable! REG_DMAC_DCCSR(%d) = 0x%08x\n", chan, chan, REG_DMAC_DCCSR(chan));
-			jz_mmc_stop_dma(host);
-			break;
-		}
-	}
+	unsigned long flags;
 
 	flags = claim_dma_lock();
-	dma_cmd = DMAC_DCMD_SWDH_32 | DMAC_DCMD_DWDH_32 | DMAC_DCMD_RDIL_IGN | DMAC_DCMD_TIE;
-	switch (ds) {
-#ifdef USE_DMA_BUSRT_64
-	case 64:
-		dma_cmd |= DMAC_DCMD_DS_64BYTE;
-		break;
-#endif
-
-	case 32:
-		dma_cmd |= DMAC_DCMD_DS_32BYTE;
-		break;
 
-	case 16:
-		dma_cmd |= DMAC_DCMD_DS_16BYTE;
-		break;
-
-	case 4:
-		dma_cmd |= DMAC_DCMD_DS_32BIT;
-		break;
+	REG_DMAC_DCCSR(chan) |= DMAC_DCCSR_DES8;
+	REG_DMAC_DCCSR(chan) &= ~DMAC_DCCSR_NDES;
 
-	default:
-		;
-	}
-	if (DMA_MODE_WRITE == mode) {
-		dma_cmd |= DMAC_DCMD_SAI;
-		src_addr = (unsigned int)phyaddr;      /* DMA source address */
-		dst_addr = CPHYSADDR(MSC_TXFIFO(host->pdev_id));      /* DMA target address */
-		MSC_SET_OUT_REQ_SRC(host->pdev_id, req_src);
+	/* Setup request source */
+	if (host->dma.dir == DMA_TO_DEVICE) {
+		MSC_SET_OUT_REQ_SRC(host->pdev_id, REG_DMAC_DRSR(chan));
 	} else {
-		dma_cmd |= DMAC_DCMD_DAI;
-		src_addr = CPHYSADDR(MSC_RXFIFO(host->pdev_id));
-		dst_addr = (unsigned int)phyaddr;
-		MSC_SET_IN_REQ_SRC(host->pdev_id, req_src);
+		MSC_SET_IN_REQ_SRC(host->pdev_id, REG_DMAC_DRSR(chan));
 	}
 
-	REG_DMAC_DCCSR(chan) |= DMAC_DCCSR_NDES; /* No-descriptor transfer */
-	REG_DMAC_DSAR(chan) = src_addr;
-	REG_DMAC_DTAR(chan) = dst_addr;
-	REG_DMAC_DTCR(chan) = (count + ds - 1) / ds;
-	REG_DMAC_DCMD(chan) = dma_cmd;
-	REG_DMAC_DRSR(chan) = req_src;
+        /* Setup DMA descriptor address */
+	REG_DMAC_DDA(chan) = CPHYSADDR((unsigned long)host->dma_desc);
 
+	/* DMA doorbell set -- start DMA now ... */
+	REG_DMAC_DMADBSR(chan / HALF_DMA_NUM) = 1 << (chan - (chan / HALF_DMA_NUM) * HALF_DMA_NUM) ;
+
+	/* Enable DMA */
 	REG_DMAC_DMACR(chan / HALF_DMA_NUM) |= DMAC_DMACR_DMAE;
+
 	REG_DMAC_DCCSR(chan) |= DMAC_DCCSR_EN;
 
 	release_dma_lock(flags);
 }
-#endif
 
 static void jz_mmc_highmem_dma_map_sg(struct scatterlist *sgl, unsigned int nents, int is_write)
 {
@@ -382,14 +317,15 @@ static void jz_mmc_highmem_dma_map_sg(struct scatterlist *sgl, unsigned int nent
 	local_irq_restore(flags);
 }
 
-int jz_mmc_start_dma(struct jz_mmc_host *host) {
+/*
+ * Map the data and build its descriptor chain without starting the
+ * DMAC, so the cache maintenance and descriptor setup run while the
+ * command is still on the bus. Returns < 0 when the data has to go by
+ * PIO instead.
+ */
+int jz_mmc_prepare_dma(struct jz_mmc_host *host) {
 	struct mmc_data *data = host->curr_mrq->data;
 	int mode;
-#ifndef USE_DMA_DESC
-	int i;
-	int ds = 4;
-	struct scatterlist *sgentry;
-#endif
 	int ret = 0;
 
 	host->transfer_mode = JZ_TRANS_MODE_DMA;
@@ -402,6 +338,8 @@ int jz_mmc_start_dma(struct jz_mmc_host *host) {
 		host->dma.dir = DMA_FROM_DEVICE;
 	}
 
+	jz_mmc_wait_dma_idle(host->dma.channel, host);
+
 #ifndef CONFIG_HIGHMEM
 	host->dma.len =
 	    dma_map_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
@@ -411,38 +349,7 @@ int jz_mmc_start_dma(struct jz_mmc_host *host) {
 	host->dma.len = data->sg_len;
 #endif
 
-#ifdef USE_DMA_DESC
-	ret = jz_mmc_start_scatter_dma(host->dma.channel, host, data->sg, host->dma.len, mode);
-#else
-	for_each_sg(data->sg, sgentry, host->dma.len, i) {
-		dma_cache_wback_inv((unsigned long)CKSEG0ADDR(sg_phys(sgentry) + data->sg->offset),
-				    sg_dma_len(sgentry));
-
-		if (unlikely((sg_dma_len(sgentry) & 0x3))) {
-			ret = -1;
-			break;
-		}
-
-		if (unlikely(sg_phys(sgentry) & 0x3)) {
-			ret = -1;
-			break;
-		}
-
-		if ((likely(sg_dma_len(sgentry) % 32 == 0)))
-			ds = 32; /* 32 byte */
-		else if (sg_dma_len(sgentry) % 16 == 0)
-			ds = 16; /* 16 byte */
-		else
-			ds = 4; /* default to 4 byte */
-
-		/*
-		 * FIXME: bug here!!!!! if NR_SG > 1(current NR_SG==1),
-		 * must wait for current dma done, then next sg
-		 */
-		jz_mmc_start_normal_dma(host, sg_phys(sgentry),
-				 sg_dma_len(sgentry), mode, ds);
-	}
-#endif
+	ret = jz_mmc_build_scatter_dma(host, data->sg, host->dma.len, mode);
 
 	if (ret < 0) {
 		dma_unmap_sg(mmc_dev(host->mmc), data->sg, host->dma.len,
@@ -453,6 +360,15 @@ int jz_mmc_start_dma(struct jz_mmc_host *host) {
 	return ret;
 }
 
+int jz_mmc_start_dma(struct jz_mmc_host *host) {
+	int ret = jz_mmc_prepare_dma(host);
+
+	if (ret == 0)
+		jz_mmc_kick_dma(host);
+
+	return ret;
+}
+
 static irqreturn_t jz_mmc_dma_callback(int irq, void *devid)
 {
 	struct jz_mmc_host *host = devid;
@@ -510,9 +426,12 @@ static int jz_mmc_init_dma(struct jz_mmc_host *host)
 
 	REG_DMAC_DMACR(host->dma.channel / HALF_DMA_NUM) |= DMAC_DMACR_FMSC;
 
-#ifdef USE_DMA_DESC
 	host->dma_desc = (JZ_MSC_DMA_DESC *)__get_free_pages(GFP_KERNEL, 0);
-#endif
+	if (!host->dma_desc) {
+		printk(KERN_ERR "no memory for MMC DMA descriptors\n");
+		jz_free_dma(host->dma.channel);
+		goto err_out;
+	}
 
 	return 0;
 err_out:
@@ -522,6 +441,7 @@ err_out:
 static void jz_mmc_deinit_dma(struct jz_mmc_host *host)
 {
 	jz_free_dma(host->dma.channel);
+	free_pages((unsigned long)host->dma_desc, 0);
 }
 
 int jz_mmc_dma_register(struct jz_mmc_dma *dma)
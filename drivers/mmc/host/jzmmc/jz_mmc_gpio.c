@@ -98,6 +98,7 @@ stable:
 		}
 
 		wake_up_interruptible(&host->data_wait_queue);
+		complete(&host->irq_done);
 	}
 
 	if ( (1 == host->oldstat) && (0 == host->eject) ) {
@@ -38,6 +38,11 @@ EXPORT_SYMBOL(is_virt_addr_valid);
 
 struct jz_mmc_controller controller[JZ_MAX_MSC_NUM];
 
+/* run high-speed cards at SD_CLOCK_HS, falls back per card on CRC errors */
+int jzmmc_highspeed = 0;
+module_param(jzmmc_highspeed, int, 0444);
+MODULE_PARM_DESC(jzmmc_highspeed, "Run SD high-speed cards at 48MHz, falling back to 24MHz on CRC errors");
+
 /* add partitions info for recovery */
 #ifdef CONFIG_JZ_SYSTEM_AT_CARD
 static ssize_t jz_mmc_partitions_show(struct device *dev,struct device_attribute *attr, char *buf)
@@ -85,11 +90,30 @@ static DEVICE_ATTR(partitions, S_IRUSR | S_IRGRP | S_IROTH, jz_mmc_partitions_sh
 static DEVICE_ATTR(recovery_permission, S_IWUSR, NULL, jz_mmc_permission_set);
 #endif
 
+static ssize_t jz_mmc_bus_clock_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct jz_mmc_host *host = mmc_priv(dev_get_drvdata(dev));
+
+	return sprintf(buf, "%u\n", host->bus_clock);
+}
+
+static ssize_t jz_mmc_hs_retries_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct jz_mmc_host *host = mmc_priv(dev_get_drvdata(dev));
+
+	return sprintf(buf, "%u\n", host->hs_retries);
+}
+
+static DEVICE_ATTR(bus_clock, S_IRUSR | S_IRGRP | S_IROTH, jz_mmc_bus_clock_show, NULL);
+static DEVICE_ATTR(hs_retries, S_IRUSR | S_IRGRP | S_IROTH, jz_mmc_hs_retries_show, NULL);
+
 static struct attribute *jz_mmc_attributes[] = {
 #ifdef CONFIG_JZ_SYSTEM_AT_CARD
 	&dev_attr_partitions.attr,
 	&dev_attr_recovery_permission.attr,
 #endif
+	&dev_attr_bus_clock.attr,
+	&dev_attr_hs_retries.attr,
 	NULL
 };
 
@@ -379,19 +403,27 @@ static int jz_mmc_probe(struct platform_device *pdev)
 	mmc->ocr_avail = plat->ocr_mask;
 	mmc->caps |= host->plat->max_bus_width;
 
+	/*
+	 * The core already switches high-speed cards with CMD6 when the
+	 * board sets MMC_CAP_SD_HIGHSPEED, f_max is what keeps them at 24MHZ
+	 */
+	if (jzmmc_highspeed &&
+	    (mmc->caps & (MMC_CAP_SD_HIGHSPEED | MMC_CAP_MMC_HIGHSPEED))) {
+		host->hs_allowed = 1;
+		mmc->f_max = SD_CLOCK_HS;
+	}
+
 
 	mmc->max_seg_size = 64 * 1024; /* our DMA can support 16M per seg, but what is the best size?
 					* How to determine the best size?
 					* 16M / 64 = 128K to avoid if all the segs are mergable!
 					* 64K maybe the best value
 					*/
-#ifndef CONFIG_MMC_BLOCK_BOUNCE
-	mmc->max_phys_segs = 64;    /* when use 8-word DMA descriptor, we can have max of 128 descriptors
-				     * a segment may split to 2 descriptors, so the max segs is 128 / 2 = 64
-				     */
-#else
-	mmc->max_phys_segs = 1;
-#endif
+	mmc->max_phys_segs = JZ_MSC_MAX_SEGS; /* a page holds 128 8-word descriptors and a segment
+					       * may split to 2 of them, so the max segs is 128 / 2 = 64.
+					       * More than one segment also keeps the block layer from
+					       * using its bounce buffer.
+					       */
 
 	mmc->max_hw_segs = mmc->max_phys_segs;
 
@@ -417,14 +449,12 @@ static int jz_mmc_probe(struct platform_device *pdev)
 	msc_hosts[host->pdev_id] = host;
 #endif
 
-#if defined(CONFIG_JZ_SYSTEM_AT_CARD)
 	{
 		int  sysfs_ret = 0;
 		sysfs_ret = sysfs_create_group(&pdev->dev.kobj, &jz_mmc_attr_group);
 		if (sysfs_ret)
 			printk(KERN_WARNING"MSC: failed to create sysfs group!\n");
 	}
-#endif
 
 	printk("JZ %s driver registered\n", mmc_hostname(host->mmc));
 
@@ -441,6 +471,7 @@ static int jz_mmc_remove(struct platform_device *pdev)
 	struct mmc_host *mmc = platform_get_drvdata(pdev);
 	struct jz_mmc_platform_data *plat = pdev->dev.platform_data;
 
+	sysfs_remove_group(&pdev->dev.kobj, &jz_mmc_attr_group);
 	platform_set_drvdata(pdev, NULL);
 
 	if (mmc) {
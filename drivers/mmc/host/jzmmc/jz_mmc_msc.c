@@ -27,6 +27,15 @@
 	 MSC_STAT_CRC_READ_ERROR | MSC_STAT_CRC_WRITE_ERROR_MASK |	\
 	 MSC_STAT_TIME_OUT_RES | MSC_STAT_TIME_OUT_READ)
 
+/* IREG error bits, they end a jz_mmc_wait_irq() early */
+#define MSC_IREG_CMD_ERR_BITS	(MSC_IREG_TIMEOUT_RES | MSC_IREG_CRC_RES_ERR)
+#define MSC_IREG_ERR_BITS						\
+	(MSC_IREG_CMD_ERR_BITS | MSC_IREG_CRC_READ_ERR |		\
+	 MSC_IREG_CRC_WRITE_ERR | MSC_IREG_TIMEOUT_READ)
+
+#define JZ_MMC_CMD_TIMEOUT	HZ		/* RESTO bounds it far lower */
+#define JZ_MMC_PRG_TIMEOUT	(5 * HZ)	/* card busy after a write or erase */
+
 #if 1
 
 static int jzmmc_trace_level = 0;
@@ -170,21 +179,43 @@ static inline int msc_calc_clkrt(int clk_src, u32 rate)
 	return i;
 }
 
+/*
+ * Above 24MHZ only when high speed was asked for at probe and the
+ * current card has not shown CRC errors there yet. A clock at or below
+ * the identification rate means a new card, which gets its own try.
+ */
+static int jz_mmc_hs_rate(struct jz_mmc_host *host, int rate)
+{
+	if (rate <= MMC_CLOCK_MIN)
+		host->hs_failed = 0;
+
+	if (rate > SD_CLOCK_24M && (!host->hs_allowed || host->hs_failed))
+		rate = SD_CLOCK_24M;
+
+	return rate;
+}
+
 #if defined(CONFIG_SOC_JZ4760) || defined(CONFIG_SOC_JZ4760B)
 void jz_mmc_set_clock(struct jz_mmc_host *host, int rate) 
 {
 	int clkrt;
+	int clk_src;
 
 	/*
-	 * NOTE: we do not support >24MHZ on JZ4760(B)
-	 * add this check in case users who defined SD_CLOCK_MAX > 24MHZ
+	 * NOTE: >24MHZ on JZ4760(B) is only used with jzmmc_highspeed, and
+	 * the card is checked for CRC errors by jz_mmc_hs_fallback().
+	 *
+	 * MSCCLK is shared by MSC0 and MSC2, so it stays at one rate for the
+	 * whole boot and each host only picks its own CLKRT divider.
 	 */
-	if (rate > SD_CLOCK_24M)
-		rate = SD_CLOCK_24M;
+	rate = jz_mmc_hs_rate(host, rate);
+	clk_src = jzmmc_highspeed ? SD_CLOCK_HS : SD_CLOCK_24M;
 
-	cpm_set_clock(CGU_MSCCLK, SD_CLOCK_24M);
+	cpm_set_clock(CGU_MSCCLK, clk_src);
 	clkrt = msc_calc_clkrt(cpm_get_clock(CGU_MSCCLK), rate);
 	REG_MSC_CLKRT(host->pdev_id) = clkrt;	
+
+	host->bus_clock = cpm_get_clock(CGU_MSCCLK) >> clkrt;
 }
 #endif
 
@@ -209,8 +240,10 @@ void jz_mmc_set_clock(struct jz_mmc_host *host, int rate)
 		panic("%s: no existing MMC host(%d)\n", __func__, host->pdev_id);
 	}
 
+	rate = jz_mmc_hs_rate(host, rate);
+
 	if (rate > SD_CLOCK_24M) {
-		clk_src = SD_CLOCK_MAX;
+		clk_src = rate;
 		REG_MSC_LPM(host->pdev_id) |= 0x1 << 31;	// send cmd and data at clock rising
 	} else{
 		clk_src = SD_CLOCK_24M;
@@ -222,9 +255,29 @@ void jz_mmc_set_clock(struct jz_mmc_host *host, int rate)
 	clkrt = msc_calc_clkrt(cpm_get_clock(cgu_clk), rate);
 
 	REG_MSC_CLKRT(host->pdev_id) = clkrt;
+
+	host->bus_clock = cpm_get_clock(cgu_clk) >> clkrt;
 }
 #endif
 
+/*
+ * A CRC error while running above 24MHZ: drop this card back to 24MHZ.
+ * The request still fails with -EILSEQ and mmc_block retries it at the
+ * lower clock.
+ */
+static void jz_mmc_hs_fallback(struct jz_mmc_host *host)
+{
+	if (host->bus_clock <= SD_CLOCK_24M)
+		return;
+
+	host->hs_failed = 1;
+	host->hs_retries++;
+	printk(KERN_WARNING "jz-msc%d: CRC error at %uHz, falling back to %dHz\n",
+	       host->pdev_id, host->bus_clock, SD_CLOCK_24M);
+
+	jz_mmc_set_clock(host, SD_CLOCK_24M);
+}
+
 static void jz_mmc_enable_irq(struct jz_mmc_host *host, unsigned int mask)
 {
 	REG_MSC_IMASK(host->pdev_id) &= ~mask;
@@ -235,6 +288,40 @@ static void jz_mmc_disable_irq(struct jz_mmc_host *host, unsigned int mask)
 	REG_MSC_IMASK(host->pdev_id) |= mask;
 }
 
+/*
+ * Sleep until one of the IREG bits in mask is raised or the card is
+ * ejected. jz_mmc_irq() masks the bits again and completes irq_done.
+ * The IREG bits are left set for the caller to check and clear, and a
+ * bit raised before the call fires as soon as it is unmasked.
+ *
+ * Returns the IREG bits of mask that are set, 0 on timeout or eject.
+ */
+static unsigned int jz_mmc_wait_irq(struct jz_mmc_host *host, unsigned int mask, long timeout)
+{
+	unsigned long flags;
+
+	if (host->eject)
+		return 0;
+
+	local_irq_save(flags);
+	INIT_COMPLETION(host->irq_done);
+	host->irq_wait = mask;
+	jz_mmc_enable_irq(host, mask);
+	local_irq_restore(flags);
+
+	wait_for_completion_timeout(&host->irq_done, timeout);
+
+	local_irq_save(flags);
+	host->irq_wait = 0;
+	jz_mmc_disable_irq(host, mask);
+	local_irq_restore(flags);
+
+	if (host->eject)
+		return 0;
+
+	return REG_MSC_IREG(host->pdev_id) & mask;
+}
+
 static int jz_mmc_parse_cmd_response(struct jz_mmc_host *host, unsigned int stat)
 {
 	struct mmc_command *cmd = host->curr_mrq->cmd;
@@ -323,6 +410,7 @@ static int jz_mmc_parse_cmd_response(struct jz_mmc_host *host, unsigned int stat
 			if ((cmd->resp[0] & 0x80000000) == 0)
 				cmd->error = -EILSEQ;
 		}
+		jz_mmc_hs_fallback(host);
 	}
 
 	TRACE_CMD_RES();
@@ -332,12 +420,20 @@ static int jz_mmc_parse_cmd_response(struct jz_mmc_host *host, unsigned int stat
 
 extern void jz_mmc_start_pio(struct jz_mmc_host *host);
 
-void jz_mmc_data_start(struct jz_mmc_host *host)
+/*
+ * Program NOB/BLKLEN and, when the data can go by DMA, map it and build
+ * the descriptor chain. Called before the command is sent so the CPU
+ * work overlaps the command phase; jz_mmc_data_start() then only has
+ * to kick the DMAC (or run PIO).
+ */
+static void jz_mmc_data_prepare(struct jz_mmc_host *host)
 {
 	struct mmc_data *data = host->curr_mrq->data;
 	unsigned int nob = data->blocks;
 	unsigned int block_size = data->blksz;
 
+	host->dma_ready = 0;
+
 	/* NOTE: this flag is never test! */
 	if (data->flags & MMC_DATA_STREAM)
 		nob = 0xffff;
@@ -350,20 +446,39 @@ void jz_mmc_data_start(struct jz_mmc_host *host)
 	 */
 	if (unlikely((block_size & 0x3) || ((nob * block_size) <= 64))) {
 		//printk("===>use pio1\n");
-		jz_mmc_start_pio(host);
 		return;
 	}
 
 #ifdef JZ_MSC_USE_DMA
-	if (jz_mmc_start_dma(host) < 0) {
+	if (jz_mmc_prepare_dma(host) < 0)
 		printk("===>use pio2\n");
-		jz_mmc_start_pio(host);
-	}
-#else
-	jz_mmc_start_pio(host);
+	else
+		host->dma_ready = 1;
 #endif
 }
 
+/* Take back a write DMA kick jz_mmc_irq() has not done yet, returns 1 if it was pending */
+static int jz_mmc_claim_kick(struct jz_mmc_host *host)
+{
+	unsigned long flags;
+	int kick;
+
+	local_irq_save(flags);
+	kick = host->dma_kick;
+	host->dma_kick = 0;
+	local_irq_restore(flags);
+
+	return kick;
+}
+
+void jz_mmc_data_start(struct jz_mmc_host *host)
+{
+	if (host->dma_ready)
+		jz_mmc_kick_dma(host);
+	else
+		jz_mmc_start_pio(host);
+}
+
 volatile u32 jz_mmc_junk = 0;
 EXPORT_SYMBOL(jz_mmc_junk);
 
@@ -561,39 +676,26 @@ static u32 jz_mmc_wait_status(struct jz_mmc_host *host, u32 st_mask,
 //extern volatile int error_may_happen;
 
 static u32 jz_mmc_wait_cmd_done(struct jz_mmc_host *host) {
-	u32 timeout = 0x7fffffff;
 	struct mmc_command *cmd = host->curr_mrq->cmd;
 	int cmd_succ = 0;
 	u32 stat = 0;
 
-#if 0
-	/* this may slow down the card response from the usrs' view, but more friendly to other kernel parts */
-	jz_mmc_wait_status(host, MSC_STAT_END_CMD_RES | MSC_STAT_TIME_OUT_RES | MSC_STAT_CRC_RES_ERR,
-			   -1, 1, 0); /* interval: 1jiffie = 10ms */
-#else
-	//wait_cmd_done = 1;
-	while (!(REG_MSC_STAT(host->pdev_id) & (MSC_STAT_END_CMD_RES | MSC_STAT_TIME_OUT_RES | MSC_STAT_CRC_RES_ERR)) &&
-	       (host->eject == 0)) {
-#if 0
-		if (error_may_happen)
-			jz_mmc_dump_regs(host->pdev_id, __LINE__);
-#endif
-	}
-	//error_may_happen = 0;
-	//wait_cmd_done = 0;
-#endif
+	if (!(REG_MSC_STAT(host->pdev_id) & (MSC_STAT_END_CMD_RES | MSC_STAT_TIME_OUT_RES | MSC_STAT_CRC_RES_ERR)))
+		jz_mmc_wait_irq(host, MSC_IREG_END_CMD_RES | MSC_IREG_CMD_ERR_BITS, JZ_MMC_CMD_TIMEOUT);
 
-	if (REG_MSC_STAT(host->pdev_id) & MSC_STAT_TIME_OUT_RES)
+	/* Check for status, avoid be cleaned by following command*/
+	stat = REG_MSC_STAT(host->pdev_id);
+	if (stat & MSC_STAT_TIME_OUT_RES)
 		cmd->error = -ETIMEDOUT;
+	if (!(stat & (MSC_STAT_END_CMD_RES | MSC_STAT_TIME_OUT_RES | MSC_STAT_CRC_RES_ERR))) {
+		printk("JZ-MSC%d: no response to cmd %d, state = 0x%08x\n", host->pdev_id, cmd->opcode, stat);
+		cmd->error = -ETIMEDOUT;
+	}
 	if (host->eject) {
 		/* wait response timeout */
-		//printk("===>eject!!! state = 0x%08x\n", REG_MSC_STAT(host->pdev_id));
-		//while (!(REG_MSC_STAT(host->pdev_id) & (MSC_STAT_END_CMD_RES | MSC_STAT_TIME_OUT_RES | MSC_STAT_CRC_RES_ERR)));
 		cmd->error = -ENOMEDIUM;
 	}
 
-	/* Check for status, avoid be cleaned by following command*/
-	stat = REG_MSC_STAT(host->pdev_id);
 	if ((stat & MSC_STAT_END_CMD_RES) &&
 	    !(stat & (MSC_STAT_TIME_OUT_RES | MSC_STAT_CRC_RES_ERR)))
 		cmd_succ = 1;
@@ -601,13 +703,12 @@ static u32 jz_mmc_wait_cmd_done(struct jz_mmc_host *host) {
 	REG_MSC_IREG(host->pdev_id) = MSC_IREG_END_CMD_RES;	/* clear irq flag */
 
 	if (cmd_succ && need_wait_prog_done(cmd)) {
-		timeout = 0x7fffffff;
-		while (--timeout && !(REG_MSC_IREG(host->pdev_id) & MSC_IREG_PRG_DONE) && (host->eject == 0))
-			;
+		/* the card may stay busy for hundreds of ms, sleep through it */
+		unsigned int ireg = jz_mmc_wait_irq(host, MSC_IREG_PRG_DONE, JZ_MMC_PRG_TIMEOUT);
 
 		stat |= (REG_MSC_STAT(host->pdev_id) & MSC_STAT_ERR_BITS);
 		REG_MSC_IREG(host->pdev_id) = MSC_IREG_PRG_DONE;	/* clear status */
-		if ((timeout == 0) || (host->eject)) {
+		if (!ireg) {
 			cmd->error = -ETIMEDOUT;
 			printk("JZ-MSC%d: wait prog_done error when execute_cmd!, state = 0x%08x\n", host->pdev_id, stat);
 		}
@@ -626,13 +727,13 @@ static void jz_mmc_send_stop_cmd(struct jz_mmc_host *host) {
 
 	REG_MSC_RESTO(host->pdev_id) = 0xff;
 
-	REG_MSC_STRPCL(host->pdev_id) |= MSC_STRPCL_START_OP;
+	/* the data error that got us here is still latched in IREG */
+	REG_MSC_IREG(host->pdev_id) = MSC_IREG_PRG_DONE | MSC_IREG_CMD_ERR_BITS;
 
-	/* Becarefull, maybe endless */
-	while(!(REG_MSC_STAT(host->pdev_id) & (MSC_STAT_PRG_DONE | MSC_STAT_ERR_BITS)) &&
-	      !host->eject) ;
+	REG_MSC_STRPCL(host->pdev_id) |= MSC_STRPCL_START_OP;
 
-	if (REG_MSC_STAT(host->pdev_id) | MSC_STAT_ERR_BITS)
+	if (!(jz_mmc_wait_irq(host, MSC_IREG_PRG_DONE | MSC_IREG_CMD_ERR_BITS, JZ_MMC_PRG_TIMEOUT) &
+	      MSC_IREG_PRG_DONE))
 		stop_cmd->error = -ETIMEDOUT;
 
 	REG_MSC_IREG(host->pdev_id) = MSC_IREG_PRG_DONE;
@@ -642,15 +743,12 @@ static int jz_mmc_data_done(struct jz_mmc_host *host)
 {
 	struct mmc_data *data = host->curr_mrq->data;
 	int stat = 0;
-	u32 timeout = 0x7fffffff;
 
 	stat = REG_MSC_STAT(host->pdev_id);
 	REG_MSC_IREG(host->pdev_id) = MSC_IREG_DATA_TRAN_DONE;	/* clear status */
 
 	if (host->curr_mrq && (host->curr_mrq->data->flags & MMC_DATA_WRITE)) {
-		while (--timeout && !(REG_MSC_IREG(host->pdev_id) & MSC_IREG_PRG_DONE))
-			;
-		if (timeout == 0) {
+		if (!jz_mmc_wait_irq(host, MSC_IREG_PRG_DONE, JZ_MMC_PRG_TIMEOUT)) {
 			/* FIXME: aha, we never see this situation happen, what can we do if it happened???
 			 * block.c will send cmd13??? */
 			//host->curr.mrq->cmd->error = -ETIMEDOUT;
@@ -681,6 +779,7 @@ static int jz_mmc_data_done(struct jz_mmc_host *host)
 		       host->pdev_id, stat,
 		       host->curr_mrq? host->curr_mrq->cmd->opcode : -1);
 		data->error = -EILSEQ;
+		jz_mmc_hs_fallback(host);
 	}
 	/*
 	 * There appears to be a hardware design bug here.  There seems to
@@ -699,9 +798,8 @@ static int jz_mmc_data_done(struct jz_mmc_host *host)
 	if (host->curr_mrq->stop) {
 		if ((!(REG_MSC_STAT(host->pdev_id) & MSC_STAT_AUTO_CMD_DONE)) && data->error)
 			jz_mmc_send_stop_cmd(host);
-		else
-			while(!(REG_MSC_STAT(host->pdev_id) & (MSC_STAT_AUTO_CMD_DONE | MSC_STAT_ERR_BITS)) &&
-			      !host->eject) ;
+		else if (!(REG_MSC_STAT(host->pdev_id) & (MSC_STAT_AUTO_CMD_DONE | MSC_STAT_ERR_BITS)))
+			jz_mmc_wait_irq(host, MSC_IREG_AUTO_CMD_DONE | MSC_IREG_ERR_BITS, JZ_MMC_CMD_TIMEOUT);
 
 		REG_MSC_CMDAT(host->pdev_id) &= ~(MSC_CMDAT_SEND_AS_STOP);
 	}
@@ -746,8 +844,13 @@ static void jz_mmc_execute_cmd(struct jz_mmc_host *host)
 	TRACE_CMD_REQ();
 	host->transfer_end = 1;
 
-	if(data && (data->flags & MMC_DATA_READ))
-		jz_mmc_data_start(host);
+	if (data) {
+		jz_mmc_data_prepare(host);
+		if (data->flags & MMC_DATA_READ)
+			jz_mmc_data_start(host);
+		else
+			host->dma_kick = host->dma_ready; /* jz_mmc_irq() kicks it on END_CMD_RES */
+	}
 
 	REG_MSC_RESTO(host->pdev_id) = 0xff;
 	/* Send command */
@@ -765,7 +868,8 @@ static void jz_mmc_execute_cmd(struct jz_mmc_host *host)
 		int acked = 0;
 		if(host->curr_mrq->data->flags & MMC_DATA_WRITE) {
 			jz_mmc_enable_irq(host, MSC_IMASK_DATA_TRAN_DONE);
-			jz_mmc_data_start(host);
+			if (jz_mmc_claim_kick(host) || !host->dma_ready)
+				jz_mmc_data_start(host);
 		}
 
 		err = wait_event_interruptible_timeout(host->data_wait_queue,
@@ -773,7 +877,15 @@ static void jz_mmc_execute_cmd(struct jz_mmc_host *host)
 							|| (REG_MSC_STAT(host->pdev_id) & WAITMASK)),
 						       6 * HZ);
 
-		while(!((REG_MSC_STAT(host->pdev_id) & MSC_STAT_DATA_TRAN_DONE) || (host->eject)));
+		/*
+		 * An error ends the wait before DATA_TRAN_DONE. The irq then
+		 * completes jz_mmc_wait_irq() instead of setting data_ack, so
+		 * set it here and let jz_mmc_data_done() see the error.
+		 */
+		if (!(REG_MSC_STAT(host->pdev_id) & MSC_STAT_DATA_TRAN_DONE) &&
+		    (jz_mmc_wait_irq(host, MSC_IREG_DATA_TRAN_DONE, JZ_MMC_CMD_TIMEOUT) &
+		     MSC_IREG_DATA_TRAN_DONE))
+			host->data_ack = 1;
 		REG_MSC_STAT(host->pdev_id) &= ~(MSC_STAT_DATA_TRAN_DONE);
 
 		acked = host->data_ack;
@@ -819,8 +931,10 @@ static void jz_mmc_execute_cmd(struct jz_mmc_host *host)
 	if (host->eject)
 		cmd->error = -ENOMEDIUM;
 
-	if (host->curr_mrq->data)
+	if (host->curr_mrq->data) {
+		jz_mmc_claim_kick(host);
 		jz_mmc_data_stop(host);
+	}
 
 	/* restore cmd->arg for SET_BLOCKLEN */
 	if (unlikely((cmd->opcode == MMC_SET_BLOCKLEN) && (old_cmd_arg & 0x3))) {
@@ -833,15 +947,26 @@ static irqreturn_t jz_mmc_irq(int irq, void *devid)
 	struct jz_mmc_host *host = devid;
 	unsigned int ireg = 0;
 
-	ireg = REG_MSC_IREG(host->pdev_id);
-	if (ireg) {
-		if (ireg & MSC_IREG_DATA_TRAN_DONE) {
-			jz_mmc_disable_irq(host, MSC_IMASK_DATA_TRAN_DONE);
-			BUG_ON(host->data_ack);
-			host->data_ack = 1;
-			wmb();
-			wake_up_interruptible(&host->data_wait_queue);
+	/* only the unmasked sources, IREG bits stay latched after masking */
+	ireg = REG_MSC_IREG(host->pdev_id) & ~REG_MSC_IMASK(host->pdev_id);
+	if (ireg & host->irq_wait) {
+		/* a write command got its answer: start the prepared DMA right away */
+		if (host->dma_kick &&
+		    (ireg & (MSC_IREG_END_CMD_RES | MSC_IREG_CMD_ERR_BITS)) == MSC_IREG_END_CMD_RES) {
+			host->dma_kick = 0;
+			jz_mmc_kick_dma(host);
 		}
+
+		/* IMASK and IREG bits line up */
+		jz_mmc_disable_irq(host, host->irq_wait);
+		host->irq_wait = 0;
+		complete(&host->irq_done);
+	} else if (ireg & MSC_IREG_DATA_TRAN_DONE) {
+		jz_mmc_disable_irq(host, MSC_IMASK_DATA_TRAN_DONE);
+		BUG_ON(host->data_ack);
+		host->data_ack = 1;
+		wmb();
+		wake_up_interruptible(&host->data_wait_queue);
 	}
 
 
@@ -864,6 +989,10 @@ static int jz_mmc_msc_init(struct jz_mmc_host *host)
 	host->transfer_end = 1;
 	host->transfer_mode = JZ_TRANS_MODE_NULL;
 	init_waitqueue_head(&host->data_wait_queue);
+	init_completion(&host->irq_done);
+	host->irq_wait = 0;
+	host->dma_ready = 0;
+	host->dma_kick = 0;
 #if 0
 	init_waitqueue_head(&host->status_check_queue);
 	init_timer(&host->status_check_timer);
@@ -0,0 +1,446 @@
+/*
+ * Compressed RAM based swap device
+ *
+ * Swap pages written to /dev/ramzswapX are compressed with LZO and kept
+ * in a size class pool (rzs_pool.c).  The swap code notifies the device
+ * when a slot is freed so its memory is returned right away.
+ *
+ * Released under the terms of the GNU General Public License Version 2.0
+ */
+
+#define KMSG_COMPONENT "ramzswap"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/device.h>
+#include <linux/genhd.h>
+#include <linux/highmem.h>
+#include <linux/lzo.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/swap.h>
+#include <linux/vmalloc.h>
+
+#include "ramzswap_drv.h"
+
+static int ramzswap_major;
+static struct ramzswap *devices;
+
+static unsigned int num_devices = 1;
+module_param(num_devices, uint, 0);
+MODULE_PARM_DESC(num_devices, "Number of ramzswap devices");
+
+static unsigned long disksize_kb;
+module_param(disksize_kb, ulong, 0);
+MODULE_PARM_DESC(disksize_kb, "Size of each device in kB "
+		 "(default: " __stringify(DEFAULT_DISKSIZE_PERC_RAM) "% of RAM)");
+
+static int page_zero_filled(void *ptr)
+{
+	unsigned long *page = ptr;
+	unsigned int pos;
+
+	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos])
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Release whatever slot "index" holds. Called with rzs->lock held. */
+static void ramzswap_free_slot(struct ramzswap *rzs, u32 index)
+{
+	struct table *t = &rzs->table[index];
+
+	if (t->flags & RZS_ZERO) {
+		rzs->stats.pages_zero--;
+	} else if (t->flags & RZS_UNCOMPRESSED) {
+		__free_page(t->page);
+		rzs->stats.pages_expand--;
+	} else if (t->page) {
+		rzs_pool_free(&rzs->pool, t->page, t->offset);
+		rzs->stats.pages_stored--;
+		rzs->stats.compr_size -= t->size;
+	}
+
+	t->page = NULL;
+	t->offset = 0;
+	t->size = 0;
+	t->flags = 0;
+}
+
+static void ramzswap_read(struct ramzswap *rzs, struct bio *bio)
+{
+	u32 index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	struct page *page = bio->bi_io_vec[0].bv_page;
+	struct table *t = &rzs->table[index];
+	size_t clen = PAGE_SIZE;
+	void *user_mem;
+	int ret = LZO_E_OK;
+
+	spin_lock(&rzs->lock);
+	rzs->stats.num_reads++;
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	if (!t->page) {
+		/* zero page, or read before write */
+		memset(user_mem, 0, PAGE_SIZE);
+	} else if (t->flags & RZS_UNCOMPRESSED) {
+		memcpy(user_mem, page_address(t->page), PAGE_SIZE);
+	} else {
+		ret = lzo1x_decompress_safe(page_address(t->page) + t->offset,
+					    t->size, user_mem, &clen);
+	}
+	kunmap_atomic(user_mem, KM_USER0);
+	spin_unlock(&rzs->lock);
+
+	if (unlikely(ret != LZO_E_OK || clen != PAGE_SIZE)) {
+		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
+		bio_io_error(bio);
+		return;
+	}
+
+	flush_dcache_page(page);
+	set_bit(BIO_UPTODATE, &bio->bi_flags);
+	bio_endio(bio, 0);
+}
+
+static void ramzswap_write(struct ramzswap *rzs, struct bio *bio)
+{
+	u32 index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	struct page *page = bio->bi_io_vec[0].bv_page;
+	struct page *spare = NULL, *zpage;
+	struct table *t = &rzs->table[index];
+	size_t clen;
+	void *user_mem, *src;
+	u16 offset;
+	u8 flags;
+	int ret;
+
+	user_mem = kmap(page);
+
+	if (page_zero_filled(user_mem)) {
+		kunmap(page);
+		spin_lock(&rzs->lock);
+		rzs->stats.num_writes++;
+		ramzswap_free_slot(rzs, index);
+		t->flags = RZS_ZERO;
+		rzs->stats.pages_zero++;
+		spin_unlock(&rzs->lock);
+		goto out;
+	}
+
+	mutex_lock(&rzs->compress_lock);
+	ret = lzo1x_1_compress(user_mem, PAGE_SIZE, rzs->compress_buffer,
+			       &clen, rzs->compress_workmem);
+	if (unlikely(ret != LZO_E_OK)) {
+		pr_err("Compression failed! err=%d\n", ret);
+		goto out_unlock;
+	}
+
+	src = rzs->compress_buffer;
+	if (unlikely(clen > MAX_CPAGE_SIZE)) {
+		src = user_mem;
+		clen = PAGE_SIZE;
+	}
+
+retry:
+	spin_lock(&rzs->lock);
+	if (clen == PAGE_SIZE) {
+		if (!spare)
+			goto alloc_spare;
+		zpage = spare;
+		spare = NULL;
+		offset = 0;
+		flags = RZS_UNCOMPRESSED;
+	} else {
+		if (rzs_pool_alloc(&rzs->pool, clen, &spare, &zpage, &offset))
+			goto alloc_spare;
+		flags = 0;
+	}
+
+	memcpy(page_address(zpage) + offset, src, clen);
+
+	rzs->stats.num_writes++;
+	ramzswap_free_slot(rzs, index);
+	t->page = zpage;
+	t->offset = offset;
+	t->size = clen;
+	t->flags = flags;
+	if (flags & RZS_UNCOMPRESSED) {
+		rzs->stats.pages_expand++;
+	} else {
+		rzs->stats.pages_stored++;
+		rzs->stats.compr_size += clen;
+	}
+	spin_unlock(&rzs->lock);
+
+	mutex_unlock(&rzs->compress_lock);
+	kunmap(page);
+	if (spare)
+		__free_page(spare);
+out:
+	set_bit(BIO_UPTODATE, &bio->bi_flags);
+	bio_endio(bio, 0);
+	return;
+
+alloc_spare:
+	spin_unlock(&rzs->lock);
+	/* lowmem only, the pool addresses pages with page_address() */
+	spare = alloc_page(GFP_NOIO | __GFP_NOWARN);
+	if (spare)
+		goto retry;
+
+out_unlock:
+	mutex_unlock(&rzs->compress_lock);
+	kunmap(page);
+	spin_lock(&rzs->lock);
+	rzs->stats.failed_writes++;
+	spin_unlock(&rzs->lock);
+	bio_io_error(bio);
+}
+
+/* Swap only ever does single, page aligned, page sized I/O */
+static inline int valid_swap_request(struct ramzswap *rzs, struct bio *bio)
+{
+	if (unlikely(bio->bi_sector >= (rzs->disksize >> SECTOR_SHIFT) ||
+		     (bio->bi_sector & (SECTORS_PER_PAGE - 1)) ||
+		     bio->bi_vcnt != 1 || bio->bi_size != PAGE_SIZE ||
+		     bio->bi_io_vec[0].bv_offset != 0))
+		return 0;
+
+	return 1;
+}
+
+static int ramzswap_make_request(struct request_queue *queue, struct bio *bio)
+{
+	struct ramzswap *rzs = queue->queuedata;
+
+	if (!valid_swap_request(rzs, bio)) {
+		bio_io_error(bio);
+		return 0;
+	}
+
+	if (bio_data_dir(bio) == READ)
+		ramzswap_read(rzs, bio);
+	else
+		ramzswap_write(rzs, bio);
+
+	return 0;
+}
+
+static void ramzswap_slot_free_notify(struct block_device *bdev,
+				      unsigned long index)
+{
+	struct ramzswap *rzs = bdev->bd_disk->private_data;
+
+	if (index >= rzs->disksize >> PAGE_SHIFT)
+		return;
+
+	spin_lock(&rzs->lock);
+	ramzswap_free_slot(rzs, index);
+	rzs->stats.notify_free++;
+	spin_unlock(&rzs->lock);
+}
+
+static struct block_device_operations ramzswap_devops = {
+	.swap_slot_free_notify = ramzswap_slot_free_notify,
+	.owner = THIS_MODULE,
+};
+
+/*
+ * sysfs statistics, in /sys/block/ramzswapX/
+ */
+static inline struct ramzswap *dev_to_rzs(struct device *dev)
+{
+	return dev_to_disk(dev)->private_data;
+}
+
+#define RZS_STAT_ATTR(_name, _expr)					\
+static ssize_t _name##_show(struct device *dev,				\
+			    struct device_attribute *attr, char *buf)	\
+{									\
+	struct ramzswap *rzs = dev_to_rzs(dev);				\
+	u64 val;							\
+									\
+	spin_lock(&rzs->lock);						\
+	val = (_expr);							\
+	spin_unlock(&rzs->lock);					\
+	return sprintf(buf, "%llu\n", (unsigned long long)val);	\
+}									\
+static DEVICE_ATTR(_name, S_IRUGO, _name##_show, NULL)
+
+RZS_STAT_ATTR(disksize, rzs->disksize);
+RZS_STAT_ATTR(num_reads, rzs->stats.num_reads);
+RZS_STAT_ATTR(num_writes, rzs->stats.num_writes);
+RZS_STAT_ATTR(failed_writes, rzs->stats.failed_writes);
+RZS_STAT_ATTR(notify_free, rzs->stats.notify_free);
+RZS_STAT_ATTR(zero_pages, rzs->stats.pages_zero);
+RZS_STAT_ATTR(orig_data_size,
+	      (u64)(rzs->stats.pages_stored + rzs->stats.pages_expand)
+	      << PAGE_SHIFT);
+RZS_STAT_ATTR(compr_data_size, rzs->stats.compr_size);
+RZS_STAT_ATTR(mem_used_total,
+	      (u64)(rzs->pool.nr_pages + rzs->stats.pages_expand)
+	      << PAGE_SHIFT);
+
+static struct attribute *ramzswap_attrs[] = {
+	&dev_attr_disksize.attr,
+	&dev_attr_num_reads.attr,
+	&dev_attr_num_writes.attr,
+	&dev_attr_failed_writes.attr,
+	&dev_attr_notify_free.attr,
+	&dev_attr_zero_pages.attr,
+	&dev_attr_orig_data_size.attr,
+	&dev_attr_compr_data_size.attr,
+	&dev_attr_mem_used_total.attr,
+	NULL,
+};
+
+static struct attribute_group ramzswap_attr_group = {
+	.attrs = ramzswap_attrs,
+};
+
+static void destroy_device(struct ramzswap *rzs)
+{
+	size_t index;
+
+	if (rzs->disk) {
+		sysfs_remove_group(&disk_to_dev(rzs->disk)->kobj,
+				   &ramzswap_attr_group);
+		del_gendisk(rzs->disk);
+		put_disk(rzs->disk);
+	}
+
+	if (rzs->queue)
+		blk_cleanup_queue(rzs->queue);
+
+	if (rzs->table) {
+		for (index = 0; index < rzs->disksize >> PAGE_SHIFT; index++)
+			ramzswap_free_slot(rzs, index);
+		vfree(rzs->table);
+	}
+
+	free_pages((unsigned long)rzs->compress_buffer, 1);
+	kfree(rzs->compress_workmem);
+}
+
+static int create_device(struct ramzswap *rzs, int device_id)
+{
+	size_t num_pages;
+
+	spin_lock_init(&rzs->lock);
+	mutex_init(&rzs->compress_lock);
+	rzs_pool_init(&rzs->pool);
+
+	if (disksize_kb)
+		rzs->disksize = (size_t)disksize_kb << 10;
+	else
+		rzs->disksize = ((size_t)totalram_pages << PAGE_SHIFT) / 100 *
+				DEFAULT_DISKSIZE_PERC_RAM;
+	rzs->disksize &= PAGE_MASK;
+	num_pages = rzs->disksize >> PAGE_SHIFT;
+
+	rzs->table = vmalloc(num_pages * sizeof(*rzs->table));
+	if (!rzs->table)
+		goto fail;
+	memset(rzs->table, 0, num_pages * sizeof(*rzs->table));
+
+	rzs->compress_workmem = kmalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+	/* lzo1x_worst_compress(PAGE_SIZE) is a bit over one page */
+	rzs->compress_buffer = (void *)__get_free_pages(GFP_KERNEL, 1);
+	if (!rzs->compress_workmem || !rzs->compress_buffer)
+		goto fail;
+
+	rzs->queue = blk_alloc_queue(GFP_KERNEL);
+	if (!rzs->queue)
+		goto fail;
+	blk_queue_make_request(rzs->queue, ramzswap_make_request);
+	rzs->queue->queuedata = rzs;
+	blk_queue_logical_block_size(rzs->queue, PAGE_SIZE);
+	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, rzs->queue);
+
+	rzs->disk = alloc_disk(1);
+	if (!rzs->disk)
+		goto fail;
+	rzs->disk->major = ramzswap_major;
+	rzs->disk->first_minor = device_id;
+	rzs->disk->fops = &ramzswap_devops;
+	rzs->disk->queue = rzs->queue;
+	rzs->disk->private_data = rzs;
+	snprintf(rzs->disk->disk_name, 16, "ramzswap%d", device_id);
+	set_capacity(rzs->disk, rzs->disksize >> SECTOR_SHIFT);
+	add_disk(rzs->disk);
+
+	if (sysfs_create_group(&disk_to_dev(rzs->disk)->kobj,
+			       &ramzswap_attr_group))
+		pr_warning("Error creating sysfs group for %s\n",
+			   rzs->disk->disk_name);
+
+	pr_info("%s: %zu kB\n", rzs->disk->disk_name, rzs->disksize >> 10);
+	return 0;
+
+fail:
+	pr_err("Error allocating device %d\n", device_id);
+	return -ENOMEM;
+}
+
+static int __init ramzswap_init(void)
+{
+	int i, ret;
+
+	if (!num_devices) {
+		pr_warning("num_devices must be at least 1\n");
+		return -EINVAL;
+	}
+
+	ramzswap_major = register_blkdev(0, "ramzswap");
+	if (ramzswap_major <= 0) {
+		pr_warning("Unable to get major number\n");
+		return -EBUSY;
+	}
+
+	devices = kzalloc(num_devices * sizeof(*devices), GFP_KERNEL);
+	if (!devices) {
+		ret = -ENOMEM;
+		goto out_unregister;
+	}
+
+	for (i = 0; i < num_devices; i++) {
+		ret = create_device(&devices[i], i);
+		if (ret)
+			goto out_destroy;
+	}
+
+	return 0;
+
+out_destroy:
+	/* the device that failed is partly set up too */
+	while (i >= 0)
+		destroy_device(&devices[i--]);
+	kfree(devices);
+out_unregister:
+	unregister_blkdev(ramzswap_major, "ramzswap");
+	return ret;
+}
+
+static void __exit ramzswap_exit(void)
+{
+	int i;
+
+	for (i = 0; i < num_devices; i++)
+		destroy_device(&devices[i]);
+
+	kfree(devices);
+	unregister_blkdev(ramzswap_major, "ramzswap");
+}
+
+module_init(ramzswap_init);
+module_exit(ramzswap_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Compressed RAM based swap device");
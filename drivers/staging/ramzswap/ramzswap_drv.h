@@ -0,0 +1,84 @@
+/*
+ * Compressed RAM based swap device
+ *
+ * Released under the terms of the GNU General Public License Version 2.0
+ */
+
+#ifndef _RAMZSWAP_DRV_H_
+#define _RAMZSWAP_DRV_H_
+
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+
+/* Default disk size when disksize_kb isn't given: 25% of RAM */
+#define DEFAULT_DISKSIZE_PERC_RAM	25
+
+/* Pages compressing to more than this are stored uncompressed */
+#define MAX_CPAGE_SIZE		(PAGE_SIZE / 4 * 3)
+
+#define SECTOR_SHIFT		9
+#define SECTORS_PER_PAGE_SHIFT	(PAGE_SHIFT - SECTOR_SHIFT)
+#define SECTORS_PER_PAGE	(1 << SECTORS_PER_PAGE_SHIFT)
+
+/*
+ * Pool objects are rounded up to RZS_ALIGN and packed into pages of
+ * their size class, one class per RZS_ALIGN step up to MAX_CPAGE_SIZE.
+ */
+#define RZS_ALIGN_SHIFT		5
+#define RZS_ALIGN		(1 << RZS_ALIGN_SHIFT)
+#define RZS_NR_CLASSES		(MAX_CPAGE_SIZE >> RZS_ALIGN_SHIFT)
+
+/* table.flags */
+#define RZS_ZERO		0x01	/* page was all zero, nothing stored */
+#define RZS_UNCOMPRESSED	0x02	/* whole page of its own */
+
+/* One entry per swap slot */
+struct table {
+	struct page *page;
+	u16 offset;
+	u16 size;
+	u8 flags;
+} __attribute__((aligned(4)));
+
+struct rzs_pool_class {
+	struct list_head partial;	/* pages with free slots */
+	unsigned int size;
+};
+
+struct rzs_pool {
+	struct rzs_pool_class class[RZS_NR_CLASSES];
+	unsigned long nr_pages;
+};
+
+struct rzs_stats {
+	u64 num_reads;
+	u64 num_writes;
+	u64 failed_writes;
+	u64 notify_free;
+	u64 compr_size;		/* bytes in pool objects */
+	unsigned long pages_zero;
+	unsigned long pages_stored;	/* compressed into the pool */
+	unsigned long pages_expand;	/* stored uncompressed */
+};
+
+struct ramzswap {
+	spinlock_t lock;		/* table, pool and stats */
+	struct mutex compress_lock;	/* compress_buffer and workmem */
+	void *compress_workmem;
+	void *compress_buffer;
+	struct table *table;
+	struct rzs_pool pool;
+	struct request_queue *queue;
+	struct gendisk *disk;
+	size_t disksize;		/* bytes */
+	struct rzs_stats stats;
+};
+
+/* rzs_pool.c, called with ramzswap.lock held */
+extern void rzs_pool_init(struct rzs_pool *pool);
+extern int rzs_pool_alloc(struct rzs_pool *pool, unsigned int size,
+			  struct page **spare, struct page **page, u16 *offset);
+extern void rzs_pool_free(struct rzs_pool *pool, struct page *page,
+			  u16 offset);
+
+#endif
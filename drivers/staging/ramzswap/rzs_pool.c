@@ -0,0 +1,128 @@
+/*
+ * Size class allocator for ramzswap
+ *
+ * Compressed pages are rounded up to RZS_ALIGN and packed into whole
+ * pages holding objects of a single size, so internal waste is below
+ * RZS_ALIGN per object and a page goes back to the system as soon as
+ * its last object is freed.  Free slots of a page are chained through
+ * their first two bytes.  The page's own fields hold the metadata:
+ * ->private is the first free slot and the number of slots in use,
+ * ->index the size class, ->lru links it on the class partial list.
+ *
+ * Released under the terms of the GNU General Public License Version 2.0
+ */
+
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/list.h>
+
+#include "ramzswap_drv.h"
+
+#define RZS_POOL_END		0xffff
+
+static inline unsigned int class_index(unsigned int size)
+{
+	return (size - 1) >> RZS_ALIGN_SHIFT;
+}
+
+static inline u16 page_first_free(struct page *page)
+{
+	return page_private(page) & 0xffff;
+}
+
+static inline unsigned int page_inuse(struct page *page)
+{
+	return page_private(page) >> 16;
+}
+
+static inline void set_page_slots(struct page *page, u16 first_free,
+				  unsigned int inuse)
+{
+	set_page_private(page, (inuse << 16) | first_free);
+}
+
+static inline u16 *slot_next(struct page *page, u16 offset)
+{
+	return (u16 *)(page_address(page) + offset);
+}
+
+void rzs_pool_init(struct rzs_pool *pool)
+{
+	int i;
+
+	for (i = 0; i < RZS_NR_CLASSES; i++) {
+		INIT_LIST_HEAD(&pool->class[i].partial);
+		pool->class[i].size = (i + 1) << RZS_ALIGN_SHIFT;
+	}
+	pool->nr_pages = 0;
+}
+
+static void rzs_pool_add_page(struct rzs_pool *pool, unsigned int idx,
+			      struct page *page)
+{
+	struct rzs_pool_class *c = &pool->class[idx];
+	unsigned int off;
+
+	for (off = 0; off + c->size <= PAGE_SIZE; off += c->size)
+		*slot_next(page, off) = (off + 2 * c->size <= PAGE_SIZE) ?
+					off + c->size : RZS_POOL_END;
+
+	set_page_slots(page, 0, 0);
+	page->index = idx;
+	list_add(&page->lru, &c->partial);
+	pool->nr_pages++;
+}
+
+/*
+ * Returns -ENOMEM if the class has no free slot and no *spare page was
+ * given; the caller allocates one outside the lock and tries again.  A
+ * spare page that gets used is taken over and *spare cleared.
+ */
+int rzs_pool_alloc(struct rzs_pool *pool, unsigned int size,
+		   struct page **spare, struct page **page, u16 *offset)
+{
+	unsigned int idx = class_index(size);
+	struct rzs_pool_class *c = &pool->class[idx];
+	struct page *p;
+	u16 off, next;
+
+	if (list_empty(&c->partial)) {
+		if (!*spare)
+			return -ENOMEM;
+		rzs_pool_add_page(pool, idx, *spare);
+		*spare = NULL;
+	}
+
+	p = list_first_entry(&c->partial, struct page, lru);
+	off = page_first_free(p);
+	next = *slot_next(p, off);
+	set_page_slots(p, next, page_inuse(p) + 1);
+	if (next == RZS_POOL_END)
+		list_del_init(&p->lru);
+
+	*page = p;
+	*offset = off;
+	return 0;
+}
+
+void rzs_pool_free(struct rzs_pool *pool, struct page *page, u16 offset)
+{
+	struct rzs_pool_class *c = &pool->class[page->index];
+	u16 first_free = page_first_free(page);
+	unsigned int inuse = page_inuse(page) - 1;
+
+	if (!inuse) {
+		/* a full page isn't on the partial list */
+		if (first_free != RZS_POOL_END)
+			list_del(&page->lru);
+		set_page_private(page, 0);
+		__free_page(page);
+		pool->nr_pages--;
+		return;
+	}
+
+	*slot_next(page, offset) = first_free;
+	set_page_slots(page, offset, inuse);
+	if (first_free == RZS_POOL_END)
+		list_add(&page->lru, &c->partial);
+}
@@ -334,6 +334,10 @@ int __init musb_platform_init(struct musb *musb)
 		return -ENODEV;
 	}
 
+	/*
+	 * The HSDMA has no line of its own, its INTR register is read
+	 * and dispatched from generic_interrupt() on IRQ_OTG.
+	 */
 	musb->b_dma_share_usb_irq = 1;
 	musb->board_set_vbus = jz_musb_set_vbus;
 
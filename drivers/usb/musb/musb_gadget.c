@@ -665,6 +665,7 @@ static void rxstate(struct musb *musb, struct musb_request *req)
 				struct dma_controller	*c;
 				struct dma_channel	*channel;
 				int			use_dma = 0;
+				int			use_mode_1;
 
 				c = musb->dma_controller;
 				channel = musb_ep->dma;
@@ -686,41 +687,49 @@ static void rxstate(struct musb *musb, struct musb_request *req)
 	 * to get endpoint interrupt on every DMA req, but that didn't seem
 	 * to work reliably.
 	 *
-	 * REVISIT an updated g_file_storage can set req->short_not_ok, which
-	 * then becomes usable as a runtime "use mode 1" hint...
+	 * g_file_storage sets req->short_not_ok on its bulk OUT buffers, so
+	 * those (and only those) go in mode 1: one DMA for the whole request
+	 * with AUTOCLEAR acking each packet, instead of an irq per packet.
 	 */
+				use_mode_1 = request->short_not_ok
+					&& musb_ep->type == USB_ENDPOINT_XFER_BULK
+					&& len == musb_ep->packet_sz
+					&& (request->length - request->actual)
+						> musb_ep->packet_sz;
 
-				csr |= MUSB_RXCSR_DMAENAB;
-#ifdef USE_MODE1
-				csr |= MUSB_RXCSR_AUTOCLEAR;
-				/* csr |= MUSB_RXCSR_DMAMODE; */
-
-				/* this special sequence (enabling and then
-				 * disabling MUSB_RXCSR_DMAMODE) is required
-				 * to get DMAReq to activate
-				 */
-				musb_writew(epio, MUSB_RXCSR,
-					csr | MUSB_RXCSR_DMAMODE);
-#else
-				if (!musb_ep->hb_mult &&
-					musb_ep->hw_ep->rx_double_buffered)
+				if (use_mode_1) {
 					csr |= MUSB_RXCSR_AUTOCLEAR;
-#endif
-				musb_writew(epio, MUSB_RXCSR, csr);
+					musb_writew(epio, MUSB_RXCSR, csr);
+					csr |= MUSB_RXCSR_DMAENAB;
+					musb_writew(epio, MUSB_RXCSR, csr);
 
-				if (request->actual < request->length) {
+					/* this special sequence (enabling and then
+					 * disabling MUSB_RXCSR_DMAMODE) is required
+					 * to get DMAReq to activate
+					 */
+					musb_writew(epio, MUSB_RXCSR,
+						csr | MUSB_RXCSR_DMAMODE);
+					musb_writew(epio, MUSB_RXCSR, csr);
+				} else {
+					csr |= MUSB_RXCSR_DMAENAB;
+					if (!musb_ep->hb_mult &&
+						musb_ep->hw_ep->rx_double_buffered)
+						csr |= MUSB_RXCSR_AUTOCLEAR;
+					musb_writew(epio, MUSB_RXCSR, csr);
+				}
+
+				/* a PIO fallback may already have unmapped it */
+				if (request->dma != DMA_ADDR_INVALID) {
 					int transfer_size = 0;
-#ifdef USE_MODE1
-					transfer_size = min(request->length - request->actual,
-							channel->max_len);
-#else
-					transfer_size = min(request->length - request->actual,
-							(unsigned)len);
-#endif
-					if (transfer_size <= musb_ep->packet_sz)
-						musb_ep->dma->desired_mode = 0;
+
+					if (use_mode_1)
+						transfer_size = min(request->length - request->actual,
+								channel->max_len);
 					else
-						musb_ep->dma->desired_mode = 1;
+						transfer_size = min(request->length - request->actual,
+								(unsigned)len);
+
+					musb_ep->dma->desired_mode = use_mode_1;
 
 					use_dma = c->channel_program(
 							channel,
@@ -881,8 +890,11 @@ void musb_g_rx(struct musb *musb, u8 epnum)
 
 		/* incomplete, and not short? wait for next IN packet */
 		if ((request->actual < request->length)
-				&& (musb_ep->dma->actual_len
-					== musb_ep->packet_sz)) {
+				&& ((musb_ep->dma->actual_len
+					== musb_ep->packet_sz)
+				    || (dma->desired_mode == 1
+					&& !(dma->actual_len
+					     & (musb_ep->packet_sz - 1))))) {
 			/* In double buffer case, continue to unload fifo if
  			 * there is Rx packet in FIFO.
  			 **/
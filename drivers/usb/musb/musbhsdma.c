@@ -181,6 +181,11 @@ static int dma_channel_program(struct dma_channel *channel,
 	 */
 	if ((musb->hwvers >= MUSB_HWVERS_1800) && (dma_addr % 4))
 		return false;
+#ifdef CONFIG_JZSOC
+	/* same on the JZ cores, whatever RTL version they report */
+	if (dma_addr % 4)
+		return false;
+#endif
 
 	channel->actual_len = 0;
 	musb_channel->start_addr = dma_addr;
@@ -455,7 +460,8 @@ static u8 dma_controller_fetch_intr(struct dma_controller *c)
 
 irqreturn_t musb_call_dma_controller_irq(int irq, struct musb *musb)
 {
-	if (!musb->b_dma_share_usb_irq)
+	/* no controller with use_dma=0 or if dma_controller_create() failed */
+	if (!musb->b_dma_share_usb_irq || !musb->dma_controller)
 		return IRQ_NONE;
 
 	if (dma_controller_fetch_intr(musb->dma_controller))
@@ -32,6 +32,7 @@
 #include <linux/device.h>
 #include <linux/efi.h>
 #include <linux/fb.h>
+#include <linux/poll.h>
 
 #include <asm/fb.h>
 
@@ -1380,6 +1381,19 @@ fb_mmap(struct file *file, struct vm_area_struct * vma)
 	return 0;
 }
 
+static unsigned int
+fb_poll(struct file *file, poll_table *wait)
+{
+	int fbidx = iminor(file->f_path.dentry->d_inode);
+	struct fb_info *info = registered_fb[fbidx];
+
+	if (!info)
+		return POLLERR;
+	if (!info->fbops->fb_poll)
+		return DEFAULT_POLLMASK;
+	return info->fbops->fb_poll(info, file, wait);
+}
+
 static int
 fb_open(struct inode *inode, struct file *file)
 __acquires(&info->lock)
@@ -1441,6 +1455,7 @@ static const struct file_operations fb_fops = {
 	.compat_ioctl = fb_compat_ioctl,
 #endif
 	.mmap =		fb_mmap,
+	.poll =		fb_poll,
 	.open =		fb_open,
 	.release =	fb_release,
 #ifdef HAVE_ARCH_FB_UNMAPPED_AREA
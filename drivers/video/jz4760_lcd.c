@@ -37,6 +37,10 @@
 #include <linux/dma-mapping.h>
 #include <linux/platform_device.h>
 #include <linux/pm.h>
+#include <linux/poll.h>
+#include <linux/time.h>
+#include <linux/ktime.h>
+#include <linux/cpufreq.h>
 
 #include <asm/irq.h>
 #include <asm/pgtable.h>
@@ -783,6 +787,10 @@ struct lcd_cfb_info
 	int b_lcd_display;
 	int b_lcd_pwm;
 	int backlight_level;
+
+	/* cache maintenance of user mappings, see jzfb_need_auto_flush() */
+	atomic_t cached_maps;
+	int explicit_flush;
 };
 
 static struct lcd_cfb_info *jz4760fb_info;
@@ -801,6 +809,39 @@ spinlock_t lock;
 wait_queue_head_t wait_vsync;
 unsigned int delay_flush;
 
+/*
+ * cfb->cached_maps counts the live cacheable user mappings of a frame
+ * buffer, and cfb->explicit_flush tells whether their owners have taken
+ * over cache maintenance through FBIO_FLUSH_RECTS.  The vsync handler
+ * only writes back the visible frame while a cached mapping exists whose
+ * owner has not issued an explicit flush yet.
+ */
+static inline int jzfb_need_auto_flush(struct lcd_cfb_info *cfb)
+{
+	return atomic_read(&cfb->cached_maps) && !cfb->explicit_flush;
+}
+
+/*
+ * Pending flips (yoffsets in lines) and completed flip events, both
+ * protected by lock.  flip_ticket numbers the queued flips and
+ * flip_done the latched ones, so a waiter can tell when its flip is on.
+ */
+static unsigned int flip_queue[JZFB_FLIP_QUEUE_LEN];
+static unsigned int flip_head, flip_count;
+static unsigned int flip_ticket, flip_done;
+static struct jzfb_flip_event flip_events[JZFB_FLIP_EVENT_LEN];
+static unsigned int event_head, event_count;
+
+/* set_par is reconfiguring the IPU, vsync must not touch it, under lock */
+static int ipu_reconfig;
+
+/*
+ * Frame pacing reported to the cpufreq 'deadline' governor, protected
+ * by lock: when the last vsync came and when a flip was last latched.
+ */
+static ktime_t last_vsync, last_latch, last_queue;
+static unsigned int vsync_period_us;
+
 #define MAX_XRES 640
 #define MAX_YRES 480
 
@@ -822,13 +863,12 @@ int get_lcd_hight(void)
 EXPORT_SYMBOL(get_lcd_width);
 EXPORT_SYMBOL(get_lcd_hight);
 
-typedef enum
-{
-	RAW = 0,
-	IPU,
-	SW_HALF_DOUBLE,
-	SW_FULL_DOUBLE
-} lcd_output_mode;
+/* panel lines are doubled, a square source pixel covers two of them */
+#define LCD_LOGICAL_H (LCD_SCREEN_H / 2)
+
+static struct jzfb_scaler scaler = {
+	.policy = JZFB_SCALE_NATIVE,
+};
 
 unsigned int frame_yoffset = 0;
 
@@ -846,6 +886,10 @@ static void jz4760fb_set_mode(struct jz4760lcd_info *lcd_info);
 static void jz4760fb_deep_set_mode(struct jz4760lcd_info *lcd_info);
 
 static int jz4760fb_set_backlight_level(int n);
+static int jzfb_queue_flip(struct lcd_cfb_info *cfb, unsigned long yoffset,
+			   unsigned int *ticket);
+static int jz4760fb_set_par(struct fb_info *info);
+static int jzfb_apply_par(struct fb_info *info, int clear);
 
 static int screen_on(void);
 static int screen_off(void);
@@ -1058,6 +1102,59 @@ static void jz4760lcd_info_switch_to_TVE(int mode)
 	}
 }
 
+/*
+ * Write back the dirty rectangles of a cached user mapping, so that the
+ * next scanout of that frame sees them without a full-frame flush.
+ */
+static int jz4760fb_flush_rects(struct lcd_cfb_info *cfb, struct jzfb_flush_rects *fr)
+{
+	struct fb_var_screeninfo *var = &cfb->fb.var;
+	unsigned int line_length = cfb->fb.fix.line_length;
+	unsigned int bytes_pp = (var->bits_per_pixel + 7) >> 3;
+	unsigned int i, y;
+
+	if (fr->count > JZFB_MAX_FLUSH_RECTS)
+		return -EINVAL;
+	if (var->yres > var->yres_virtual ||
+	    fr->yoffset > var->yres_virtual - var->yres)
+		return -EINVAL;
+
+	for (i = 0; i < fr->count; i++) {
+		struct jzfb_rect *r = &fr->rects[i];
+		unsigned long addr;
+
+		if (r->x + r->w < r->x || r->y + r->h < r->y)
+			return -EINVAL;
+		if (r->x >= var->xres || r->y >= var->yres)
+			continue;
+		if (r->w > var->xres - r->x)
+			r->w = var->xres - r->x;
+		if (r->h > var->yres - r->y)
+			r->h = var->yres - r->y;
+		if (!r->w || !r->h)
+			continue;
+
+		if ((fr->yoffset + r->y + r->h) * line_length > cfb->fb.fix.smem_len)
+			return -EINVAL;
+
+		addr = (unsigned long)lcd_frame0 +
+			(fr->yoffset + r->y) * line_length + r->x * bytes_pp;
+
+		if (r->w * bytes_pp == line_length) {
+			/* full lines are contiguous, flush them in one go */
+			dma_cache_wback(addr, r->h * line_length);
+			continue;
+		}
+
+		for (y = 0; y < r->h; y++, addr += line_length)
+			dma_cache_wback(addr, r->w * bytes_pp);
+	}
+
+	cfb->explicit_flush = 1;
+
+	return 0;
+}
+
 static int jz4760fb_ioctl(struct fb_info *info, unsigned int cmd, unsigned long arg)
 {
 	int ret = 0;
@@ -1088,6 +1185,70 @@ static int jz4760fb_ioctl(struct fb_info *info, unsigned int cmd, unsigned long
 
 		break;
 
+	case FBIO_FLUSH_RECTS:
+	{
+		struct jzfb_flush_rects fr;
+
+		if (copy_from_user(&fr, argp, sizeof(fr)))
+			return -EFAULT;
+
+		ret = jz4760fb_flush_rects((struct lcd_cfb_info *)info, &fr);
+
+		break;
+	}
+
+	case FBIO_GET_SCALER:
+		if (copy_to_user(argp, &scaler, sizeof(scaler)))
+			return -EFAULT;
+
+		break;
+
+	case FBIO_SET_SCALER:
+	{
+		struct jzfb_scaler sc;
+
+		if (copy_from_user(&sc, argp, sizeof(sc)))
+			return -EFAULT;
+		if (sc.policy >= JZFB_SCALE_NR_POLICIES)
+			return -EINVAL;
+
+		scaler.policy = sc.policy;
+		ret = jzfb_apply_par(info, 0);
+
+		break;
+	}
+
+	case FBIO_QUEUE_FLIP:
+	{
+		unsigned int ticket;
+
+		spin_lock_irq(&lock);
+		ret = jzfb_queue_flip((struct lcd_cfb_info *)info, arg, &ticket);
+		spin_unlock_irq(&lock);
+
+		break;
+	}
+
+	case FBIO_GET_FLIP_EVENT:
+	{
+		struct jzfb_flip_event ev;
+
+		spin_lock_irq(&lock);
+		if (!event_count) {
+			spin_unlock_irq(&lock);
+			return -EAGAIN;
+		}
+		ev = flip_events[event_head];
+		event_head = (event_head + 1) % JZFB_FLIP_EVENT_LEN;
+		event_count--;
+		spin_unlock_irq(&lock);
+
+		if (copy_to_user(argp, &ev, sizeof(ev)))
+			return -EFAULT;
+
+		break;
+	}
+
 	case FBIO_GET_MODE:
 		D("fbio get mode\n");
 
@@ -1220,15 +1381,45 @@ static int jz4760fb_ioctl(struct fb_info *info, unsigned int cmd, unsigned long
 	return ret;
 }
 
-/* Use mmap /dev/fb can only get a non-cacheable Virtual Address. */
+static void jz4760fb_vma_open(struct vm_area_struct *vma)
+{
+	struct lcd_cfb_info *cfb = vma->vm_private_data;
+
+	atomic_inc(&cfb->cached_maps);
+}
+
+static void jz4760fb_vma_close(struct vm_area_struct *vma)
+{
+	struct lcd_cfb_info *cfb = vma->vm_private_data;
+
+	/* last cached mapping gone, the next one starts on auto flush again */
+	if (atomic_dec_and_test(&cfb->cached_maps))
+		cfb->explicit_flush = 0;
+}
+
+static struct vm_operations_struct jz4760fb_cached_vm_ops = {
+	.open = jz4760fb_vma_open,
+	.close = jz4760fb_vma_close,
+};
+
+/*
+ * The cache attribute of the user mapping is taken from the top bits of
+ * the mmap offset (see JZFB_MMAP_OFFSET()); offset 0 is uncached.
+ */
 static int jz4760fb_mmap(struct fb_info *info, struct vm_area_struct *vma)
 {
 	struct lcd_cfb_info *cfb = (struct lcd_cfb_info *)info;
 	unsigned long start;
 	unsigned long off;
+	unsigned int mode;
 	u32 len;
 	D("%s, %s, %d\n", __FILE__, __FUNCTION__, __LINE__);
 	off = vma->vm_pgoff << PAGE_SHIFT;
+	mode = off >> JZFB_MMAP_MODE_SHIFT;
+	off &= (1UL << JZFB_MMAP_MODE_SHIFT) - 1;
+
+	if (mode >= JZFB_CACHE_NR_MODES)
+		return -EINVAL;
 	//fb->fb_get_fix(&fix, PROC_CONSOLE(info), info);
 
 	/* frame buffer memory */
@@ -1242,13 +1433,23 @@ static int jz4760fb_mmap(struct fb_info *info, struct vm_area_struct *vma)
 
 	vma->vm_pgoff = off >> PAGE_SHIFT;
 	vma->vm_flags |= VM_IO;
-	vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot); /* Uncacheable */
 
-#if 1
 	pgprot_val(vma->vm_page_prot) &= ~_CACHE_MASK;
-	pgprot_val(vma->vm_page_prot) |= _CACHE_UNCACHED; /* Uncacheable */
-//	pgprot_val(vma->vm_page_prot) |= _CACHE_CACHABLE_NONCOHERENT;	/* Write-Back */
-#endif
+	switch (mode) {
+	case JZFB_CACHE_WRITEBACK:
+		pgprot_val(vma->vm_page_prot) |= _CACHE_CACHABLE_NONCOHERENT;	/* Write-Back */
+		break;
+	case JZFB_CACHE_WRITETHROUGH:
+		pgprot_val(vma->vm_page_prot) |= _CACHE_CACHABLE_NO_WA;	/* Write-Through */
+		break;
+	case JZFB_CACHE_UNCACHED_ACCEL:
+		pgprot_val(vma->vm_page_prot) |= _CACHE_UNCACHED_ACCELERATED;
+		break;
+	case JZFB_CACHE_UNCACHED:
+	default:
+		pgprot_val(vma->vm_page_prot) |= _CACHE_UNCACHED; /* Uncacheable */
+		break;
+	}
 
 	if (io_remap_pfn_range(vma, vma->vm_start, off >> PAGE_SHIFT,
 						   vma->vm_end - vma->vm_start,
@@ -1256,6 +1457,13 @@ static int jz4760fb_mmap(struct fb_info *info, struct vm_area_struct *vma)
 	{
 		return -EAGAIN;
 	}
+
+	/* only write-back lines can hold data the LCD DMA does not see */
+	if (mode == JZFB_CACHE_WRITEBACK) {
+		vma->vm_ops = &jz4760fb_cached_vm_ops;
+		vma->vm_private_data = cfb;
+		jz4760fb_vma_open(vma);
+	}
 	return 0;
 }
 
@@ -1263,81 +1471,278 @@ static int jz4760fb_mmap(struct fb_info *info, struct vm_area_struct *vma)
  * DO NOT MODIFY PAR */
 static int jz4760fb_check_var(struct fb_var_screeninfo *var, struct fb_info *fb)
 {
+	/* the IPU scales onto the panel, it never crops a larger source */
+	if (var->xres > LCD_SCREEN_W || var->yres > LCD_SCREEN_H)
+		return -EINVAL;
+
 	clear_fb = var->bits_per_pixel != fb->var.bits_per_pixel ||
 		var->xres != fb->var.xres || var->yres != fb->var.yres;
 	return 0;
 }
 
-static int jzfb_wait_for_vsync()
+/*
+ * Tell the cpufreq governor how much of the frame period was left when
+ * the client queued its next frame, called with lock held.  The client
+ * started on the frame when the previous flip latched or, if it renders
+ * ahead behind a pending flip, when it queued that flip.  One that
+ * stayed away for several periods was idle rather than late.
+ */
+static void jzfb_report_frame(void)
+{
+	ktime_t now = ktime_get();
+	ktime_t start;
+	s64 busy;
+
+	start = (last_queue.tv64 > last_latch.tv64) ? last_queue : last_latch;
+	last_queue = now;
+
+	if (!vsync_period_us || !last_latch.tv64)
+		return;
+
+	busy = ktime_us_delta(now, start);
+	if (busy > 4 * vsync_period_us)
+		return;
+
+	cpufreq_deadline_frame(vsync_period_us - (int)busy, vsync_period_us);
+}
+
+/*
+ * Queue a flip to yoffset for the next vsync, called with lock held.
+ */
+static int jzfb_queue_flip(struct lcd_cfb_info *cfb, unsigned long yoffset,
+			   unsigned int *ticket)
+{
+	struct fb_var_screeninfo *var = &cfb->fb.var;
+	unsigned int line_length = cfb->fb.fix.line_length;
+
+	/* bound yoffset before it takes part in any arithmetic */
+	if (var->yres > var->yres_virtual ||
+	    yoffset > var->yres_virtual - var->yres)
+		return -EINVAL;
+	if ((yoffset + var->yres) * line_length > cfb->fb.fix.smem_len)
+		return -EINVAL;
+	if (flip_count == JZFB_FLIP_QUEUE_LEN)
+		return -EBUSY;
+
+	jzfb_report_frame();
+
+	delay_flush = 8;
+	if (jzfb_need_auto_flush(cfb))
+		dma_cache_wback_inv((unsigned long)(lcd_frame0 + yoffset * line_length),
+				    line_length * cfb->fb.var.yres);
+
+	flip_queue[(flip_head + flip_count) % JZFB_FLIP_QUEUE_LEN] = yoffset;
+	flip_count++;
+	*ticket = ++flip_ticket;
+
+	return 0;
+}
+
+/*
+ * Latch the oldest queued flip and record its completion event, called
+ * from the vsync interrupt with lock held.
+ */
+static void jzfb_latch_flip(struct lcd_cfb_info *cfb)
+{
+	struct jzfb_flip_event *ev;
+	struct timespec ts;
+	unsigned int yoffset;
+
+	if (!flip_count)
+		return;
+
+	yoffset = flip_queue[flip_head];
+	flip_head = (flip_head + 1) % JZFB_FLIP_QUEUE_LEN;
+	flip_count--;
+	flip_done++;
+	last_latch = last_vsync;
+
+	frame_yoffset = yoffset * cfb->fb.fix.line_length;
+	cfb->fb.var.yoffset = yoffset;
+
+	/* overwrite the oldest event if the client doesn't keep up */
+	if (event_count == JZFB_FLIP_EVENT_LEN) {
+		event_head = (event_head + 1) % JZFB_FLIP_EVENT_LEN;
+		event_count--;
+	}
+	ev = &flip_events[(event_head + event_count) % JZFB_FLIP_EVENT_LEN];
+	event_count++;
+
+	ktime_get_ts(&ts);
+	ev->sequence = vsync_count + 1;
+	ev->yoffset = yoffset;
+	ev->tv_sec = ts.tv_sec;
+	ev->tv_nsec = ts.tv_nsec;
+}
+
+static int jzfb_wait_for_flip(unsigned int ticket)
 {
-	uint32_t count = vsync_count;
 	long t = wait_event_interruptible_timeout(wait_vsync,
-						  count != vsync_count,
+						  (int)(flip_done - ticket) >= 0,
 						  HZ / 10);
 	return t > 0 ? 0 : (t < 0 ? (int)t : -ETIMEDOUT);
 }
 
+static unsigned int jz4760fb_poll(struct fb_info *info, struct file *file,
+				  poll_table *wait)
+{
+	unsigned int mask = 0;
+
+	poll_wait(file, &wait_vsync, wait);
+
+	spin_lock_irq(&lock);
+	if (event_count)
+		mask |= POLLIN | POLLRDNORM;
+	if (flip_count < JZFB_FLIP_QUEUE_LEN)
+		mask |= POLLOUT | POLLWRNORM;
+	spin_unlock_irq(&lock);
+
+	return mask;
+}
+
 
 /*
- * set the video mode according to info->var
+ * Work out where the IPU puts a var->xres x var->yres source on the panel
+ * for the current scaler policy.
  */
-static int jz4760fb_set_par(struct fb_info *info)
+static void jzfb_scaler_geometry(struct fb_var_screeninfo *var, struct jzfb_scaler *sc)
+{
+	unsigned int src_w = var->xres;
+	unsigned int src_h = var->yres;
+	unsigned int policy = sc->policy;
+	unsigned int w, h, k;
+
+	if (!src_w || !src_h)
+		policy = JZFB_SCALE_NATIVE;
+
+	switch (policy) {
+	case JZFB_SCALE_INTEGER:
+		k = min(LCD_SCREEN_W / src_w, LCD_LOGICAL_H / src_h);
+		if (k) {
+			w = src_w * k;
+			h = src_h * k * 2;
+			break;
+		}
+		/* larger than the screen, scale down keeping the aspect */
+	case JZFB_SCALE_ASPECT:
+		if (src_w * LCD_LOGICAL_H > src_h * LCD_SCREEN_W) {
+			w = LCD_SCREEN_W;
+			h = 2 * src_h * LCD_SCREEN_W / src_w;
+		} else {
+			w = src_w * LCD_LOGICAL_H / src_h;
+			h = LCD_SCREEN_H;
+		}
+		break;
+	case JZFB_SCALE_FULLSCREEN:
+		w = LCD_SCREEN_W;
+		h = LCD_SCREEN_H;
+		break;
+	case JZFB_SCALE_NATIVE:
+	default:
+		if (src_h > LCD_LOGICAL_H) {
+			sc->out_x = 0;
+			sc->out_y = 0;
+			sc->out_w = src_w;
+			sc->out_h = src_h;
+		} else {
+			sc->out_x = (LCD_SCREEN_W - src_w) / 2;
+			sc->out_y = LCD_LOGICAL_H - src_h;
+			sc->out_w = src_w;
+			sc->out_h = src_h * 2;
+		}
+		return;
+	}
+
+	/* the IPU wants even output sizes */
+	w = min(w & ~1, (unsigned int)LCD_SCREEN_W);
+	h = min(h & ~1, (unsigned int)LCD_SCREEN_H);
+
+	sc->out_x = (LCD_SCREEN_W - w) / 2;
+	sc->out_y = (LCD_SCREEN_H - h) / 2;
+	sc->out_w = w;
+	sc->out_h = h;
+}
+
+/*
+ * Drop the queued flips, their geometry is gone with the mode.  Their
+ * waiters see them as done.  Called with lock held.
+ */
+static void jzfb_flush_flips(void)
+{
+	flip_done += flip_count;
+	flip_count = 0;
+}
+
+/*
+ * Apply info->var, clearing the frames first if clear is set.
+ */
+static int jzfb_apply_par(struct fb_info *info, int clear)
 {	
 	struct fb_var_screeninfo *var = &info->var;
 	struct fb_fix_screeninfo *fix = &info->fix;
-	
-	uint32_t xoffset = (320 - (var->xres))/2;
-	uint32_t yoffset = var->yres > 240 ? 480 - (var->yres) : 240 - (var->yres);
-	uint32_t result = yoffset << 16 | xoffset;
 
 	spin_lock_irq(&lock);
 	//struct lcd_cfb_info *jzfb = info->par;
+	ipu_reconfig = 1;
+	jzfb_flush_flips();
+
 	fix->line_length = var->xres_virtual * (var->bits_per_pixel >> 3);
-		
+	if (var->yres > var->yres_virtual ||
+	    var->yoffset > var->yres_virtual - var->yres ||
+	    (var->yoffset + var->yres) * fix->line_length > fix->smem_len)
+		var->yoffset = 0;
+	frame_yoffset = var->yoffset * fix->line_length;
+
+	jzfb_scaler_geometry(var, &scaler);
+
+	REG_LCD_XYP1 = scaler.out_y << 16 | scaler.out_x;
+	REG_LCD_OSDCTRL |= LCD_OSDCTRL_CHANGES;
+	while (REG_LCD_OSDS & LCD_OSDS_READY != 1);
+
+	REG_LCD_SIZE1 = scaler.out_h << 16 | scaler.out_w;
+	REG_LCD_OSDCTRL |= LCD_OSDCTRL_CHANGES;
+	while (REG_LCD_OSDS & LCD_OSDS_READY != 1);
+
+	spin_unlock_irq(&lock);
+	wake_up_interruptible_all(&wait_vsync);
+
+	/*
+	 * The IPU reads the source straight out of the framebuffer.  Setting
+	 * it up may sleep, so it runs outside the lock while ipu_reconfig
+	 * keeps the vsync handler away from it.
+	 */
 	ipu_driver_close_tv();
-	// printk("TONY RESULT = %d %d %d\n",xoffset,yoffset,result);
-	if (var->yres > 240)
-	{
-		REG_LCD_XYP1 = 0;	
-		REG_LCD_OSDCTRL |= LCD_OSDCTRL_CHANGES;
-		while (REG_LCD_OSDS & LCD_OSDS_READY != 1);
-		
-		REG_LCD_SIZE1 = var->yres << 16 | var->xres;
-		REG_LCD_OSDCTRL |= LCD_OSDCTRL_CHANGES;
-		while (REG_LCD_OSDS & LCD_OSDS_READY != 1);
-		
-		ipu_driver_open_tv(var->xres,var->yres,var->xres,var->yres);		
-	}
-	else
-	{
-		REG_LCD_XYP1 = result;	
-		REG_LCD_OSDCTRL |= LCD_OSDCTRL_CHANGES;
-		while (REG_LCD_OSDS & LCD_OSDS_READY != 1);
+	ipu_driver_open_tv(var->xres, var->yres, scaler.out_w, scaler.out_h);
 
-		REG_LCD_SIZE1 = var->yres*2 << 16 | var->xres;
-		REG_LCD_OSDCTRL |= LCD_OSDCTRL_CHANGES;
-		while (REG_LCD_OSDS & LCD_OSDS_READY != 1);
-		
-		ipu_driver_open_tv(var->xres,var->yres,var->xres,var->yres * 2);
-	}
+	spin_lock_irq(&lock);
+	ipu_reconfig = 0;
+	spin_unlock_irq(&lock);
 	
-	if (clear_fb) 
+	if (clear) 
 	{
 		void *page_virt = lcd_frame0;
 		unsigned int size = fix->line_length * var->yres * 3;
 
-		spin_unlock_irq(&lock);
-
 		for (; page_virt < lcd_frame0 + size; page_virt += PAGE_SIZE)
 			clear_page(page_virt);
 		dma_cache_wback_inv((unsigned long) lcd_frame0, size);
-
-		spin_lock_irq(&lock);
 	}
 	
 	return 0;
 }
 
+/*
+ * set the video mode according to info->var, check_var decided whether
+ * the frames need clearing
+ */
+static int jz4760fb_set_par(struct fb_info *info)
+{
+	int clear = clear_fb;
+
+	clear_fb = false;
+	return jzfb_apply_par(info, clear);
+}
+
 /*
  * (Un)Blank the display.
  * Fix me: should we use VESA value?
@@ -1385,22 +1790,36 @@ static int jz4760fb_pan_display(struct fb_var_screeninfo *var, struct fb_info *i
 	if (vsync_on)
 #endif
 	{
-		spin_lock_irq(&lock);
-		frame_yoffset = var->yoffset * cfb->fb.fix.line_length;
-		delay_flush = 8;
-		dma_cache_wback_inv((unsigned long)(lcd_frame0 + frame_yoffset),
-					cfb->fb.fix.line_length * cfb->fb.var.yres);
-		spin_unlock_irq(&lock);
-		jzfb_wait_for_vsync();
+		unsigned int ticket;
+		long t;
+		int ret;
+
+		/* FBIOPAN_DISPLAY has always blocked, wait for a free slot */
+		for (;;) {
+			spin_lock_irq(&lock);
+			ret = jzfb_queue_flip(cfb, var->yoffset, &ticket);
+			spin_unlock_irq(&lock);
+			if (ret != -EBUSY)
+				break;
+			t = wait_event_interruptible_timeout(wait_vsync,
+					flip_count < JZFB_FLIP_QUEUE_LEN, HZ / 10);
+			if (t <= 0)
+				return t < 0 ? (int)t : -EBUSY;
+		}
+		if (ret)
+			return ret;
+		jzfb_wait_for_flip(ticket);
 	}
 #ifdef VSYNC_OPTION
 	else
 	{
 		frame_yoffset = var->yoffset * cfb->fb.fix.line_length;
 		delay_flush = 8;
-		dma_cache_wback_inv((unsigned long)(lcd_frame0 + frame_yoffset),
+		if (jzfb_need_auto_flush(cfb))
+			dma_cache_wback_inv((unsigned long)(lcd_frame0 + frame_yoffset),
 					cfb->fb.fix.line_length * cfb->fb.var.yres);
-		ipu_update_address();
+		if (!ipu_reconfig)
+			ipu_update_address();
 	}
 #endif
 	return 0;
@@ -1419,6 +1838,7 @@ static struct fb_ops jz4760fb_ops = {
 	.fb_imageblit = cfb_imageblit,
 	.fb_mmap = jz4760fb_mmap,
 	.fb_ioctl = jz4760fb_ioctl,
+	.fb_poll = jz4760fb_poll,
 };
 
 static int jz4760fb_set_var(struct fb_var_screeninfo *var, int con,
@@ -2101,20 +2521,39 @@ static void jz4760fb_deep_set_mode(struct jz4760lcd_info *lcd_info)
 static irqreturn_t jz4760fb_interrupt_handler(int irq, void *dev_id)
 {
 	struct lcd_cfb_info *cfb = dev_id;
+	ktime_t now;
 
 
 	spin_lock(&lock);
 	//SETREG32(IPU_STATUS,0);
 	//writel(0, jzfb->ipu_base + IPU_STATUS);
 
+	/*
+	 * Uncached mappings and clients flushing their dirty rectangles
+	 * don't need the visible frame written back on every vsync.
+	 */
 	if (delay_flush == 0) {
-	dma_cache_wback_inv((unsigned long)(lcd_frame0 + frame_yoffset),
-				cfb->fb.fix.line_length * cfb->fb.var.yres);
+		if (jzfb_need_auto_flush(cfb))
+			dma_cache_wback_inv((unsigned long)(lcd_frame0 + frame_yoffset),
+					cfb->fb.fix.line_length * cfb->fb.var.yres);
 	} else {
 		delay_flush--;
 	}
 
-	ipu_update_address();
+	now = ktime_get();
+	if (last_vsync.tv64) {
+		s64 period = ktime_us_delta(now, last_vsync);
+
+		/* ignore gaps from blanking or a stopped controller */
+		if (period > 5000 && period < 50000)
+			vsync_period_us = period;
+	}
+	last_vsync = now;
+
+	if (!ipu_reconfig) {
+		jzfb_latch_flip(cfb);
+		ipu_update_address();
+	}
 	vsync_count++;
 
 	spin_unlock(&lock);
@@ -96,6 +96,92 @@ struct jz4760lcd_info {
 #define FBIO_MODE_SWITCH	0x46a5 /* switch mode between LCD and TVE */
 #define FBIO_GET_TVE_MODE	0x46a6 /* get tve info */
 #define FBIO_SET_TVE_MODE	0x46a7 /* set tve mode */
+#define FBIO_FLUSH_RECTS	0x46a8 /* write back dirty rectangles */
+#define FBIO_QUEUE_FLIP		0x46a9 /* queue a pan to yoffset, don't wait */
+#define FBIO_GET_FLIP_EVENT	0x46aa /* fetch a flip completion event */
+#define FBIO_GET_SCALER		0x46ab /* get ipu scaler policy */
+#define FBIO_SET_SCALER		0x46ac /* set ipu scaler policy */
+
+/*
+ * mmap() cache attributes.
+ *
+ * The attribute is selected per mapping by encoding it in the top bits of
+ * the mmap offset, e.g. mmap(..., fd, JZFB_MMAP_OFFSET(JZFB_CACHE_WRITEBACK)).
+ * An offset of 0 keeps the historical uncached mapping.
+ *
+ * With a cached mapping the client owns cache maintenance and must issue
+ * FBIO_FLUSH_RECTS for the regions it touched before panning; until the
+ * first FBIO_FLUSH_RECTS the driver falls back to writing back the whole
+ * visible frame on every vsync.
+ */
+#define JZFB_CACHE_UNCACHED		0 /* uncached (default) */
+#define JZFB_CACHE_WRITEBACK		1 /* cacheable, write-back */
+#define JZFB_CACHE_WRITETHROUGH		2 /* cacheable, write-through no write-allocate */
+#define JZFB_CACHE_UNCACHED_ACCEL	3 /* uncached accelerated (write gathering) */
+#define JZFB_CACHE_NR_MODES		4
+
+#define JZFB_MMAP_MODE_SHIFT		28
+#define JZFB_MMAP_OFFSET(mode)		((mode) << JZFB_MMAP_MODE_SHIFT)
+
+struct jzfb_rect {
+	unsigned int x;		/* in pixels */
+	unsigned int y;		/* in lines, relative to yoffset */
+	unsigned int w;
+	unsigned int h;
+};
+
+#define JZFB_MAX_FLUSH_RECTS	16
+
+struct jzfb_flush_rects {
+	unsigned int yoffset;	/* frame the rectangles belong to */
+	unsigned int count;	/* number of valid rects, <= JZFB_MAX_FLUSH_RECTS */
+	struct jzfb_rect rects[JZFB_MAX_FLUSH_RECTS];
+};
+
+/*
+ * Flip queue.
+ *
+ * FBIO_QUEUE_FLIP takes the yoffset (in lines) as argument and returns at
+ * once, or -EBUSY when JZFB_FLIP_QUEUE_LEN flips are already pending.  One
+ * queued flip is latched per vsync; each latched flip produces an event,
+ * fetched with FBIO_GET_FLIP_EVENT (-EAGAIN when none is pending).  poll()
+ * on the fb device reports POLLIN while events are pending and POLLOUT
+ * while the queue has room.  FBIOPAN_DISPLAY goes through the same queue
+ * and waits for its flip to be latched.
+ */
+#define JZFB_FLIP_QUEUE_LEN	3
+#define JZFB_FLIP_EVENT_LEN	8
+
+struct jzfb_flip_event {
+	unsigned int sequence;	/* vsync count the flip was latched at */
+	unsigned int yoffset;	/* in lines */
+	unsigned int tv_sec;	/* CLOCK_MONOTONIC time of the vsync */
+	unsigned int tv_nsec;
+};
+
+/*
+ * IPU scaler.
+ *
+ * The source is the visible area of the framebuffer as set with
+ * FBIOPUT_VSCREENINFO (any xres/yres/bits_per_pixel up to the panel size);
+ * the IPU reads it in place and scales it onto the panel according to the
+ * policy below.  The panel has 2:1 wide pixels, so the non-native policies
+ * treat the source as square pixels on a 320x240 display.
+ */
+#define JZFB_SCALE_NATIVE	0 /* 1:1 above 240 lines, 2x lines below (legacy) */
+#define JZFB_SCALE_INTEGER	1 /* largest integer factor that fits, centered */
+#define JZFB_SCALE_ASPECT	2 /* fit keeping the source aspect ratio */
+#define JZFB_SCALE_FULLSCREEN	3 /* stretch to the whole panel */
+#define JZFB_SCALE_NR_POLICIES	4
+
+struct jzfb_scaler {
+	unsigned int policy;	/* JZFB_SCALE_* */
+	/* read only, output window on the panel from the last mode set */
+	unsigned int out_x;
+	unsigned int out_y;
+	unsigned int out_w;
+	unsigned int out_h;
+};
 
 /*
  * LCD panel specific definition
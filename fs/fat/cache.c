@@ -9,12 +9,22 @@
  */
 
 #include <linux/fs.h>
+#include <linux/slab.h>
 #include <linux/buffer_head.h>
 #include "fat.h"
 
 /* this must be > 0. */
 #define FAT_MAX_CACHE	8
 
+/*
+ * Regular files of at least this many clusters get an extent map, built
+ * on the first lookup past the start. The map is capped so a badly
+ * fragmented file can't pin much memory, the tail beyond it falls back to
+ * the LRU cache above.
+ */
+#define FAT_EXTENT_MIN_CLUSTERS	64
+#define FAT_EXTENT_MAX		4096
+
 struct fat_cache {
 	struct list_head cache_list;
 	int nr_contig;	/* number of contiguous clusters */
@@ -22,6 +32,12 @@ struct fat_cache {
 	int dcluster;	/* cluster number on disk. */
 };
 
+struct fat_extent {
+	int fcluster;	/* first cluster of the run in the file. */
+	int dcluster;	/* first cluster of the run on disk. */
+	int nr_contig;	/* number of contiguous clusters following */
+};
+
 struct fat_cache_id {
 	unsigned int id;
 	int nr_contig;
@@ -187,6 +203,10 @@ static void __fat_cache_inval_inode(struct inode *inode)
 		i->nr_caches--;
 		fat_cache_free(cache);
 	}
+	kfree(i->extents);
+	i->extents = NULL;
+	i->nr_extents = 0;
+	i->extents_failed = 0;
 	/* Update. The copy of caches before this id is discarded. */
 	i->cache_valid_id++;
 	if (i->cache_valid_id == FAT_CACHE_VALID)
@@ -214,6 +234,150 @@ static inline void cache_init(struct fat_cache_id *cid, int fclus, int dclus)
 	cid->nr_contig = 0;
 }
 
+/*
+ * Binary search the extent map for "fclus". Returns 0 and fills in the
+ * mapping if it is covered, -1 if there is no map or "fclus" lies past it.
+ */
+static int fat_extent_lookup(struct inode *inode, int fclus,
+			     int *cached_fclus, int *cached_dclus)
+{
+	struct msdos_inode_info *i = MSDOS_I(inode);
+	struct fat_extent *e;
+	int lo, hi, mid, ret = -1;
+
+	spin_lock(&i->cache_lru_lock);
+	if (i->extents == NULL)
+		goto out;
+
+	/* find the last extent starting at or before "fclus" */
+	lo = 0;
+	hi = i->nr_extents - 1;
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (i->extents[mid].fcluster <= fclus)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	e = &i->extents[lo];
+	if (e->fcluster <= fclus && fclus <= e->fcluster + e->nr_contig) {
+		*cached_fclus = fclus;
+		*cached_dclus = e->dcluster + (fclus - e->fcluster);
+		ret = 0;
+	}
+out:
+	spin_unlock(&i->cache_lru_lock);
+	return ret;
+}
+
+/*
+ * Walk the whole cluster chain once and record it as a sorted array of
+ * contiguous runs, so later random access is a binary search rather
+ * than a FAT walk from the nearest LRU entry. The array is grown as the
+ * walk finds fragments and trimmed to size at the end.
+ */
+static void fat_extent_build(struct inode *inode)
+{
+	struct super_block *sb = inode->i_sb;
+	struct msdos_inode_info *i = MSDOS_I(inode);
+	const int limit = sb->s_maxbytes >> MSDOS_SB(sb)->cluster_bits;
+	struct fat_extent *map, *tmp;
+	struct fat_entry fatent;
+	unsigned int id;
+	int nr, size, fclus, dclus;
+
+	spin_lock(&i->cache_lru_lock);
+	id = i->cache_valid_id;
+	spin_unlock(&i->cache_lru_lock);
+
+	size = 16;
+	map = kmalloc(size * sizeof(*map), GFP_NOFS);
+	if (map == NULL)
+		goto out_failed;
+
+	fclus = 0;
+	dclus = i->i_start;
+	map[0].fcluster = fclus;
+	map[0].dcluster = dclus;
+	map[0].nr_contig = 0;
+	nr = 1;
+
+	fatent_init(&fatent);
+	for (;;) {
+		int next;
+
+		/* a broken chain is reported by fat_get_cluster() */
+		if (fclus > limit)
+			goto failed;
+		next = fat_ent_read(inode, &fatent, dclus);
+		if (next == FAT_ENT_EOF)
+			break;
+		else if (next < 0 || next == FAT_ENT_FREE)
+			goto failed;
+
+		fclus++;
+		if (next == dclus + 1) {
+			map[nr - 1].nr_contig++;
+		} else {
+			if (nr == FAT_EXTENT_MAX)
+				break;
+			if (nr == size) {
+				size = min(size * 2, FAT_EXTENT_MAX);
+				tmp = krealloc(map, size * sizeof(*map),
+					       GFP_NOFS);
+				if (tmp == NULL)
+					goto failed;
+				map = tmp;
+			}
+			map[nr].fcluster = fclus;
+			map[nr].dcluster = next;
+			map[nr].nr_contig = 0;
+			nr++;
+		}
+		dclus = next;
+	}
+	fatent_brelse(&fatent);
+
+	if (nr < size) {
+		tmp = krealloc(map, nr * sizeof(*map), GFP_NOFS);
+		if (tmp != NULL)
+			map = tmp;
+	}
+
+	spin_lock(&i->cache_lru_lock);
+	/* unless fat_free() or another builder got here first */
+	if (i->cache_valid_id == id && i->extents == NULL) {
+		i->extents = map;
+		i->nr_extents = nr;
+		map = NULL;
+	}
+	spin_unlock(&i->cache_lru_lock);
+	kfree(map);
+	return;
+
+failed:
+	fatent_brelse(&fatent);
+	kfree(map);
+out_failed:
+	/* leave it to the LRU until the chain changes */
+	spin_lock(&i->cache_lru_lock);
+	if (i->cache_valid_id == id)
+		i->extents_failed = 1;
+	spin_unlock(&i->cache_lru_lock);
+}
+
+static inline int fat_want_extents(struct inode *inode, int cluster)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(inode->i_sb);
+
+	/* FAT_ENT_EOF comes from the allocation path, the LRU covers it */
+	return S_ISREG(inode->i_mode) && cluster != FAT_ENT_EOF &&
+		MSDOS_I(inode)->extents == NULL &&
+		!MSDOS_I(inode)->extents_failed &&
+		(i_size_read(inode) >> sbi->cluster_bits) >=
+		FAT_EXTENT_MIN_CLUSTERS;
+}
+
 int fat_get_cluster(struct inode *inode, int cluster, int *fclus, int *dclus)
 {
 	struct super_block *sb = inode->i_sb;
@@ -229,6 +393,11 @@ int fat_get_cluster(struct inode *inode, int cluster, int *fclus, int *dclus)
 	if (cluster == 0)
 		return 0;
 
+	if (fat_want_extents(inode, cluster))
+		fat_extent_build(inode);
+	if (fat_extent_lookup(inode, cluster, fclus, dclus) == 0)
+		return 0;
+
 	if (fat_cache_lookup(inode, cluster, &cid, fclus, dclus) < 0) {
 		/*
 		 * dummy, always not contiguous
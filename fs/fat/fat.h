@@ -6,6 +6,7 @@
 #include <linux/nls.h>
 #include <linux/fs.h>
 #include <linux/mutex.h>
+#include <linux/workqueue.h>
 #include <linux/msdos_fs.h>
 
 /*
@@ -70,6 +71,10 @@ struct msdos_sb_info {
 	unsigned int prev_free;      /* previously allocated cluster number */
 	unsigned int free_clusters;  /* -1 if undefined */
 	unsigned int free_clus_valid; /* is free_clusters valid? */
+	unsigned long *free_bitmap;  /* set bit = free cluster, or NULL */
+	int free_bitmap_ready;	     /* free_bitmap fully scanned? */
+	int free_bitmap_abort;	     /* stop the scan, unmounting */
+	struct work_struct free_bitmap_work;
 	struct fat_mount_options options;
 	struct nls_table *nls_disk;  /* Codepage used on disk */
 	struct nls_table *nls_io;    /* Charset used for input and display */
@@ -96,6 +101,10 @@ struct msdos_inode_info {
 	int nr_caches;
 	/* for avoiding the race between fat_free() and fat_get_cluster() */
 	unsigned int cache_valid_id;
+	/* sorted cluster runs of large files, under cache_lru_lock */
+	struct fat_extent *extents;
+	int nr_extents;
+	int extents_failed;	/* don't rebuild until invalidated */
 
 	/* NOTE: mmu_private is 64bits, so must hold ->i_mutex to access */
 	loff_t mmu_private;	/* physically allocated size */
@@ -295,6 +304,10 @@ extern int fat_alloc_clusters(struct inode *inode, int *cluster,
 			      int nr_cluster);
 extern int fat_free_clusters(struct inode *inode, int cluster);
 extern int fat_count_free_clusters(struct super_block *sb);
+extern void fat_free_bitmap_start(struct super_block *sb);
+extern void fat_free_bitmap_stop(struct super_block *sb);
+extern int fat_free_bitmap_init(void);
+extern void fat_free_bitmap_destroy(void);
 
 /* fat/file.c */
 extern int fat_generic_ioctl(struct inode *inode, struct file *filp,
@@ -7,6 +7,8 @@
 #include <linux/fs.h>
 #include <linux/msdos_fs.h>
 #include <linux/blkdev.h>
+#include <linux/vmalloc.h>
+#include <linux/bitmap.h>
 #include "fat.h"
 
 struct fatent_operations {
@@ -452,6 +454,108 @@ static void fat_collect_bhs(struct buffer_head **bhs, int *nr_bhs,
 	}
 }
 
+/*
+ * When prev_free + 1 is taken, look for a free run at least this long so
+ * the file being written can keep growing contiguously.
+ */
+#define FAT_ALLOC_RUN		16
+
+/* Returns the first free run of "want" clusters in [from, to), or "to". */
+static unsigned long fat_bitmap_find_run(unsigned long *map,
+					 unsigned long from, unsigned long to,
+					 int want)
+{
+	unsigned long start, end;
+
+	start = find_next_bit(map, to, from);
+	while (start < to) {
+		end = find_next_zero_bit(map, to, start);
+		if (end - start >= want)
+			return start;
+		start = find_next_bit(map, to, end);
+	}
+	return to;
+}
+
+/* Where to start allocating; the caller takes free bits from here on. */
+static int fat_bitmap_find(struct msdos_sb_info *sbi, int nr_cluster)
+{
+	unsigned long *map = sbi->free_bitmap;
+	unsigned long next = sbi->prev_free + 1;
+	unsigned long start;
+	int want = max(nr_cluster, FAT_ALLOC_RUN);
+
+	if (next < sbi->max_cluster && test_bit(next, map))
+		return next;
+
+	start = fat_bitmap_find_run(map, next, sbi->max_cluster, want);
+	if (start < sbi->max_cluster)
+		return start;
+	start = fat_bitmap_find_run(map, FAT_START_ENT, next, want);
+	if (start < next)
+		return start;
+	return next;
+}
+
+static int fat_bitmap_alloc(struct inode *inode, int *cluster, int nr_cluster,
+			    struct buffer_head **bhs, int *nr_bhs,
+			    int *idx_clus)
+{
+	struct super_block *sb = inode->i_sb;
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	struct fatent_operations *ops = sbi->fatent_ops;
+	struct fat_entry fatent, prev_ent;
+	unsigned long entry;
+	int err = 0;
+
+	fatent_init(&prev_ent);
+	fatent_init(&fatent);
+	entry = fat_bitmap_find(sbi, nr_cluster);
+	while (*idx_clus < nr_cluster) {
+		entry = find_next_bit(sbi->free_bitmap, sbi->max_cluster, entry);
+		if (entry >= sbi->max_cluster) {
+			entry = find_next_bit(sbi->free_bitmap,
+					      sbi->max_cluster, FAT_START_ENT);
+			if (entry >= sbi->max_cluster) {
+				err = -ENOSPC;
+				break;
+			}
+		}
+
+		fatent_set_entry(&fatent, entry);
+		err = fat_ent_read_block(sb, &fatent);
+		if (err)
+			break;
+		if (ops->ent_get(&fatent) != FAT_ENT_FREE) {
+			fat_fs_error(sb, "%s: free cluster bitmap is stale"
+				     " (entry 0x%08lx)", __func__, entry);
+			err = -EIO;
+			break;
+		}
+
+		/* make the cluster chain */
+		ops->ent_put(&fatent, FAT_ENT_EOF);
+		if (prev_ent.nr_bhs)
+			ops->ent_put(&prev_ent, entry);
+
+		fat_collect_bhs(bhs, nr_bhs, &fatent);
+
+		__clear_bit(entry, sbi->free_bitmap);
+		sbi->prev_free = entry;
+		if (sbi->free_clusters != -1)
+			sbi->free_clusters--;
+		sb->s_dirt = 1;
+
+		cluster[*idx_clus] = entry;
+		(*idx_clus)++;
+
+		/* as in fat_alloc_clusters(), bhs holds the references */
+		prev_ent = fatent;
+	}
+	fatent_brelse(&fatent);
+	return err;
+}
+
 int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 {
 	struct super_block *sb = inode->i_sb;
@@ -471,6 +575,13 @@ int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 	}
 
 	err = nr_bhs = idx_clus = 0;
+	if (sbi->free_bitmap_ready) {
+		err = fat_bitmap_alloc(inode, cluster, nr_cluster, bhs, &nr_bhs,
+				       &idx_clus);
+		unlock_fat(sbi);
+		goto out_unlocked;
+	}
+
 	count = FAT_START_ENT;
 	fatent_init(&prev_ent);
 	fatent_init(&fatent);
@@ -495,6 +606,8 @@ int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 
 				fat_collect_bhs(bhs, &nr_bhs, &fatent);
 
+				if (sbi->free_bitmap)
+					__clear_bit(entry, sbi->free_bitmap);
 				sbi->prev_free = entry;
 				if (sbi->free_clusters != -1)
 					sbi->free_clusters--;
@@ -526,6 +639,7 @@ int fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 out:
 	unlock_fat(sbi);
 	fatent_brelse(&fatent);
+out_unlocked:
 	if (!err) {
 		if (inode_needs_sync(inode))
 			err = fat_sync_bhs(bhs, nr_bhs);
@@ -579,6 +693,8 @@ int fat_free_clusters(struct inode *inode, int cluster)
 		}
 
 		ops->ent_put(&fatent, FAT_ENT_FREE);
+		if (sbi->free_bitmap)
+			__set_bit(fatent.entry, sbi->free_bitmap);
 		if (sbi->free_clusters != -1) {
 			sbi->free_clusters++;
 			sb->s_dirt = 1;
@@ -641,6 +757,10 @@ int fat_count_free_clusters(struct super_block *sb)
 	unsigned long reada_blocks, reada_mask, cur_block;
 	int err = 0, free;
 
+	/* a scan is already under way, let it finish rather than repeat it */
+	if (sbi->free_bitmap && !sbi->free_bitmap_ready)
+		flush_work(&sbi->free_bitmap_work);
+
 	lock_fat(sbi);
 	if (sbi->free_clusters != -1 && sbi->free_clus_valid)
 		goto out;
@@ -677,3 +797,111 @@ out:
 	unlock_fat(sbi);
 	return err;
 }
+
+/*
+ * Free cluster bitmap.  Built by a background scan after mount so the
+ * allocator can find free runs without walking the FAT and statfs has an
+ * exact count.  fat_lock is only held per FAT block while scanning, and
+ * alloc/free keep the bits up to date for the blocks already scanned.
+ */
+static struct workqueue_struct *fat_bitmap_wq;
+
+static void fat_free_bitmap_build(struct work_struct *work)
+{
+	struct msdos_sb_info *sbi = container_of(work, struct msdos_sb_info,
+						 free_bitmap_work);
+	struct super_block *sb = sbi->fat_inode->i_sb;
+	struct fatent_operations *ops = sbi->fatent_ops;
+	unsigned long *map = sbi->free_bitmap;
+	struct fat_entry fatent;
+	unsigned long reada_blocks, reada_mask, cur_block;
+	int err = 0;
+
+	reada_blocks = FAT_READA_SIZE >> sb->s_blocksize_bits;
+	reada_mask = reada_blocks - 1;
+	cur_block = 0;
+
+	fatent_init(&fatent);
+	fatent_set_entry(&fatent, FAT_START_ENT);
+	while (fatent.entry < sbi->max_cluster) {
+		if (sbi->free_bitmap_abort)
+			goto out;
+
+		/* readahead of fat blocks */
+		if ((cur_block & reada_mask) == 0) {
+			unsigned long rest = sbi->fat_length - cur_block;
+			fat_ent_reada(sb, &fatent, min(reada_blocks, rest));
+		}
+		cur_block++;
+
+		lock_fat(sbi);
+		err = fat_ent_read_block(sb, &fatent);
+		if (err) {
+			unlock_fat(sbi);
+			goto out;
+		}
+		do {
+			if (ops->ent_get(&fatent) == FAT_ENT_FREE)
+				__set_bit(fatent.entry, map);
+			else
+				__clear_bit(fatent.entry, map);
+		} while (fat_ent_next(sbi, &fatent));
+		unlock_fat(sbi);
+	}
+
+	lock_fat(sbi);
+	sbi->free_clusters = bitmap_weight(map, sbi->max_cluster);
+	sbi->free_clus_valid = 1;
+	sbi->free_bitmap_ready = 1;
+	sb->s_dirt = 1;
+	unlock_fat(sbi);
+out:
+	fatent_brelse(&fatent);
+	if (err) {
+		/* fall back to scanning the FAT */
+		lock_fat(sbi);
+		sbi->free_bitmap = NULL;
+		unlock_fat(sbi);
+		vfree(map);
+	}
+}
+
+void fat_free_bitmap_start(struct super_block *sb)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+	unsigned long size;
+
+	INIT_WORK(&sbi->free_bitmap_work, fat_free_bitmap_build);
+
+	size = BITS_TO_LONGS(sbi->max_cluster) * sizeof(unsigned long);
+	sbi->free_bitmap = vmalloc(size);
+	if (!sbi->free_bitmap)
+		return;
+	memset(sbi->free_bitmap, 0, size);
+
+	queue_work(fat_bitmap_wq, &sbi->free_bitmap_work);
+}
+
+void fat_free_bitmap_stop(struct super_block *sb)
+{
+	struct msdos_sb_info *sbi = MSDOS_SB(sb);
+
+	sbi->free_bitmap_abort = 1;
+	cancel_work_sync(&sbi->free_bitmap_work);
+	vfree(sbi->free_bitmap);
+	sbi->free_bitmap = NULL;
+	sbi->free_bitmap_ready = 0;
+}
+
+int __init fat_free_bitmap_init(void)
+{
+	fat_bitmap_wq = create_singlethread_workqueue("fat_bitmap");
+	if (fat_bitmap_wq == NULL)
+		return -ENOMEM;
+	return 0;
+}
+
+void fat_free_bitmap_destroy(void)
+{
+	destroy_workqueue(fat_bitmap_wq);
+}
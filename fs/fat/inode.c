@@ -465,6 +465,8 @@ static void fat_put_super(struct super_block *sb)
 
 	lock_kernel();
 
+	fat_free_bitmap_stop(sb);
+
 	if (sb->s_dirt)
 		fat_write_super(sb);
 
@@ -514,6 +516,9 @@ static void init_once(void *foo)
 	ei->nr_caches = 0;
 	ei->cache_valid_id = FAT_CACHE_VALID + 1;
 	INIT_LIST_HEAD(&ei->cache_lru);
+	ei->extents = NULL;
+	ei->nr_extents = 0;
+	ei->extents_failed = 0;
 	INIT_HLIST_NODE(&ei->i_fat_hash);
 	inode_init_once(&ei->vfs_inode);
 }
@@ -1477,6 +1482,8 @@ int fat_fill_super(struct super_block *sb, void *data, int silent,
 		goto out_fail;
 	}
 
+	fat_free_bitmap_start(sb);
+
 	return 0;
 
 out_invalid:
@@ -1565,8 +1572,14 @@ static int __init init_fat_fs(void)
 	if (err)
 		goto failed;
 
+	err = fat_free_bitmap_init();
+	if (err)
+		goto failed_bitmap;
+
 	return 0;
 
+failed_bitmap:
+	fat_destroy_inodecache();
 failed:
 	fat_cache_destroy();
 	return err;
@@ -1574,6 +1587,7 @@ failed:
 
 static void __exit exit_fat_fs(void)
 {
+	fat_free_bitmap_destroy();
 	fat_cache_destroy();
 	fat_destroy_inodecache();
 }
@@ -0,0 +1,228 @@
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * Copyright (c) 2002, 2003, 2004, 2005, 2006, 2007, 2008, 2009
+ * Phillip Lougher <phillip@lougher.demon.co.uk>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * decompressor.c
+ */
+
+/*
+ * This file maps the compression id stored in the superblock to the
+ * decompressor implementing it.  Compression types not built into this
+ * kernel have a placeholder entry so the mount can name what is missing.
+ *
+ * Each superblock keeps a pool of decompressor streams.  One is created at
+ * mount time, more are created on demand up to msblk->max_streams, so a
+ * reader waiting for its buffer_heads does not hold up the others.
+ */
+
+#include <linux/types.h>
+#include <linux/mutex.h>
+#include <linux/buffer_head.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+
+#include "squashfs_fs.h"
+#include "squashfs_fs_sb.h"
+#include "squashfs_fs_i.h"
+#include "decompressor.h"
+#include "squashfs.h"
+
+#ifndef CONFIG_SQUASHFS_LZMA
+static const struct squashfs_decompressor squashfs_lzma_comp_ops = {
+	NULL, NULL, NULL, LZMA_COMPRESSION, "lzma", 0
+};
+#endif
+
+#ifndef CONFIG_SQUASHFS_LZO
+static const struct squashfs_decompressor squashfs_lzo_comp_ops = {
+	NULL, NULL, NULL, LZO_COMPRESSION, "lzo", 0
+};
+#endif
+
+/* there is no xz decoder in lib/ on this kernel */
+static const struct squashfs_decompressor squashfs_xz_comp_ops = {
+	NULL, NULL, NULL, XZ_COMPRESSION, "xz", 0
+};
+
+static const struct squashfs_decompressor squashfs_unknown_comp_ops = {
+	NULL, NULL, NULL, 0, "unknown", 0
+};
+
+static const struct squashfs_decompressor *decompressor[] = {
+	&squashfs_zlib_comp_ops,
+	&squashfs_lzo_comp_ops,
+	&squashfs_lzma_comp_ops,
+	&squashfs_xz_comp_ops,
+	&squashfs_unknown_comp_ops
+};
+
+
+const struct squashfs_decompressor *squashfs_lookup_decompressor(int id)
+{
+	int i;
+
+	for (i = 0; decompressor[i]->id; i++)
+		if (id == decompressor[i]->id)
+			break;
+
+	return decompressor[i];
+}
+
+
+struct squashfs_stream {
+	void			*stream;
+	struct list_head	list;
+};
+
+struct squashfs_stream_pool {
+	struct mutex		mutex;
+	struct list_head	free;
+	int			total;
+	wait_queue_head_t	wait;
+};
+
+
+static struct squashfs_stream *alloc_stream(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream *stream = kmalloc(sizeof(*stream), GFP_KERNEL);
+	if (stream == NULL)
+		return NULL;
+
+	stream->stream = msblk->decompressor->init(msblk);
+	if (stream->stream == NULL) {
+		kfree(stream);
+		return NULL;
+	}
+
+	return stream;
+}
+
+
+static void free_stream(struct squashfs_sb_info *msblk,
+	struct squashfs_stream *stream)
+{
+	msblk->decompressor->free(stream->stream);
+	kfree(stream);
+}
+
+
+void *squashfs_decompressor_init(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream *stream;
+	struct squashfs_stream_pool *pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (pool == NULL)
+		goto failed;
+
+	mutex_init(&pool->mutex);
+	INIT_LIST_HEAD(&pool->free);
+	init_waitqueue_head(&pool->wait);
+
+	stream = alloc_stream(msblk);
+	if (stream == NULL)
+		goto failed;
+
+	list_add(&stream->list, &pool->free);
+	pool->total = 1;
+
+	return pool;
+
+failed:
+	ERROR("Failed to allocate %s decompressor\n", msblk->decompressor->name);
+	kfree(pool);
+	return NULL;
+}
+
+
+void squashfs_decompressor_free(struct squashfs_sb_info *msblk, void *s)
+{
+	struct squashfs_stream_pool *pool = s;
+	struct squashfs_stream *stream, *next;
+
+	if (pool == NULL)
+		return;
+
+	list_for_each_entry_safe(stream, next, &pool->free, list)
+		free_stream(msblk, stream);
+	kfree(pool);
+}
+
+
+static struct squashfs_stream *get_stream(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream_pool *pool = msblk->stream;
+	struct squashfs_stream *stream;
+
+	while (1) {
+		mutex_lock(&pool->mutex);
+
+		if (!list_empty(&pool->free)) {
+			stream = list_entry(pool->free.next,
+					struct squashfs_stream, list);
+			list_del(&stream->list);
+			mutex_unlock(&pool->mutex);
+			return stream;
+		}
+
+		if (pool->total < msblk->max_streams) {
+			pool->total++;
+			mutex_unlock(&pool->mutex);
+
+			stream = alloc_stream(msblk);
+			if (stream)
+				return stream;
+
+			/* out of memory, make do with the streams we have */
+			mutex_lock(&pool->mutex);
+			pool->total--;
+		}
+
+		mutex_unlock(&pool->mutex);
+		wait_event(pool->wait, !list_empty(&pool->free));
+	}
+}
+
+
+static void put_stream(struct squashfs_sb_info *msblk,
+	struct squashfs_stream *stream)
+{
+	struct squashfs_stream_pool *pool = msblk->stream;
+
+	mutex_lock(&pool->mutex);
+	list_add(&stream->list, &pool->free);
+	mutex_unlock(&pool->mutex);
+
+	wake_up(&pool->wait);
+}
+
+
+int squashfs_decompress(struct squashfs_sb_info *msblk, void **buffer,
+	struct buffer_head **bh, int b, int offset, int length, int srclength,
+	int pages)
+{
+	struct squashfs_stream *stream = get_stream(msblk);
+	int res;
+
+	res = msblk->decompressor->decompress(msblk, stream->stream, buffer, bh,
+		b, offset, length, srclength, pages);
+
+	put_stream(msblk, stream);
+
+	return res;
+}
@@ -372,6 +372,92 @@ static int read_blocklist(struct inode *inode, int index, u64 *block)
 }
 
 
+/*
+ * Decompress a whole datablock straight into the page cache pages it
+ * covers, rather than into the "data" cache and copying out.  Only done
+ * when every page of the block can be grabbed and none is uptodate yet,
+ * which is the usual case under readahead.  Returns -EAGAIN if the caller
+ * should go through the cache instead.
+ */
+static int squashfs_readpage_direct(struct page *target_page, u64 block,
+	int bsize)
+{
+	struct inode *inode = target_page->mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int file_end = (i_size_read(inode) - 1) >> PAGE_CACHE_SHIFT;
+	int mask = (1 << (msblk->block_log - PAGE_CACHE_SHIFT)) - 1;
+	int start_index = target_page->index & ~mask;
+	int end_index = min(start_index | mask, file_end);
+	int pages = end_index - start_index + 1;
+	int i, n, bytes, res = -EAGAIN;
+	struct page **page;
+	void **pageaddr;
+
+	page = kmalloc(pages * (sizeof(*page) + sizeof(*pageaddr)), GFP_KERNEL);
+	if (page == NULL)
+		return -EAGAIN;
+	pageaddr = (void **) (page + pages);
+
+	for (i = 0, n = start_index; n <= end_index; i++, n++) {
+		page[i] = (n == target_page->index) ? target_page :
+			grab_cache_page_nowait(target_page->mapping, n);
+
+		if (page[i] == NULL || PageUptodate(page[i]))
+			goto release;
+
+		pageaddr[i] = kmap(page[i]);
+	}
+
+	res = squashfs_read_data(inode->i_sb, pageaddr, block, bsize, NULL,
+			pages << PAGE_CACHE_SHIFT, pages);
+	if (res < 0 || res > pages * PAGE_CACHE_SIZE) {
+		ERROR("Unable to read page, block %llx, size %x\n", block,
+			bsize);
+		res = -EIO;
+		goto unmap;
+	}
+
+	/* zero everything past the end of the data, the block may be short */
+	for (i = res >> PAGE_CACHE_SHIFT; i < pages; i++) {
+		bytes = (i == res >> PAGE_CACHE_SHIFT) ?
+			res & (PAGE_CACHE_SIZE - 1) : 0;
+		memset(pageaddr[i] + bytes, 0, PAGE_CACHE_SIZE - bytes);
+	}
+
+	for (i = 0; i < pages; i++) {
+		kunmap(page[i]);
+		flush_dcache_page(page[i]);
+		SetPageUptodate(page[i]);
+		if (page[i] != target_page) {
+			unlock_page(page[i]);
+			page_cache_release(page[i]);
+		}
+	}
+
+	kfree(page);
+	return 0;
+
+release:
+	/* page[i] was grabbed but not mapped */
+	if (page[i] && page[i] != target_page) {
+		unlock_page(page[i]);
+		page_cache_release(page[i]);
+	}
+
+unmap:
+	for (n = 0; n < i; n++) {
+		kunmap(page[n]);
+		if (page[n] != target_page) {
+			unlock_page(page[n]);
+			page_cache_release(page[n]);
+		}
+	}
+
+	kfree(page);
+	return res;
+}
+
+
 static int squashfs_readpage(struct file *file, struct page *page)
 {
 	struct inode *inode = page->mapping->host;
@@ -410,6 +496,13 @@ static int squashfs_readpage(struct file *file, struct page *page)
 				 msblk->block_size;
 			sparse = 1;
 		} else {
+			int res = squashfs_readpage_direct(page, block, bsize);
+			if (res == 0) {
+				unlock_page(page);
+				return 0;
+			} else if (res != -EAGAIN)
+				goto error_out;
+
 			/*
 			 * Read and decompress datablock.
 			 */
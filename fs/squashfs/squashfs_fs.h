@@ -178,6 +178,9 @@
 /* cached data constants for filesystem */
 #define SQUASHFS_CACHED_BLKS		8
 
+/* upper bound for the metadata_cache/fragment_cache/data_cache/streams options */
+#define SQUASHFS_MAX_CACHED		64
+
 #define SQUASHFS_MAX_FILE_SIZE_LOG	64
 
 #define SQUASHFS_MAX_FILE_SIZE		(1LL << \
@@ -212,6 +215,9 @@ struct meta_index {
  * definitions for structures on disk
  */
 #define ZLIB_COMPRESSION	 1
+#define LZMA_COMPRESSION	 2
+#define LZO_COMPRESSION		 3
+#define XZ_COMPRESSION		 4
 
 struct squashfs_super_block {
 	__le32			s_magic;
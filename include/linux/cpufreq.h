@@ -321,6 +321,19 @@ extern struct cpufreq_governor cpufreq_gov_ondemand;
 #elif defined(CONFIG_CPU_FREQ_DEFAULT_GOV_CONSERVATIVE)
 extern struct cpufreq_governor cpufreq_gov_conservative;
 #define CPUFREQ_DEFAULT_GOVERNOR	(&cpufreq_gov_conservative)
+#elif defined(CONFIG_CPU_FREQ_DEFAULT_GOV_DEADLINE)
+extern struct cpufreq_governor cpufreq_gov_deadline;
+#define CPUFREQ_DEFAULT_GOVERNOR	(&cpufreq_gov_deadline)
+#endif
+
+/* Deadline events for the 'deadline' governor */
+#ifdef CONFIG_CPU_FREQ_GOV_DEADLINE
+extern void cpufreq_deadline_frame(int slack_us, unsigned int period_us);
+extern void cpufreq_deadline_underrun(void);
+#else
+static inline void cpufreq_deadline_frame(int slack_us,
+					  unsigned int period_us) { }
+static inline void cpufreq_deadline_underrun(void) { }
 #endif
 
 
@@ -408,6 +408,7 @@ struct vm_area_struct;
 struct fb_info;
 struct device;
 struct file;
+struct poll_table_struct;
 
 /* Definitions below are used in the parsed monitor specs */
 #define FB_DPMS_ACTIVE_OFF	1
@@ -680,6 +681,10 @@ struct fb_ops {
 
 	/* teardown any resources to do with this framebuffer */
 	void (*fb_destroy)(struct fb_info *info);
+
+	/* wait for fb specific events (optional) */
+	unsigned int (*fb_poll)(struct fb_info *info, struct file *file,
+				struct poll_table_struct *wait);
 };
 
 #ifdef CONFIG_FB_TILEBLITTING
@@ -0,0 +1,19 @@
+#ifndef __JZ_TCSM_H__
+#define __JZ_TCSM_H__
+
+#include <linux/types.h>
+
+/*
+ * Pieces of the TCSM on-chip scratchpad for kernel hot paths, see
+ * drivers/char/jzchar/tcsm.c.  Addresses are uncached; NULL means TCSM
+ * is full, mapped by a process, or not there.
+ */
+#if defined(CONFIG_JZ_TCSM) || defined(CONFIG_JZ_TCSM_MODULE)
+extern void *jz_tcsm_alloc(size_t size);
+extern void jz_tcsm_free(void *addr, size_t size);
+#else
+static inline void *jz_tcsm_alloc(size_t size) { return NULL; }
+static inline void jz_tcsm_free(void *addr, size_t size) { }
+#endif
+
+#endif /* __JZ_TCSM_H__ */
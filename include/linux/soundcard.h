@@ -637,6 +637,8 @@ typedef struct buffmem_desc {
 #define SNDCTL_DSP_SETSYNCRO		_SIO  ('P', 21)
 #define SNDCTL_DSP_SETDUPLEX		_SIO  ('P', 22)
 #define SNDCTL_DSP_GETODELAY		_SIOR ('P', 23, int)
+#define SNDCTL_DSP_GETPLAYVOL		_SIOR ('P', 24, int)
+#define SNDCTL_DSP_SETPLAYVOL		_SIOWR('P', 24, int)
 
 #define SNDCTL_DSP_GETCHANNELMASK		_SIOWR('P', 64, int)
 #define SNDCTL_DSP_BIND_CHANNEL		_SIOWR('P', 65, int)
@@ -34,6 +34,7 @@
 #else
 #include <linux/decompress/unlzma.h>
 #include <linux/slab.h>
+#include <linux/module.h>
 #endif /* STATIC */
 
 #include <linux/decompress/mm.h>
@@ -645,6 +646,10 @@ exit_0:
 	return ret;
 }
 
+#if !defined(PREBOOT) && defined(CONFIG_SQUASHFS_LZMA)
+EXPORT_SYMBOL(unlzma);
+#endif
+
 #ifdef PREBOOT
 STATIC int INIT decompress(unsigned char *buf, int in_len,
 			      int(*fill)(void*, unsigned int),
@@ -23,7 +23,11 @@
 #include <linux/dma-mapping.h>
 #include <linux/mutex.h>
 #include <linux/mm.h>
+#include <linux/cpufreq.h>
+#include <linux/poll.h>
+#include <linux/kthread.h>
 #include <asm/hardirq.h>
+#include <asm/div64.h>
 #include <asm/jzsoc.h>
 #include "sound_config.h"
 
@@ -59,6 +63,9 @@
 #define AUDIO_UNLOCK(lock, flags)	spin_unlock_irqrestore(&lock, flags)
 
 #define THIS_AUDIO_NODE(p)		list_entry(p, audio_node, list)
+#define AUDIO_RING_MAX			32
+/* Replay periods are chained in hardware, small fragments are fine */
+#define AUDIO_MIN_FRAGSIZE		512
 #define ALIGN_PAGE_SIZE(x)		(((x) + PAGE_SIZE) / PAGE_SIZE * PAGE_SIZE)
 
 typedef struct {
@@ -105,6 +112,25 @@ typedef struct __audio_pipe
 
 	wait_queue_head_t	q_full;
 	int			avialable_couter;
+	int			writers;	/* write() calls in progress */
+
+	/* replay descriptor ring, see audio_ring_start() */
+	jz_dma_desc_8word	*ring;
+	unsigned long		ring_page;
+	unsigned int		ring_phys;
+	audio_node		*ring_node[AUDIO_RING_MAX];
+	int			ring_len;
+	int			ring_cur;
+	int			ring_tail;
+	int			ring_queued;
+	int			ring_idle;
+	int			ring_mapped;	/* vmas mapping the buffer */
+	int			ring_mmap;	/* ring loops over the mapped buffer */
+	unsigned int		ring_periods;	/* periods played since start */
+	unsigned int		ring_reported;	/* ring_periods at the last GETOPTR */
+	unsigned long		silence_buf;
+	unsigned int		silence_phys;
+	int			silence_order;
 
 #ifdef WORK_QUEUE_MODE
 	struct work_struct	work;
@@ -181,6 +207,47 @@ static audio_pipe in_endpoint= {
 static struct i2s_codec the_codecs[NR_I2S];
 static struct jz_i2s_controller_info *the_i2s_controller = NULL;
 static int audio_mix_modcnt = 0;
+
+/*
+ * Software mixer
+ *
+ * Every write-only opener of /dev/dsp owns a virtual stream with its own
+ * rate, channel count, sample format and volume. A lone stream matching
+ * the codec writes straight into the replay nodes as before. Otherwise
+ * write() runs the format filters to turn the data into S16 stereo frames
+ * queued in a FIFO, and kjzmix resamples them to the codec rate (16.16
+ * fixed-point linear interpolation), sums them into replay nodes and
+ * narrows the result for an 8-bit codec. It keeps only JZ_MIX_AHEAD periods
+ * queued ahead of the DMA.
+ */
+#define JZ_MIX_STREAMS		4
+#define JZ_MIX_FIFO_FRAMES	8192	/* power of two */
+#define JZ_MIX_AHEAD		3
+
+struct jz_mix_stream {
+	int			used;
+	int			drain;	/* play out a partial period too */
+	int			rate;
+	int			channels;
+	int			format;	/* AFMT_S16_LE, AFMT_S8 or AFMT_U8 */
+	int			volume;	/* left | right << 8, 0 - 100 each */
+	unsigned int		phase;	/* 16.16 position between last and next */
+	u32			last;
+	u32			next;
+	u32			*fifo;
+	unsigned int		head;
+	unsigned int		count;
+	wait_queue_head_t	wait;
+};
+
+static struct jz_mix_stream mix_streams[JZ_MIX_STREAMS];
+static int mix_users = 0;
+static unsigned int mix_queued = 0;	/* frames in all FIFOs */
+static DEFINE_SPINLOCK(mix_lock);	/* process context only, irqs stay on */
+static DECLARE_WAIT_QUEUE_HEAD(mix_wait);
+static struct task_struct *mix_thread = NULL;
+static s16 mix_chunk[512];	/* kjzmix only, for 8-bit codecs */
+
 static audio_node *last_read_node = NULL;
 static int g_play_first = 0;
 
@@ -564,6 +631,31 @@ static inline int get_audio_freenodecount(unsigned int *mem)
 	return count;
 }
 
+static inline int get_audio_usenodecount(unsigned int *mem)
+{
+	struct list_head *puse;
+	struct list_head *plist;
+	audio_head *phead;
+	int count = 0;
+
+	phead = (audio_head *)mem;
+	puse =  &(phead->use);
+	plist = puse;
+	while (plist->next != puse) {
+		count++;
+		plist = plist->next;
+	}
+	return count;
+}
+
+/* The fragments sit back to back behind the node list */
+static inline unsigned int get_audio_fragmem(unsigned int *mem)
+{
+	audio_head *phead = (audio_head *)mem;
+
+	return (unsigned int)mem + phead->listsize;
+}
+
 //--------------------------------------------------------------------
 // end audio node operater
 //--------------------------------------------------------------------
@@ -587,7 +679,15 @@ static irqreturn_t jz_i2s_dma_irq (int irq, void *dev_id)
 
 	ENTER();
 
-	REG_DMAC_DCCSR(dma_chan) = 0;
+	/*
+	 * The replay ring keeps running across the interrupt, so only the
+	 * status bits are acked and EN and the descriptor mode stay set.
+	 */
+	if (endpoint->ring) {
+		REG_DMAC_DCCSR(dma_chan) &= ~(DMAC_DCCSR_TT | DMAC_DCCSR_CT | DMAC_DCCSR_AR);
+	} else {
+		REG_DMAC_DCCSR(dma_chan) = 0;
+	}
 
 	DPRINT_IRQ("!!!! endpoint direct = %s \n",(endpoint == &out_endpoint) ? "out" : "in");
 
@@ -862,6 +962,325 @@ static inline void audio_stop_dma_node(audio_dma_type* dma)
 	REG_DMAC_DCCSR(dma->ch) = 0;
 }
 
+//-------------------------------------------------------------------
+/*
+ * Replay descriptor ring
+ *
+ * Replay DMA follows a circular chain of 8-word descriptors, one per
+ * fragment, so the DMAC moves from one period to the next by itself.
+ * Slots without queued data point at a silence buffer. The interrupt
+ * only reaps the periods the hardware has finished: their nodes go back
+ * to the free list and their descriptors fall back to silence. A late
+ * interrupt therefore no longer opens a gap as long as the ring is fed.
+ *
+ * Every descriptor always moves a whole fragment, so refilling a slot
+ * is a single store to dsadr and can race safely with the DMAC fetching
+ * it. Short nodes are padded with silence.
+ *
+ * Slots [ring_cur, ring_tail) hold data. ring_queued counts them.
+ * All ring_* fields are protected by endpoint->lock.
+ *
+ * In mmap mode (ring_mmap) slot i is pinned to fragment i of the mapped
+ * buffer and the ring loops over it untouched. The application writes
+ * ahead of the hardware pointer reported by SNDCTL_DSP_GETOPTR.
+ */
+#define ring_next(ep, i)	(((i) + 1) % (ep)->ring_len)
+
+static int audio_ring_init(audio_pipe *endpoint)
+{
+	endpoint->ring_page = __get_free_page(GFP_KERNEL | GFP_DMA);
+	if (!endpoint->ring_page) {
+		return -ENOMEM;
+	}
+	dma_cache_wback_inv(endpoint->ring_page, PAGE_SIZE);
+	endpoint->ring = (jz_dma_desc_8word *)KSEG1ADDR(endpoint->ring_page);
+	endpoint->ring_phys = virt_to_phys((void *)endpoint->ring_page);
+	memset((void *)endpoint->ring, 0, PAGE_SIZE);
+	return 0;
+}
+
+static void audio_ring_deinit(audio_pipe *endpoint)
+{
+	if (endpoint->silence_buf) {
+		free_pages(endpoint->silence_buf, endpoint->silence_order);
+		endpoint->silence_buf = 0;
+	}
+	if (endpoint->ring_page) {
+		free_page(endpoint->ring_page);
+		endpoint->ring_page = 0;
+		endpoint->ring = NULL;
+	}
+}
+
+/* (Re)allocate the silence buffer after the fragment size changed */
+static int audio_ring_resize(audio_pipe *endpoint, unsigned int fragsize)
+{
+	int order = get_order(fragsize);
+	unsigned long buf;
+
+	buf = __get_free_pages(GFP_KERNEL | GFP_DMA, order);
+	if (!buf) {
+		return -ENOMEM;
+	}
+	memset((void *)buf, 0, PAGE_SIZE << order);
+	dma_cache_wback_inv(buf, PAGE_SIZE << order);
+
+	if (endpoint->silence_buf) {
+		free_pages(endpoint->silence_buf, endpoint->silence_order);
+	}
+	endpoint->silence_buf = buf;
+	endpoint->silence_order = order;
+	endpoint->silence_phys = virt_to_phys((void *)buf);
+	return 0;
+}
+
+/* Pad a short node with silence so its slot can keep the full count */
+static inline void audio_ring_pad(audio_pipe *endpoint, audio_node *node)
+{
+	if (node->end < endpoint->fragsize) {
+		memset((void *)(node->pBuf + node->end), 0, endpoint->fragsize - node->end);
+		dma_cache_wback(node->pBuf + node->end, endpoint->fragsize - node->end);
+	}
+}
+
+/* Slot the DMAC is transferring right now, derived from its next pointer */
+static inline int audio_ring_hw_slot(audio_pipe *endpoint)
+{
+	unsigned int next;
+
+	next = (REG_DMAC_DDA(endpoint->dma.ch) - endpoint->ring_phys) / sizeof(jz_dma_desc_8word);
+	return (next + endpoint->ring_len - 1) % endpoint->ring_len;
+}
+
+/*
+ * The ring ran dry. That is only an underrun while the replay stream is
+ * open and data is on its way, a stream that is paused or finished just
+ * plays silence.
+ */
+static inline void audio_ring_dry(audio_pipe *endpoint)
+{
+	if (endpoint != the_i2s_controller->pout_endpoint) {
+		return;
+	}
+	if (endpoint->writers || mix_queued) {
+		the_i2s_controller->error++;
+		cpufreq_deadline_underrun();
+	}
+}
+
+/*
+ * Recycle every period the hardware has finished and top the ring up
+ * from the use list. Returns the number of nodes given back.
+ */
+static int audio_ring_feed(audio_pipe *endpoint)
+{
+	jz_dma_desc_8word *desc = endpoint->ring;
+	audio_node *node;
+	int active = audio_ring_hw_slot(endpoint);
+	int freed = 0;
+
+	if (endpoint->ring_mmap) {
+		while (endpoint->ring_cur != active) {
+			endpoint->ring_periods++;
+			endpoint->ring_cur = ring_next(endpoint, endpoint->ring_cur);
+			freed++;
+		}
+		return freed;
+	}
+
+	while (endpoint->ring_cur != active) {
+		int i = endpoint->ring_cur;
+
+		node = endpoint->ring_node[i];
+		if (node) {
+			put_audio_freenode(endpoint->mem, node);
+			endpoint->ring_node[i] = NULL;
+			endpoint->ring_queued--;
+			endpoint->ring_idle = 0;
+			endpoint->ring_periods++;
+			desc[i].dsadr = endpoint->silence_phys;
+			freed++;
+		} else if (endpoint->ring_idle++ == 0) {
+			audio_ring_dry(endpoint);
+		}
+		endpoint->ring_cur = ring_next(endpoint, i);
+	}
+
+	/* The active slot is playing silence, resume right behind it */
+	if (endpoint->ring_queued == 0) {
+		endpoint->ring_tail = ring_next(endpoint, endpoint->ring_cur);
+	}
+
+	while (endpoint->ring_tail != endpoint->ring_cur) {
+		int i = endpoint->ring_tail;
+
+		node = get_audio_usenode(endpoint->mem);
+		if (!node) {
+			break;
+		}
+		endpoint->ring_node[i] = node;
+		desc[i].dsadr = node->phyaddr;
+		endpoint->ring_queued++;
+		endpoint->ring_tail = ring_next(endpoint, i);
+	}
+
+	return freed;
+}
+
+/* Build the ring over the queued nodes and kick the channel */
+static int audio_ring_start(audio_pipe *endpoint)
+{
+	jz_dma_desc_8word *desc = endpoint->ring;
+	audio_dma_type *dma = &endpoint->dma;
+	unsigned int dcmd, count;
+	audio_node *node;
+	int ch = dma->ch;
+	int i;
+
+	if (!desc || !endpoint->silence_buf || (REG_DMAC_DCCSR(ch) & DMAC_DCCSR_EN)) {
+		return 0;
+	}
+
+	endpoint->ring_len = endpoint->fragstotal;
+	dcmd = (*dma->trans_mode & ~DMAC_DCMD_STDE) | DMAC_DCMD_SAI | DMAC_DCMD_LINK | DMAC_DCMD_TIE;
+	count = endpoint->fragsize * 8 / dma->onetrans_bit;
+
+	for (i = 0; i < endpoint->ring_len; i++) {
+		unsigned int next = endpoint->ring_phys + ring_next(endpoint, i) * sizeof(jz_dma_desc_8word);
+
+		desc[i].dcmd = dcmd;
+		if (endpoint->ring_mmap) {
+			desc[i].dsadr = virt_to_phys((void *)get_audio_fragmem(endpoint->mem)) + i * endpoint->fragsize;
+		} else {
+			desc[i].dsadr = endpoint->silence_phys;
+		}
+		desc[i].dtadr = CPHYSADDR(AIC_DR);
+		desc[i].ddadr = ((next >> 4) << 24) | count;
+		desc[i].dstrd = 0;
+		desc[i].dreqt = DMAC_DRSR_RS_AICOUT;
+		endpoint->ring_node[i] = NULL;
+	}
+
+	endpoint->ring_cur = 0;
+	endpoint->ring_tail = 0;
+	endpoint->ring_queued = 0;
+	endpoint->ring_idle = 0;
+	endpoint->ring_periods = 0;
+	endpoint->ring_reported = 0;
+	while (!endpoint->ring_mmap && (node = get_audio_usenode(endpoint->mem)) != NULL) {
+		endpoint->ring_node[endpoint->ring_tail] = node;
+		desc[endpoint->ring_tail].dsadr = node->phyaddr;
+		endpoint->ring_queued++;
+		endpoint->ring_tail = ring_next(endpoint, endpoint->ring_tail);
+		if (endpoint->ring_tail == endpoint->ring_cur) {
+			break;
+		}
+	}
+
+	REG_DMAC_DCCSR(ch) = DMAC_DCCSR_DES8;
+	REG_DMAC_DDA(ch) = endpoint->ring_phys;
+	REG_DMAC_DMADBSR(ch / HALF_DMA_NUM) = 1 << (ch - (ch / HALF_DMA_NUM) * HALF_DMA_NUM);
+	REG_DMAC_DMACR(ch / HALF_DMA_NUM) |= DMAC_DMACR_DMAE;
+	REG_DMAC_DCCSR(ch) |= DMAC_DCCSR_EN;
+
+	DUMP_DMA(ch, "audio_ring_start -----------");
+	return 1;
+}
+
+/* Hand back the nodes still sitting in the ring, the channel must be stopped */
+static void audio_ring_release(audio_pipe *endpoint)
+{
+	int i;
+
+	for (i = 0; i < endpoint->ring_len; i++) {
+		if (endpoint->ring_node[i]) {
+			put_audio_freenode(endpoint->mem, endpoint->ring_node[i]);
+			endpoint->ring_node[i] = NULL;
+		}
+	}
+	endpoint->ring_queued = 0;
+	endpoint->ring_cur = 0;
+	endpoint->ring_tail = 0;
+}
+
+/* Stop replay and the AIC transmitter, called with endpoint->lock held */
+static void audio_ring_halt(audio_pipe *endpoint)
+{
+	endpoint->trans_state &= ~PIPE_TRANS;
+	audio_stop_dma_node(&endpoint->dma);
+	aic_disable_transmit();
+	DPRINT_IRQ("!!!! Stop AIC !\n");
+}
+
+/*
+ * Reap finished periods and return how many bytes of the active slot
+ * have gone out. The next-descriptor pointer is sampled around the count
+ * so both belong to the same slot. Called with endpoint->lock held.
+ */
+static unsigned int audio_ring_sync(audio_pipe *endpoint)
+{
+	int ch = endpoint->dma.ch;
+	unsigned int dda, left;
+
+	do {
+		audio_ring_feed(endpoint);
+		dda = REG_DMAC_DDA(ch);
+		left = REG_DMAC_DTCR(ch) * (endpoint->dma.onetrans_bit / 8);
+	} while (dda != REG_DMAC_DDA(ch) || audio_ring_hw_slot(endpoint) != endpoint->ring_cur);
+
+	return (left < endpoint->fragsize) ? endpoint->fragsize - left : 0;
+}
+
+/* SNDCTL_DSP_GETOPTR: hardware position of the replay ring */
+static void audio_ring_getptr(audio_pipe *endpoint, count_info *cinfo)
+{
+	unsigned long flags;
+	unsigned int done = 0;
+	unsigned int ptr = 0;
+	audio_node *node;
+
+	AUDIO_LOCK(endpoint->lock, flags);
+	if (endpoint->ring && (endpoint->trans_state & PIPE_TRANS)) {
+		done = audio_ring_sync(endpoint);
+		node = endpoint->ring_node[endpoint->ring_cur];
+		if (endpoint->ring_mmap) {
+			ptr = endpoint->ring_cur * endpoint->fragsize + done;
+		} else if (node) {
+			ptr = node->pBuf - get_audio_fragmem(endpoint->mem) + done;
+		} else {
+			done = 0;
+		}
+	}
+	cinfo->bytes = endpoint->ring_periods * endpoint->fragsize + done;
+	cinfo->blocks = endpoint->ring_periods - endpoint->ring_reported;
+	cinfo->ptr = ptr;
+	endpoint->ring_reported = endpoint->ring_periods;
+	AUDIO_UNLOCK(endpoint->lock, flags);
+}
+
+/* SNDCTL_DSP_GETODELAY: bytes written but not played yet */
+static int audio_ring_delay(audio_pipe *endpoint)
+{
+	unsigned long flags;
+	int queued, done = 0;
+
+	AUDIO_LOCK(endpoint->lock, flags);
+	if (endpoint->ring_mmap) {
+		AUDIO_UNLOCK(endpoint->lock, flags);
+		return 0;
+	}
+	if (endpoint->ring && (endpoint->trans_state & PIPE_TRANS)) {
+		done = audio_ring_sync(endpoint);
+		if (!endpoint->ring_node[endpoint->ring_cur]) {
+			done = 0;
+		}
+	}
+	queued = get_audio_usenodecount(endpoint->mem) + endpoint->ring_queued;
+	AUDIO_UNLOCK(endpoint->lock, flags);
+
+	return queued * endpoint->fragsize - done;
+}
+
 /* Never be used, fix me ???
 static inline int recalculate_fifowidth(short channels, short fmt)
 {
@@ -925,6 +1344,7 @@ static inline void set_controller_triger(struct jz_i2s_controller_info *controll
   int trystart_endpoint_out(audio_pipe *endpoint, audio_node *node);
   int trystart_endpoint_in(audio_pipe *endpoint, audio_node *node);
   note: this two function isn't protected;
+  trystart_endpoint_out() takes a NULL node in mmap mode.
  */
 static inline int trystart_endpoint_out(struct jz_i2s_controller_info *controller, audio_node *node)
 {
@@ -933,10 +1353,13 @@ static inline int trystart_endpoint_out(struct jz_i2s_controller_info *controlle
 
 	ENTER();
 
-	start = audio_trystart_dma_node(&(endpoint->dma), node);
+	/* node goes out first, ahead of anything already queued */
+	if (node) {
+		list_add(&node->list, &((audio_head *)endpoint->mem)->use);
+	}
+	start = audio_ring_start(endpoint);
 	if (start) {
 		endpoint->trans_state |= PIPE_TRANS;
-		endpoint->savenode = node;
 		aic_enable_transmit();
 		DUMP_AIC_REGS(__FUNCTION__);
 		DUMP_CODEC_REGS(__FUNCTION__);
@@ -1007,7 +1430,7 @@ void audio_sync_endpoint(audio_pipe *endpoint)
 
 	do {
 		AUDIO_LOCK(endpoint->lock, flags);
-		isnull = is_null_use_audio_node(endpoint->mem);
+		isnull = is_null_use_audio_node(endpoint->mem) && !endpoint->ring_queued;
 		AUDIO_UNLOCK(endpoint->lock, flags);
 		if (!isnull) {
 			//printk("&&&& audio_sync_endpoint\n");
@@ -1082,6 +1505,9 @@ void audio_close_endpoint(audio_pipe *endpoint, int mode)
 
 		endpoint->trans_state &= ~PIPE_TRANS;
 		audio_stop_dma_node(&endpoint->dma);
+		if (endpoint->ring) {
+			audio_ring_release(endpoint);
+		}
 
 		DUMP_LIST((audio_head *)endpoint->mem);
 		DUMP_NODE(endpoint->savenode, "SN");
@@ -1128,6 +1554,16 @@ int audio_resizemem_endpoint(audio_pipe *endpoint, unsigned int pagesize, unsign
 		printk("audio: Same pagesize && count !\n");
 		return 1;
 	}
+
+	/* The ring still points into the old nodes */
+	if (endpoint->ring && (endpoint->trans_state & PIPE_TRANS)) {
+		return 0;
+	}
+	if (endpoint->ring && audio_ring_resize(endpoint, pagesize)) {
+		printk("JZ I2S: Memory allocation failed for the silence buffer!\n");
+		return 0;
+	}
+
 	ret = init_audio_node(&endpoint->mem, pagesize, count);
 	if (ret) {
 		endpoint->fragsize = pagesize;
@@ -1156,10 +1592,8 @@ static void handle_in_endpoint_work(audio_pipe *endpoint)
 		endpoint->savenode = NULL;
 		DUMP_BUF((char *)(endpoint->savenode->pBuf + endpoint->savenode->start), 64, 32);
 
-		if (!(endpoint->is_non_block)) {
-			endpoint->avialable_couter++;
-			wake_up_interruptible(&endpoint->q_full);
-		}
+		endpoint->avialable_couter++;
+		wake_up_interruptible(&endpoint->q_full);
 	}
 
 	node = get_audio_freenode(endpoint->mem);
@@ -1200,39 +1634,27 @@ static void audio_in_endpoint_work(struct work_struct *work)
 
 static void handle_out_endpoint_work(audio_pipe *endpoint)
 {
-	audio_node *node;
+	int freed;
 	unsigned long flags;
 
 	ENTER();
 
 	AUDIO_LOCK(endpoint->lock, flags);
-	DPRINT_IRQ("%s endpoint->savenode = 0x%08x\n", __FUNCTION__, (unsigned int)endpoint->savenode);
-
-	if (endpoint->savenode) {
-		put_audio_freenode(endpoint->mem, endpoint->savenode);
-		DPRINT_IRQ("put_audio_freenode\n");
-		endpoint->savenode = NULL;
-
-		if (!(endpoint->is_non_block)) {
-			wake_up_interruptible(&endpoint->q_full);
-			endpoint->avialable_couter++;
+	freed = audio_ring_feed(endpoint);
+	DPRINT_IRQ("%s freed = %d, queued = %d\n", __FUNCTION__, freed, endpoint->ring_queued);
+
+	/* Wake non-blocking pollers too */
+	if (freed) {
+		wake_up_interruptible(&endpoint->q_full);
+		endpoint->avialable_couter++;
+		if (mix_queued) {
+			wake_up_interruptible(&mix_wait);
 		}
 	}
 
-	node = get_audio_usenode(endpoint->mem);
-	if (node) {
-		int start;
-		start = audio_trystart_dma_node(&(endpoint->dma), node);
-		if (start == 0) {
-			printk("audio_out_endpoint_work audio_trystart_dma_node error!\n");
-		} else {
-			endpoint->savenode = node;
-			DPRINT_DMA("restart dma!\n");
-		}
-	} else {
-		endpoint->trans_state &= ~PIPE_TRANS;
-		aic_disable_transmit();
-		DPRINT_IRQ("!!!! Stop AIC !\n");
+	/* A whole ring of silence went out, nobody is feeding us */
+	if (endpoint->ring_queued == 0 && endpoint->ring_idle >= endpoint->ring_len) {
+		audio_ring_halt(endpoint);
 	}
 
 	AUDIO_UNLOCK(endpoint->lock, flags);
@@ -1249,6 +1671,10 @@ static void audio_out_endpoint_work(struct work_struct *work)
 
 void audio_init_endpoint(audio_pipe *endpoint, unsigned int pagesize, unsigned int count)
 {
+	if (endpoint == &out_endpoint && audio_ring_init(endpoint)) {
+		printk("JZ I2S: Memory allocation failed for the replay ring!\n");
+	}
+
 	audio_resizemem_endpoint(endpoint, pagesize, count);
 	spin_lock_init(&endpoint->lock);
 	init_waitqueue_head(&endpoint->q_full);
@@ -1270,6 +1696,7 @@ void audio_init_endpoint(audio_pipe *endpoint, unsigned int pagesize, unsigned i
 void audio_deinit_endpoint(audio_pipe *endpoint)
 {
 	audio_close_endpoint(endpoint, FORCE_STOP);
+	audio_ring_deinit(endpoint);
 	deinit_audio_node(&endpoint->mem);
 }
 
@@ -1709,6 +2136,21 @@ void jz_codec_close(struct i2s_codec *codec, int mode)
 			filter functions
  ***************************************************************/
 
+/*
+ * Every filter converts in place and returns the byte count it leaves
+ * in the buffer. Filters that grow the data (8 -> 16 bits, mono -> stereo)
+ * walk backwards and need room for the result.
+ *
+ * The buffers handed in are node buffers or the mixer bounce buffer, all
+ * word aligned, so the loops move a 32-bit word (two 16-bit or four 8-bit
+ * samples) per access and only the tail goes sample by sample. Word
+ * layouts are little endian, as on every XBurst core.
+ *
+ * MXU is left out: its lazy context switch only covers user tasks, so
+ * kernel code would first have to save the owner's registers, which
+ * costs more than these loops take per period.
+ */
+
 /*
  * Convert signed byte to unsiged byte
  *
@@ -1722,79 +2164,65 @@ void jz_codec_close(struct i2s_codec *codec, int mode)
  *	0x81 (-127)	0x01 (1)
  *	......		......
  *	0xff (-1)	0x7f (127)
+ *
+ * Adding 0x80 is flipping bit 7, so a whole word is done with one xor.
  */
 static int convert_8bits_signed2unsigned(void *buffer, int counter)
 {
 	int i;
-	int counter_8align	= counter & ~0x7;
-	unsigned char *ucsrc	= buffer;
-	unsigned char *ucdst	= buffer;
+	int words		= counter >> 2;
+	u32 *wbuf		= buffer;
+	unsigned char *ucbuf	= buffer;
 
 	ENTER();
 
-	for (i = 0; i < counter_8align; i+=8) {
-		*(ucdst + i + 0) = *(ucsrc + i + 0) + 0x80;
-		*(ucdst + i + 1) = *(ucsrc + i + 1) + 0x80;
-		*(ucdst + i + 2) = *(ucsrc + i + 2) + 0x80;
-		*(ucdst + i + 3) = *(ucsrc + i + 3) + 0x80;
-		*(ucdst + i + 4) = *(ucsrc + i + 4) + 0x80;
-		*(ucdst + i + 5) = *(ucsrc + i + 5) + 0x80;
-		*(ucdst + i + 6) = *(ucsrc + i + 6) + 0x80;
-		*(ucdst + i + 7) = *(ucsrc + i + 7) + 0x80;
-		//printk("csrc + %d + 7 = %d,  ucdst + %d + 7 = %d\n",
-		//       i, *(csrc + i + 7), i, *(ucdst + i + 7));
+	for (i = 0; i < words; i++) {
+		wbuf[i] ^= 0x80808080;
 	}
 
-	BUG_ON(i != counter_8align);
-
-	for (i = counter_8align; i < counter; i++) {
-		*(ucdst + i) = *(ucsrc + i) + 0x80;
+	for (i = words << 2; i < counter; i++) {
+		ucbuf[i] ^= 0x80;
 	}
 
-	//printk("[dbg] src = 0x%02x (%d) --- dst = 0x%02x (%d), cnt = %d, cnt8a = %d\n",
-	//       *csrc, *csrc, *ucdst, *ucdst, counter, counter_8align);
 	LEAVE();
 	return counter;
 }
 
-/*
- * Convert stereo data to mono data, data width: 8 bits/channel
- *
- * buff:	buffer address
- * data_len:	data length in kernel space, the length of stereo data
- *		calculated by "node->end - node->start"
- */
-int convert_8bits_stereo2mono(void *buff, int data_len)
+/* Keep the left byte of each stereo pair, flipping the sign bit by xor */
+static inline int convert_8bits_stereo2mono_xor(void *buff, int data_len, u32 xor)
 {
-	/* stride = 16 bytes = 2 channels * 1 byte * 8 pipelines */
-	int data_len_16aligned = data_len & ~0xf;
-	int mono_cur, stereo_cur;
+	int words = data_len >> 3;
+	int i;
+	u32 *wbuf = buff;
 	unsigned char *uc_buff = buff;
 
-	/* copy 8 times each loop */
-	for (stereo_cur = mono_cur = 0;
-	     stereo_cur < data_len_16aligned;
-	     stereo_cur += 16, mono_cur += 8) {
+	/* two words of L R L R L R L R become one word of L L L L */
+	for (i = 0; i < words; i++) {
+		u32 a = wbuf[2 * i];
+		u32 b = wbuf[2 * i + 1];
 
-		uc_buff[mono_cur + 0] = uc_buff[stereo_cur + 0];
-		uc_buff[mono_cur + 1] = uc_buff[stereo_cur + 2];
-		uc_buff[mono_cur + 2] = uc_buff[stereo_cur + 4];
-		uc_buff[mono_cur + 3] = uc_buff[stereo_cur + 6];
-		uc_buff[mono_cur + 4] = uc_buff[stereo_cur + 8];
-		uc_buff[mono_cur + 5] = uc_buff[stereo_cur + 10];
-		uc_buff[mono_cur + 6] = uc_buff[stereo_cur + 12];
-		uc_buff[mono_cur + 7] = uc_buff[stereo_cur + 14];
+		wbuf[i] = ((a & 0xff) | ((a >> 8) & 0xff00) |
+			   ((b & 0xff) << 16) | ((b << 8) & 0xff000000)) ^ xor;
 	}
 
-	BUG_ON(stereo_cur != data_len_16aligned);
-
 	/* remaining data */
-	for (; stereo_cur < data_len; stereo_cur += 2, mono_cur++) {
-		uc_buff[mono_cur] = uc_buff[stereo_cur];
+	for (i = words << 3; i < data_len; i += 2) {
+		uc_buff[i >> 1] = uc_buff[i] ^ (unsigned char)xor;
 	}
 
-	LEAVE();
-	return (data_len / 2);
+	return (data_len >> 1);
+}
+
+/*
+ * Convert stereo data to mono data, data width: 8 bits/channel
+ *
+ * buff:	buffer address
+ * data_len:	data length in kernel space, the length of stereo data
+ *		calculated by "node->end - node->start"
+ */
+int convert_8bits_stereo2mono(void *buff, int data_len)
+{
+	return convert_8bits_stereo2mono_xor(buff, data_len, 0);
 }
 
 /*
@@ -1808,35 +2236,7 @@ int convert_8bits_stereo2mono(void *buff, int data_len)
  */
 int convert_8bits_stereo2mono_signed2unsigned(void *buff, int data_len)
 {
-	/* stride = 16 bytes = 2 channels * 1 byte * 8 pipelines */
-	int data_len_16aligned = data_len & ~0xf;
-	int mono_cur, stereo_cur;
-	unsigned char *uc_buff = buff;
-
-	/* copy 8 times each loop */
-	for (stereo_cur = mono_cur = 0;
-	     stereo_cur < data_len_16aligned;
-	     stereo_cur += 16, mono_cur += 8) {
-
-		uc_buff[mono_cur + 0] = uc_buff[stereo_cur + 0] + 0x80;
-		uc_buff[mono_cur + 1] = uc_buff[stereo_cur + 2] + 0x80;
-		uc_buff[mono_cur + 2] = uc_buff[stereo_cur + 4] + 0x80;
-		uc_buff[mono_cur + 3] = uc_buff[stereo_cur + 6] + 0x80;
-		uc_buff[mono_cur + 4] = uc_buff[stereo_cur + 8] + 0x80;
-		uc_buff[mono_cur + 5] = uc_buff[stereo_cur + 10] + 0x80;
-		uc_buff[mono_cur + 6] = uc_buff[stereo_cur + 12] + 0x80;
-		uc_buff[mono_cur + 7] = uc_buff[stereo_cur + 14] + 0x80;
-	}
-
-	BUG_ON(stereo_cur != data_len_16aligned);
-
-	/* remaining data */
-	for (; stereo_cur < data_len; stereo_cur += 2, mono_cur++) {
-		uc_buff[mono_cur] = uc_buff[stereo_cur] + 0x80;
-	}
-
-	LEAVE();
-	return (data_len / 2);
+	return convert_8bits_stereo2mono_xor(buff, data_len, 0x80808080);
 }
 
 /*
@@ -1848,53 +2248,172 @@ int convert_8bits_stereo2mono_signed2unsigned(void *buff, int data_len)
  */
 int convert_16bits_stereo2mono(void *buff, int data_len)
 {
-	/* stride = 32 bytes = 2 channels * 2 byte * 8 pipelines */
-	int data_len_32aligned = data_len & ~0x1f;
-	int data_cnt_ushort = data_len_32aligned / 2;
-	int mono_cur, stereo_cur;
-	unsigned short *ushort_buff = (unsigned short *)buff;
+	int words = data_len >> 3;
+	int i;
+	u32 *wbuf = buff;
+	unsigned short *ushort_buff = buff;
+
+	ENTER();
 
-	/* copy 8 times each loop */
-	for (stereo_cur = mono_cur = 0;
-	     stereo_cur < data_cnt_ushort;
-	     stereo_cur += 16, mono_cur += 8) {
+	/* two stereo frames become one word of two mono samples */
+	for (i = 0; i < words; i++) {
+		wbuf[i] = (wbuf[2 * i] & 0xffff) | (wbuf[2 * i + 1] << 16);
+	}
 
-		ushort_buff[mono_cur + 0] = ushort_buff[stereo_cur + 0];
-		ushort_buff[mono_cur + 1] = ushort_buff[stereo_cur + 2];
-		ushort_buff[mono_cur + 2] = ushort_buff[stereo_cur + 4];
-		ushort_buff[mono_cur + 3] = ushort_buff[stereo_cur + 6];
-		ushort_buff[mono_cur + 4] = ushort_buff[stereo_cur + 8];
-		ushort_buff[mono_cur + 5] = ushort_buff[stereo_cur + 10];
-		ushort_buff[mono_cur + 6] = ushort_buff[stereo_cur + 12];
-		ushort_buff[mono_cur + 7] = ushort_buff[stereo_cur + 14];
+	/* remaining frame */
+	for (i = words << 3; i + 4 <= data_len; i += 4) {
+		ushort_buff[i >> 2] = ushort_buff[i >> 1];
 	}
 
-	BUG_ON(stereo_cur != data_cnt_ushort);
+	LEAVE();
+	return (data_len >> 1);
+}
+
+/* Keep the high byte of each sample, flipping the sign bit by xor */
+static inline int convert_16bits_to_8bits_xor(void *buff, int cnt, u32 xor)
+{
+	int words = cnt >> 3;
+	int i;
+	u32 *wbuf = buff;
+	unsigned char *uc_buff = buff;
+
+	/* four samples in two words become one word of four bytes */
+	for (i = 0; i < words; i++) {
+		u32 a = wbuf[2 * i];
+		u32 b = wbuf[2 * i + 1];
+
+		wbuf[i] = (((a >> 8) & 0xff) | ((a >> 16) & 0xff00) |
+			   ((b << 8) & 0xff0000) | (b & 0xff000000)) ^ xor;
+	}
 
 	/* remaining data */
-	for (; stereo_cur < data_cnt_ushort; stereo_cur += 2, mono_cur++) {
-		ushort_buff[mono_cur] = ushort_buff[stereo_cur];
+	for (i = words << 3; i + 2 <= cnt; i += 2) {
+		uc_buff[i >> 1] = uc_buff[i + 1] ^ (unsigned char)xor;
 	}
 
-	LEAVE();
-	return (data_len / 2);
+	return (cnt >> 1);
 }
 
 /*
- * Set convert function for audio_pipe
- *
- * In AIC, we just use signed data for all ops as it is shared by
- * replay and record. So, converting data for every non-compatible
- * format is neccessary.
+ * Convert S16_LE data to S8, cnt is the length of the 16-bit data.
  */
-static inline int endpoint_set_filter(audio_pipe *endpoint, int format, int channels)
+int convert_16bits_to_8bits(void *buff, int cnt)
 {
-	ENTER();
-
-	DPRINT("%s %d, endpoint = 0x%08x, format = %d, channels = %d\n",
-	       __FUNCTION__, __LINE__, (unsigned int)endpoint, format, channels);
+	return convert_16bits_to_8bits_xor(buff, cnt, 0);
+}
 
-	endpoint->filter = NULL;
+/*
+ * Convert S16_LE data to U8, cnt is the length of the 16-bit data.
+ */
+int convert_16bits_to_8bits_unsigned(void *buff, int cnt)
+{
+	return convert_16bits_to_8bits_xor(buff, cnt, 0x80808080);
+}
+
+/* Widen bytes to the high half of 16-bit samples, flipping the sign bit by xor */
+static inline int convert_8bits_to_16bits_xor(void *buff, int cnt, u32 xor)
+{
+	int words = cnt >> 2;
+	int i;
+	u32 *wbuf = buff;
+	unsigned char *uc_buff = buff;
+	unsigned short *ushort_buff = buff;
+
+	/* backwards, the output is twice as long as the input */
+	for (i = cnt - 1; i >= words << 2; i--) {
+		ushort_buff[i] = (unsigned short)(uc_buff[i] ^ (unsigned char)xor) << 8;
+	}
+
+	for (i = words - 1; i >= 0; i--) {
+		u32 v = wbuf[i] ^ xor;
+
+		wbuf[2 * i + 1] = ((v >> 8) & 0xff00) | (v & 0xff000000);
+		wbuf[2 * i] = ((v & 0xff) << 8) | ((v & 0xff00) << 16);
+	}
+
+	return (cnt << 1);
+}
+
+/*
+ * Convert S8 data to S16_LE, buff must hold cnt * 2 bytes.
+ */
+int convert_8bits_to_16bits(void *buff, int cnt)
+{
+	return convert_8bits_to_16bits_xor(buff, cnt, 0);
+}
+
+/*
+ * Convert U8 data to S16_LE, buff must hold cnt * 2 bytes.
+ */
+int convert_8bits_unsigned_to_16bits(void *buff, int cnt)
+{
+	return convert_8bits_to_16bits_xor(buff, cnt, 0x80808080);
+}
+
+/*
+ * Duplicate 16-bit mono samples into stereo frames, buff must hold
+ * cnt * 2 bytes.
+ */
+int convert_16bits_mono2stereo(void *buff, int cnt)
+{
+	int words = cnt >> 2;
+	int i;
+	u32 *wbuf = buff;
+	unsigned short *ushort_buff = buff;
+
+	/* backwards, the output is twice as long as the input */
+	if (cnt & 2) {
+		u32 v = ushort_buff[words << 1];
+
+		wbuf[words << 1] = v | (v << 16);
+	}
+
+	for (i = words - 1; i >= 0; i--) {
+		u32 v = wbuf[i];
+
+		wbuf[2 * i + 1] = (v >> 16) | (v & 0xffff0000);
+		wbuf[2 * i] = (v & 0xffff) | (v << 16);
+	}
+
+	return (cnt & ~1) << 1;
+}
+
+/*
+ * Scale 16-bit stereo frames by a Q8 gain per channel, 0 (mute) to
+ * 256 (unity). Gains never exceed unity, so nothing can overflow.
+ */
+int convert_16bits_volume(void *buff, int cnt, int left, int right)
+{
+	int words = cnt >> 2;
+	int i;
+	u32 *wbuf = buff;
+
+	for (i = 0; i < words; i++) {
+		u32 v = wbuf[i];
+		int l = ((s16)v * left) >> 8;
+		int r = ((s16)(v >> 16) * right) >> 8;
+
+		wbuf[i] = (u16)l | ((u32)(u16)r << 16);
+	}
+
+	return cnt;
+}
+
+/*
+ * Set convert function for audio_pipe
+ *
+ * In AIC, we just use signed data for all ops as it is shared by
+ * replay and record. So, converting data for every non-compatible
+ * format is neccessary.
+ */
+static inline int endpoint_set_filter(audio_pipe *endpoint, int format, int channels)
+{
+	ENTER();
+
+	DPRINT("%s %d, endpoint = 0x%08x, format = %d, channels = %d\n",
+	       __FUNCTION__, __LINE__, (unsigned int)endpoint, format, channels);
+
+	endpoint->filter = NULL;
 
 	switch (format) {
 	case AFMT_U8:
@@ -2030,15 +2549,505 @@ _ERROR_SET_FORMAT:
 	return -1;
 }
 
+/* Hand a filled replay node to the DMA side */
+static inline void endpoint_post_outnode(audio_pipe *endpoint, audio_node *node, size_t count)
+{
+	unsigned long	flags;
+
+	dma_cache_wback_inv((unsigned long)node->pBuf, (unsigned long)count);
+	node->start = 0;
+	node->end = count;
+	audio_ring_pad(endpoint, node);
+
+	AUDIO_LOCK(endpoint->lock, flags);
+	put_audio_usenode(endpoint->mem, node);
+	AUDIO_UNLOCK(endpoint->lock, flags);
+}
+
+/* Start replay, or hand freshly queued nodes to the running ring */
+static inline void endpoint_start_outdma(struct jz_i2s_controller_info *controller, audio_pipe *endpoint)
+{
+	unsigned long	flags;
+	audio_node	*node;
+
+	AUDIO_LOCK(endpoint->lock, flags);
+	if ((endpoint->trans_state & PIPE_TRANS) == 0) {
+		node = get_audio_usenode(endpoint->mem);
+		if (node) {
+			unsigned int start;
+			start = trystart_endpoint_out(controller, node);
+			if (start == 0) {
+				printk("JZ I2S: trystart_endpoint_out error\n");
+			}
+		}
+	} else {
+		audio_ring_feed(endpoint);
+	}
+	AUDIO_UNLOCK(endpoint->lock, flags);
+}
+
+//-------------------------------------------------------------------
+// software mixer, see struct jz_mix_stream
+
+static inline s16 jz_mix_clamp(int v)
+{
+	if (v > 32767) {
+		return 32767;
+	}
+	if (v < -32768) {
+		return -32768;
+	}
+	return v;
+}
+
+/* Codec formats a mixed period can be narrowed to */
+static inline int jz_mix_hw_format(int format)
+{
+	return format == AFMT_S16_LE || format == AFMT_S8 || format == AFMT_U8;
+}
+
+static inline int jz_mix_frame_bytes(struct jz_mix_stream *s)
+{
+	return (s->format == AFMT_S16_LE ? 2 : 1) * s->channels;
+}
+
+/* Frames of one replay period at the codec's format */
+static inline int jz_mix_period_frames(audio_pipe *endpoint, struct i2s_codec *codec)
+{
+	int bytes = (codec->replay_format == AFMT_S16_LE) ? 2 : 1;
+
+	return endpoint->fragsize / (bytes * codec->replay_codec_channel);
+}
+
+static inline unsigned int jz_mix_step(struct jz_mix_stream *s, unsigned int out_rate)
+{
+	u64 step = (u64)s->rate << 16;
+
+	do_div(step, out_rate);
+	return (unsigned int)step;
+}
+
+/* Enough frames queued for a whole period?  Called with mix_lock held */
+static int jz_mix_stream_ready(struct jz_mix_stream *s, unsigned int out_rate, int frames)
+{
+	u64 need;
+
+	if (!s->used || !s->count) {
+		return 0;
+	}
+	need = ((u64)s->phase + (u64)jz_mix_step(s, out_rate) * frames) >> 16;
+	return s->drain || s->count >= need;
+}
+
+/* Resample one stream and sum it into a period, called with mix_lock held */
+static void jz_mix_one(struct jz_mix_stream *s, s16 *out, int frames, int out_ch, unsigned int step)
+{
+	int i;
+
+	for (i = 0; i < frames; i++) {
+		int l, r, f;
+
+		while (s->phase >= 0x10000) {
+			if (!s->count) {
+				return;
+			}
+			s->phase -= 0x10000;
+			s->last = s->next;
+			s->next = s->fifo[s->head];
+			s->head = (s->head + 1) & (JZ_MIX_FIFO_FRAMES - 1);
+			s->count--;
+			mix_queued--;
+		}
+
+		/* 15 bit weight keeps the products inside 32 bits */
+		f = s->phase >> 1;
+		l = (s16)s->last;
+		r = (s16)(s->last >> 16);
+		l += (((s16)s->next - l) * f) >> 15;
+		r += (((s16)(s->next >> 16) - r) * f) >> 15;
+
+		if (out_ch == 2) {
+			out[0] = jz_mix_clamp(out[0] + l);
+			out[1] = jz_mix_clamp(out[1] + r);
+			out += 2;
+		} else {
+			*out = jz_mix_clamp(*out + ((l + r) >> 1));
+			out++;
+		}
+		s->phase += step;
+	}
+}
+
+/* Returns 1 when a free node exists and the DMA is short of data */
+static int jz_mix_ready(void)
+{
+	struct jz_i2s_controller_info *controller = the_i2s_controller;
+	audio_pipe *endpoint = &out_endpoint;
+	unsigned long flags;
+	unsigned int rate;
+	int frames, i;
+	int ready = 0;
+
+	if (!mix_queued || !controller || !controller->pout_endpoint) {
+		return 0;
+	}
+
+	AUDIO_LOCK(endpoint->lock, flags);
+	if (get_audio_freenodecount(endpoint->mem) &&
+	    get_audio_usenodecount(endpoint->mem) + endpoint->ring_queued < JZ_MIX_AHEAD) {
+		ready = 1;
+	}
+	AUDIO_UNLOCK(endpoint->lock, flags);
+	if (!ready) {
+		return 0;
+	}
+
+	rate = controller->i2s_codec->replay_audio_rate;
+	frames = jz_mix_period_frames(endpoint, controller->i2s_codec);
+
+	ready = 0;
+	spin_lock(&mix_lock);
+	for (i = 0; i < JZ_MIX_STREAMS; i++) {
+		if (jz_mix_stream_ready(&mix_streams[i], rate, frames)) {
+			ready = 1;
+			break;
+		}
+	}
+	spin_unlock(&mix_lock);
+
+	return ready;
+}
+
+/* Sum the streams in mask into out, called with mix_lock held */
+static void jz_mix_render(s16 *out, int frames, int out_ch, unsigned int rate, unsigned int mask)
+{
+	int i;
+
+	for (i = 0; i < JZ_MIX_STREAMS; i++) {
+		struct jz_mix_stream *s = &mix_streams[i];
+
+		if ((mask & (1 << i)) && s->used) {
+			jz_mix_one(s, out, frames, out_ch, jz_mix_step(s, rate));
+		}
+	}
+}
+
+/* Render one period from every ready stream and queue it for replay */
+static void jz_mix_period(void)
+{
+	struct jz_i2s_controller_info *controller = the_i2s_controller;
+	struct i2s_codec *codec = controller->i2s_codec;
+	audio_pipe *endpoint = controller->pout_endpoint;
+	audio_node *node;
+	unsigned long flags;
+	unsigned int rate, mask = 0;
+	int frames, out_ch, i;
+
+	AUDIO_LOCK(endpoint->lock, flags);
+	node = get_audio_freenode(endpoint->mem);
+	AUDIO_UNLOCK(endpoint->lock, flags);
+	if (!node) {
+		return;
+	}
+
+	rate = codec->replay_audio_rate;
+	out_ch = codec->replay_codec_channel;
+	frames = jz_mix_period_frames(endpoint, codec);
+
+	spin_lock(&mix_lock);
+	for (i = 0; i < JZ_MIX_STREAMS; i++) {
+		if (jz_mix_stream_ready(&mix_streams[i], rate, frames)) {
+			mask |= 1 << i;
+		}
+	}
+	spin_unlock(&mix_lock);
+
+	if (codec->replay_format == AFMT_S16_LE) {
+		memset((void *)node->pBuf, 0, endpoint->fragsize);
+		spin_lock(&mix_lock);
+		jz_mix_render((s16 *)node->pBuf, frames, out_ch, rate, mask);
+		spin_unlock(&mix_lock);
+	} else {
+		/* an 8-bit codec: mix a chunk at a time and narrow it into the node */
+		unsigned char *dst = (unsigned char *)node->pBuf;
+		int done, n, len;
+
+		for (done = 0; done < frames; done += n) {
+			n = min_t(int, frames - done, ARRAY_SIZE(mix_chunk) / out_ch);
+			len = n * out_ch * 2;
+			memset(mix_chunk, 0, len);
+			spin_lock(&mix_lock);
+			jz_mix_render(mix_chunk, n, out_ch, rate, mask);
+			spin_unlock(&mix_lock);
+			if (codec->replay_format == AFMT_S8) {
+				len = convert_16bits_to_8bits(mix_chunk, len);
+			} else {
+				len = convert_16bits_to_8bits_unsigned(mix_chunk, len);
+			}
+			memcpy(dst, mix_chunk, len);
+			dst += len;
+		}
+	}
+
+	for (i = 0; i < JZ_MIX_STREAMS; i++) {
+		if (mask & (1 << i)) {
+			wake_up_interruptible(&mix_streams[i].wait);
+		}
+	}
+
+	endpoint_post_outnode(endpoint, node, endpoint->fragsize);
+	endpoint_start_outdma(controller, endpoint);
+}
+
+static int jz_mix_thread(void *data)
+{
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(mix_wait, kthread_should_stop() || jz_mix_ready());
+		while (!kthread_should_stop() && jz_mix_ready()) {
+			jz_mix_period();
+		}
+	}
+	return 0;
+}
+
+static struct jz_mix_stream *jz_mix_open(int rate, int channels, int format)
+{
+	struct jz_mix_stream *s = NULL;
+	u32 *fifo;
+	int i;
+
+	if (!mix_thread) {
+		return NULL;
+	}
+
+	fifo = kmalloc(JZ_MIX_FIFO_FRAMES * sizeof(u32), GFP_KERNEL);
+	if (!fifo) {
+		return NULL;
+	}
+
+	spin_lock(&mix_lock);
+	for (i = 0; i < JZ_MIX_STREAMS; i++) {
+		if (!mix_streams[i].used) {
+			s = &mix_streams[i];
+			break;
+		}
+	}
+	if (s) {
+		s->used = 1;
+		s->drain = 0;
+		s->rate = rate;
+		s->channels = channels;
+		s->format = jz_mix_hw_format(format) ? format : AFMT_S16_LE;
+		s->volume = 100 | (100 << 8);
+		s->phase = 0x10000;
+		s->last = 0;
+		s->next = 0;
+		s->fifo = fifo;
+		s->head = 0;
+		s->count = 0;
+		init_waitqueue_head(&s->wait);
+		mix_users++;
+	}
+	spin_unlock(&mix_lock);
+
+	if (!s) {
+		kfree(fifo);
+	}
+	return s;
+}
+
+/* Play out what is queued, then drop the stream. Returns streams left */
+static int jz_mix_close(struct jz_mix_stream *s)
+{
+	u32 *fifo;
+	int left;
+
+	s->drain = 1;
+	wake_up_interruptible(&mix_wait);
+	wait_event_timeout(s->wait, s->count == 0, HZ);
+
+	spin_lock(&mix_lock);
+	mix_queued -= s->count;
+	s->count = 0;
+	s->used = 0;
+	fifo = s->fifo;
+	s->fifo = NULL;
+	left = --mix_users;
+	spin_unlock(&mix_lock);
+
+	kfree(fifo);
+	return left;
+}
+
+/*
+ * A lone stream in the codec's own format bypasses the mixer, and so
+ * does one on a codec format the mixer cannot produce.
+ */
+static inline int jz_mix_direct(struct jz_mix_stream *s)
+{
+	struct i2s_codec *codec = the_i2s_controller->i2s_codec;
+
+	if (mix_users != 1 || s->count) {
+		return 0;
+	}
+	if (!jz_mix_hw_format(codec->replay_format)) {
+		return 1;
+	}
+	return s->rate == codec->replay_audio_rate &&
+		s->channels == codec->replay_codec_channel &&
+		s->format == codec->replay_format &&
+		s->volume == (100 | (100 << 8));
+}
+
+static int jz_mix_set_rate(struct jz_mix_stream *s, int rate)
+{
+
+	if (rate < 4000) {
+		rate = 4000;
+	}
+	if (rate > 96000) {
+		rate = 96000;
+	}
+	spin_lock(&mix_lock);
+	s->rate = rate;
+	spin_unlock(&mix_lock);
+	return rate;
+}
+
+static int jz_mix_set_channels(struct jz_mix_stream *s, int channels)
+{
+	s->channels = (channels == 1) ? 1 : 2;
+	return s->channels;
+}
+
+static int jz_mix_set_format(struct jz_mix_stream *s, int format)
+{
+	s->format = jz_mix_hw_format(format) ? format : AFMT_S16_LE;
+	return s->format;
+}
+
+/* SNDCTL_DSP_SETPLAYVOL: left | right << 8, each 0 - 100 */
+static int jz_mix_set_volume(struct jz_mix_stream *s, int volume)
+{
+	int left = min_t(int, volume & 0xff, 100);
+	int right = min_t(int, (volume >> 8) & 0xff, 100);
+
+	s->volume = left | (right << 8);
+	return s->volume;
+}
+
+/*
+ * Turn len bytes of the stream's own format into S16 stereo frames in
+ * place, buf must hold four times len. Returns the frame bytes.
+ */
+static int jz_mix_filter(struct jz_mix_stream *s, void *buf, int len)
+{
+	int left = s->volume & 0xff;
+	int right = (s->volume >> 8) & 0xff;
+
+	if (s->format == AFMT_S8) {
+		len = convert_8bits_to_16bits(buf, len);
+	} else if (s->format == AFMT_U8) {
+		len = convert_8bits_unsigned_to_16bits(buf, len);
+	}
+	if (s->channels == 1) {
+		len = convert_16bits_mono2stereo(buf, len);
+	}
+	if (left != 100 || right != 100) {
+		convert_16bits_volume(buf, len, (left << 8) / 100, (right << 8) / 100);
+	}
+	return len;
+}
+
+/* Wait until the mixer has consumed everything queued on a stream */
+static void jz_mix_sync(struct jz_mix_stream *s)
+{
+	s->drain = 1;
+	wake_up_interruptible(&mix_wait);
+	wait_event_interruptible(s->wait, s->count == 0);
+	s->drain = 0;
+}
+
+static void jz_mix_getospace(struct jz_mix_stream *s, audio_buf_info *info)
+{
+	int frame_bytes = jz_mix_frame_bytes(s);
+
+	info->fragsize = out_endpoint.fragsize;
+	info->fragstotal = JZ_MIX_FIFO_FRAMES * frame_bytes / info->fragsize;
+	info->bytes = (JZ_MIX_FIFO_FRAMES - s->count) * frame_bytes;
+	info->fragments = info->bytes / info->fragsize;
+}
+
+/* write() for a stream that goes through the mixer */
+static ssize_t jz_mix_write(struct file *file, struct jz_mix_stream *s,
+			    const char __user *buffer, size_t count)
+{
+	int frame_bytes = jz_mix_frame_bytes(s);
+	u32 tmp[128];	/* one S16 stereo frame per word once filtered */
+	size_t done = 0;
+
+	count -= count % frame_bytes;
+	while (done < count) {
+		unsigned int room, tail, first;
+		int n;
+
+		spin_lock(&mix_lock);
+		room = JZ_MIX_FIFO_FRAMES - s->count;
+		spin_unlock(&mix_lock);
+
+		if (!room) {
+			if (file->f_flags & O_NONBLOCK) {
+				break;
+			}
+			wake_up_interruptible(&mix_wait);
+			if (wait_event_interruptible(s->wait, s->count < JZ_MIX_FIFO_FRAMES)) {
+				return done ? done : -ERESTARTSYS;
+			}
+			continue;
+		}
+
+		n = ARRAY_SIZE(tmp);
+		n = min_t(int, n, room);
+		n = min_t(int, n, (count - done) / frame_bytes);
+		if (copy_from_user(tmp, buffer + done, n * frame_bytes)) {
+			return done ? done : -EFAULT;
+		}
+		jz_mix_filter(s, tmp, n * frame_bytes);
+
+		spin_lock(&mix_lock);
+		tail = (s->head + s->count) & (JZ_MIX_FIFO_FRAMES - 1);
+		first = min_t(unsigned int, n, JZ_MIX_FIFO_FRAMES - tail);
+		memcpy(s->fifo + tail, tmp, first * sizeof(u32));
+		memcpy(s->fifo, tmp + first, (n - first) * sizeof(u32));
+		s->count += n;
+		mix_queued += n;
+		spin_unlock(&mix_lock);
+
+		done += n * frame_bytes;
+	}
+
+	wake_up_interruptible(&mix_wait);
+	if (!done && count) {
+		return -EAGAIN;
+	}
+	return done;
+}
+
 static int jz_audio_release(struct inode *inode, struct file *file)
 {
-	struct jz_i2s_controller_info *controller = (struct jz_i2s_controller_info *) file->private_data;
+	struct jz_i2s_controller_info *controller = the_i2s_controller;
+	struct jz_mix_stream *stream = file->private_data;
 	int mode = 0;
 	int codec_closed = 0;
 
 
 	ENTER();
 
+	/* Other writers are still mixing, leave the hardware alone */
+	if (stream && jz_mix_close(stream)) {
+		return 0;
+	}
+
 	if (controller == NULL) {
 		printk("\nAudio device not ready!\n");
 		return -ENODEV;
@@ -2072,6 +3081,16 @@ static int jz_audio_release(struct inode *inode, struct file *file)
 		filp_close(f_test, NULL);
 #endif
 		mode |= CODEC_WMODE;
+		if (controller->pout_endpoint->ring_mmap) {
+			unsigned long flags;
+
+			AUDIO_LOCK(controller->pout_endpoint->lock, flags);
+			if (controller->pout_endpoint->trans_state & PIPE_TRANS) {
+				audio_ring_halt(controller->pout_endpoint);
+			}
+			controller->pout_endpoint->ring_mmap = 0;
+			AUDIO_UNLOCK(controller->pout_endpoint->lock, flags);
+		}
 		audio_close_endpoint(controller->pout_endpoint, NOMAL_STOP);
 		controller->pout_endpoint = NULL;
 
@@ -2122,6 +3141,14 @@ static int jz_audio_open(struct inode *inode, struct file *file)
 		return -EBUSY;
 	}
 	if ((file->f_mode & FMODE_WRITE) && (controller->pout_endpoint)) {
+		/* Another writer joins through the mixer, the codec keeps running */
+		if (mix_users && !out_endpoint.ring_mmap &&
+		    jz_mix_hw_format(codec->replay_format)) {
+			file->private_data = jz_mix_open(44100, 2, AFMT_S16_LE);
+			if (file->private_data) {
+				return 0;
+			}
+		}
 		printk("\nmedive Audio write device is busy!\n");
 		return -EBUSY;
 	}
@@ -2136,7 +3163,7 @@ static int jz_audio_open(struct inode *inode, struct file *file)
 		controller->pin_endpoint->is_non_block = file->f_flags & O_NONBLOCK;
 		mode |= CODEC_RMODE;
 	}
-   	file->private_data = controller;
+   	file->private_data = NULL;
 
 	/* we should turn codec and anti-pop first */
 	jz_codec_anti_pop(controller->i2s_codec, mode);
@@ -2171,6 +3198,12 @@ static int jz_audio_open(struct inode *inode, struct file *file)
 		jz_codec_set_format(codec, 16, CODEC_WMODE);
 		jz_codec_set_speed(codec, 44100, CODEC_WMODE);
 		set_controller_triger(controller, &out_endpoint, codec->replay_codec_channel, codec->replay_format);
+
+		/* Without a stream the opener just keeps the old exclusive behaviour */
+		if (!(mode & CODEC_RMODE)) {
+			file->private_data = jz_mix_open(codec->replay_audio_rate,
+							 codec->replay_codec_channel, codec->replay_format);
+		}
 	}
 
 	DPRINT_IOC("============ default_codec record ===============\n"
@@ -2227,8 +3260,7 @@ int jz_audio_open_for_fm(void) {
 	jz_codec_set_speed(codec, 44100, fm_file.f_mode);
 
 	{
-		struct jz_i2s_controller_info *controller =
-			(struct jz_i2s_controller_info *) fm_file.private_data;
+		struct jz_i2s_controller_info *controller = the_i2s_controller;
 		audio_pipe	*pin_endpoint = controller->pin_endpoint;
 		audio_pipe	*pout_endpoint = controller->pout_endpoint;
 
@@ -2255,10 +3287,12 @@ static int jz_audio_ioctl(struct inode *inode, struct file *file, unsigned int c
 	int	val = 0;
 	int	mode = 0;
 
-	struct jz_i2s_controller_info *controller = (struct jz_i2s_controller_info *) file->private_data;
+	struct jz_i2s_controller_info *controller = the_i2s_controller;
 	struct i2s_codec *codec = controller->i2s_codec;
 	audio_pipe	*pin_endpoint = controller->pin_endpoint;
 	audio_pipe	*pout_endpoint = controller->pout_endpoint;
+	/* only set for write-only openers, see jz_mix_open() */
+	struct jz_mix_stream *stream = file->private_data;
 
 	ENTER();
 
@@ -2284,6 +3318,9 @@ static int jz_audio_ioctl(struct inode *inode, struct file *file, unsigned int c
 
 	case SNDCTL_DSP_SYNC:
 		if (mode & CODEC_WMODE) {
+			if (stream) {
+				jz_mix_sync(stream);
+			}
 			if (pout_endpoint) {
 				audio_sync_endpoint(pout_endpoint);
 			}
@@ -2296,6 +3333,12 @@ static int jz_audio_ioctl(struct inode *inode, struct file *file, unsigned int c
 		if (get_user(val, (int *)arg)) {
 			rc = -EFAULT;
 		}
+		if (stream && mix_users > 1) {
+			/* mixing, the codec rate belongs to nobody */
+			val = jz_mix_set_rate(stream, val);
+			rc = put_user(val, (int *)arg);
+			break;
+		}
 #if 1
 		if (is_external_codec){
 			unsigned int systemclk = 0;
@@ -2312,6 +3355,9 @@ static int jz_audio_ioctl(struct inode *inode, struct file *file, unsigned int c
 
 		//printk("SNDCTL_DSP_SPEED ... set to %d\n", val);
 		val = jz_codec_set_speed(codec, val, mode);
+		if (stream) {
+			jz_mix_set_rate(stream, codec->replay_audio_rate);
+		}
 		rc = put_user(val, (int *)arg);
 		break;
 
@@ -2321,7 +3367,16 @@ static int jz_audio_ioctl(struct inode *inode, struct file *file, unsigned int c
 		    rc = -EFAULT;
 		}
 
+		if (stream && mix_users > 1) {
+			jz_mix_set_channels(stream, val ? 2 : 1);
+			rc = 1;
+			break;
+		}
+
 		jz_codec_set_channels(controller->i2s_codec, val ? 2 : 1, mode);
+		if (stream) {
+			jz_mix_set_channels(stream, codec->replay_codec_channel);
+		}
 
 		if (mode & CODEC_RMODE) {
 			set_controller_triger(controller, pin_endpoint,
@@ -2363,6 +3418,15 @@ static int jz_audio_ioctl(struct inode *inode, struct file *file, unsigned int c
 
 //		printk("\nSNDCTL_DSP_SETFMT ... set to %d\n", val);
 
+		if (stream && mix_users > 1) {
+			/* the codec stays as it is, write() converts */
+			if (val != AFMT_QUERY) {
+				jz_mix_set_format(stream, val);
+			}
+			rc = put_user(stream->format, (int *)arg);
+			break;
+		}
+
 		if (val == AFMT_QUERY) {
 			if (mode & CODEC_RMODE) {
 				val = codec->record_format;
@@ -2371,6 +3435,9 @@ static int jz_audio_ioctl(struct inode *inode, struct file *file, unsigned int c
 			}
 		} else {
 			val = jz_codec_set_format(codec, val, mode);
+			if (stream) {
+				jz_mix_set_format(stream, codec->replay_format);
+			}
 			if (mode & CODEC_RMODE) {
 				if (codec->user_need_mono) {
 					endpoint_set_filter(pin_endpoint, val, 1);
@@ -2396,6 +3463,12 @@ static int jz_audio_ioctl(struct inode *inode, struct file *file, unsigned int c
 		}
 		//printk("\nSNDCTL_DSP_CHANNELS ... set to %d\n", val);
 
+		if (stream && mix_users > 1) {
+			val = jz_mix_set_channels(stream, val);
+			rc = put_user(val, (int *)arg);
+			break;
+		}
+
 		/* if mono, change to 2, and set 1 to codec->user_need_mono */
 		if (mode & CODEC_RMODE) {
 			if (val == 1) {
@@ -2409,6 +3482,9 @@ static int jz_audio_ioctl(struct inode *inode, struct file *file, unsigned int c
 
 		/* Following lines could be marked as nothing will be changed */
 		jz_codec_set_channels(codec, val, mode);
+		if (stream) {
+			jz_mix_set_channels(stream, codec->replay_codec_channel);
+		}
 
 		if (mode & CODEC_RMODE) {
 			/* Set filter according to channel count */
@@ -2446,8 +3522,8 @@ static int jz_audio_ioctl(struct inode *inode, struct file *file, unsigned int c
 		if (rc != -EINVAL) {
 			int newfragsize, newfragstotal;
 			newfragsize = 1 << (val & 0xFFFF);
-			if (newfragsize < 4 * PAGE_SIZE) {
-				newfragsize = 4 * PAGE_SIZE;
+			if (newfragsize < AUDIO_MIN_FRAGSIZE) {
+				newfragsize = AUDIO_MIN_FRAGSIZE;
 			}
 			if (newfragsize > (16 * PAGE_SIZE)) {
 				newfragsize = 16 * PAGE_SIZE;
@@ -2468,6 +3544,11 @@ static int jz_audio_ioctl(struct inode *inode, struct file *file, unsigned int c
 				}
 			}
 			if (mode & CODEC_WMODE) {
+				/* The mapping covers the old geometry, the mixer renders it */
+				if (controller->pout_endpoint->ring_mapped || mix_users > 1) {
+					rc = -EBUSY;
+					break;
+				}
 				rc = audio_resizemem_endpoint(controller->pout_endpoint, newfragsize, newfragstotal);
 				if (!rc) {
 					rc = -EINVAL;
@@ -2477,7 +3558,7 @@ static int jz_audio_ioctl(struct inode *inode, struct file *file, unsigned int c
 		break;
 
 	case SNDCTL_DSP_GETCAPS:
-		rc = put_user(DSP_CAP_REALTIME | DSP_CAP_BATCH, (int *)arg);
+		rc = put_user(DSP_CAP_REALTIME | DSP_CAP_BATCH | DSP_CAP_TRIGGER | DSP_CAP_MMAP, (int *)arg);
 		break;
 
 	case SNDCTL_DSP_NONBLOCK:
@@ -2495,11 +3576,31 @@ static int jz_audio_ioctl(struct inode *inode, struct file *file, unsigned int c
 		if (!(mode & CODEC_WMODE)) {
 			return -EINVAL;
 		}
-		audio_get_endpoint_freesize(pout_endpoint, &abinfo);
+		if (stream && !jz_mix_direct(stream)) {
+			jz_mix_getospace(stream, &abinfo);
+		} else {
+			audio_get_endpoint_freesize(pout_endpoint, &abinfo);
+		}
 		rc = copy_to_user((void *)arg, &abinfo, sizeof(abinfo)) ? -EFAULT : 0;
 		break;
 	}
 
+	case SNDCTL_DSP_GETPLAYVOL:
+		rc = put_user(stream ? stream->volume : 100 | (100 << 8), (int *)arg);
+		break;
+
+	case SNDCTL_DSP_SETPLAYVOL:
+		if (!stream) {
+			rc = -EINVAL;
+			break;
+		}
+		if (get_user(val, (int *)arg)) {
+			rc = -EFAULT;
+			break;
+		}
+		rc = put_user(jz_mix_set_volume(stream, val), (int *)arg);
+		break;
+
 	case SNDCTL_DSP_GETISPACE:
 	{
 		audio_buf_info abinfo;
@@ -2526,6 +3627,25 @@ static int jz_audio_ioctl(struct inode *inode, struct file *file, unsigned int c
 	case SNDCTL_DSP_SETTRIGGER:
 		if (get_user(val, (int *)arg)) {
 			rc = -EFAULT;
+			break;
+		}
+		rc = 0;
+		/* Enabling output on a mapped buffer switches replay to mmap mode */
+		if ((mode & CODEC_WMODE) && pout_endpoint && pout_endpoint->ring_mapped && mix_users <= 1) {
+			unsigned long flags;
+
+			AUDIO_LOCK(pout_endpoint->lock, flags);
+			if ((val & PCM_ENABLE_OUTPUT) && !(pout_endpoint->trans_state & PIPE_TRANS)) {
+				pout_endpoint->ring_mmap = 1;
+				if (trystart_endpoint_out(controller, NULL) == 0) {
+					pout_endpoint->ring_mmap = 0;
+					rc = -EBUSY;
+				}
+			} else if (!(val & PCM_ENABLE_OUTPUT) && pout_endpoint->ring_mmap) {
+				audio_ring_halt(pout_endpoint);
+				pout_endpoint->ring_mmap = 0;
+			}
+			AUDIO_UNLOCK(pout_endpoint->lock, flags);
 		}
 		break;
 
@@ -2542,19 +3662,25 @@ static int jz_audio_ioctl(struct inode *inode, struct file *file, unsigned int c
 	case SNDCTL_DSP_GETOPTR:
 	{
 		count_info cinfo;
-		if (!(mode & CODEC_WMODE)) {
+		if (!(mode & CODEC_WMODE) || !pout_endpoint) {
 			rc = -EINVAL;
+			break;
 		}
-		rc = copy_to_user((void *) arg, &cinfo, sizeof(cinfo));
+		audio_ring_getptr(pout_endpoint, &cinfo);
+		rc = copy_to_user((void *) arg, &cinfo, sizeof(cinfo)) ? -EFAULT : 0;
 		break;
 	}
 
 	case SNDCTL_DSP_GETODELAY:
 	{
-		// fix me !!!
-		int unfinish = 0;
-		if (!(mode & CODEC_WMODE)) {
+		int unfinish;
+		if (!(mode & CODEC_WMODE) || !pout_endpoint) {
 			rc = -EINVAL;
+			break;
+		}
+		unfinish = audio_ring_delay(pout_endpoint);
+		if (stream) {
+			unfinish += stream->count * jz_mix_frame_bytes(stream);
 		}
 		rc = put_user(unfinish, (int *) arg);
 		break;
@@ -2721,32 +3847,26 @@ static inline int endpoint_put_userdata(audio_pipe *endpoint, const char __user
 		printk("JZ I2S: copy_from_user failed !\n");
 		return -EFAULT;
 	}
-	dma_cache_wback_inv((unsigned long)node->pBuf,(unsigned long)count);
-	node->start = 0;
-	node->end = count;
-
 #if DEBUG_WRMODE
 	old_fs = get_fs();
 	set_fs(KERNEL_DS);
 
-	vfs_write(f_test, (void *)(node->pBuf + node->start),
-		  node->end - node->start, &f_test_offset);
+	vfs_write(f_test, (void *)node->pBuf, count, &f_test_offset);
 
 	set_fs(old_fs);
 #endif
 
-	AUDIO_LOCK(endpoint->lock, flags);
-	put_audio_usenode(endpoint->mem, node);
-	AUDIO_UNLOCK(endpoint->lock, flags);
+	endpoint_post_outnode(endpoint, node, count);
 
 	LEAVE();
 
 	return count;
 }
 
-static ssize_t jz_audio_write(struct file *file, const char __user *buffer, size_t count, loff_t *ppos)
+static ssize_t jz_audio_write_data(struct file *file, const char __user *buffer, size_t count, loff_t *ppos)
 {
-	struct jz_i2s_controller_info *controller = (struct jz_i2s_controller_info *)file->private_data;
+	struct jz_i2s_controller_info *controller = the_i2s_controller;
+	struct jz_mix_stream *stream = file->private_data;
 	audio_pipe *pout_endpoint = controller->pout_endpoint;
 	struct i2s_codec *codec = (struct i2s_codec *)controller->i2s_codec;
 	size_t	usecount = 0;
@@ -2765,6 +3885,15 @@ static ssize_t jz_audio_write(struct file *file, const char __user *buffer, size
 
 	//medive change
 	pout_endpoint->is_non_block = file->f_flags & O_NONBLOCK;
+
+	/* The application owns the ring in mmap mode */
+	if (pout_endpoint->ring_mmap) {
+		return -EBUSY;
+	}
+
+	if (stream && !jz_mix_direct(stream)) {
+		return jz_mix_write(file, stream, buffer, count);
+	}
 #if 0
 
 	while (count >= pout_endpoint->fragsize) {
@@ -2821,20 +3950,7 @@ static ssize_t jz_audio_write(struct file *file, const char __user *buffer, size
 
 	// Handle prepared data.
 	if (usecount > 0) {
-		unsigned long	flags;
-		audio_node	*node;
-		AUDIO_LOCK(pout_endpoint->lock, flags);
-		if ((pout_endpoint->trans_state & PIPE_TRANS) == 0) {
-			node = get_audio_usenode(pout_endpoint->mem);
-			if (node) {
-				unsigned int start;
-				start = trystart_endpoint_out(controller, node);
-				if (start == 0) {
-					printk("JZ I2S: trystart_endpoint_out error\n");
-				}
-			}
-		}
-		AUDIO_UNLOCK(pout_endpoint->lock, flags);
+		endpoint_start_outdma(controller, pout_endpoint);
 	}
 
 	DPRINT("----write data usecount = %d, count = %d\n", usecount, count);
@@ -2884,20 +4000,7 @@ static ssize_t jz_audio_write(struct file *file, const char __user *buffer, size
 
 	// Handle prepared data.
 	if (usecount > 0) {
-		unsigned long	flags;
-		audio_node	*node;
-		AUDIO_LOCK(pout_endpoint->lock, flags);
-		if ((pout_endpoint->trans_state & PIPE_TRANS) == 0) {
-			node = get_audio_usenode(pout_endpoint->mem);
-			if (node) {
-				unsigned int start;
-				start = trystart_endpoint_out(controller, node);
-				if (start == 0) {
-					printk("JZ I2S: trystart_endpoint_out error\n");
-				}
-			}
-		}
-		AUDIO_UNLOCK(pout_endpoint->lock, flags);
+		endpoint_start_outdma(controller, pout_endpoint);
 	}
 
 	DPRINT("----write data usecount = %d, count = %d\n", usecount, count);
@@ -2910,6 +4013,26 @@ static ssize_t jz_audio_write(struct file *file, const char __user *buffer, size
 
 }
 
+static ssize_t jz_audio_write(struct file *file, const char __user *buffer, size_t count, loff_t *ppos)
+{
+	audio_pipe *endpoint = the_i2s_controller->pout_endpoint;
+	unsigned long flags;
+	ssize_t ret;
+
+	/* A dry ring is an underrun while a writer is in here */
+	AUDIO_LOCK(endpoint->lock, flags);
+	endpoint->writers++;
+	AUDIO_UNLOCK(endpoint->lock, flags);
+
+	ret = jz_audio_write_data(file, buffer, count, ppos);
+
+	AUDIO_LOCK(endpoint->lock, flags);
+	endpoint->writers--;
+	AUDIO_UNLOCK(endpoint->lock, flags);
+
+	return ret;
+}
+
 /**
  *  Copy recorded sound data from 'use' link list to userspace
  */
@@ -3029,7 +4152,7 @@ static inline int endpoint_get_userdata(audio_pipe *endpoint, const char __user
 
 static ssize_t jz_audio_read(struct file *file, char __user *buffer, size_t count, loff_t *ppos)
 {
-	struct jz_i2s_controller_info *controller = (struct jz_i2s_controller_info *)file->private_data;
+	struct jz_i2s_controller_info *controller = the_i2s_controller;
 	audio_pipe	*pin_endpoint = controller->pin_endpoint;
 	audio_node	*node;
 	unsigned long	flags;
@@ -3106,6 +4229,123 @@ static ssize_t jz_audio_read(struct file *file, char __user *buffer, size_t coun
 	return usecount;
 }
 
+static void jz_audio_vma_open(struct vm_area_struct *vma)
+{
+	audio_pipe *endpoint = vma->vm_private_data;
+	unsigned long flags;
+
+	AUDIO_LOCK(endpoint->lock, flags);
+	endpoint->ring_mapped++;
+	AUDIO_UNLOCK(endpoint->lock, flags);
+}
+
+/* The last munmap() ends mmap mode, nobody can feed the ring any more */
+static void jz_audio_vma_close(struct vm_area_struct *vma)
+{
+	audio_pipe *endpoint = vma->vm_private_data;
+	unsigned long flags;
+
+	AUDIO_LOCK(endpoint->lock, flags);
+	if (--endpoint->ring_mapped == 0 && endpoint->ring_mmap) {
+		if (endpoint->trans_state & PIPE_TRANS) {
+			audio_ring_halt(endpoint);
+		}
+		endpoint->ring_mmap = 0;
+	}
+	AUDIO_UNLOCK(endpoint->lock, flags);
+}
+
+static struct vm_operations_struct jz_audio_vm_ops = {
+	.open	= jz_audio_vma_open,
+	.close	= jz_audio_vma_close,
+};
+
+/*
+ * Map the replay fragments for the OSS mmap protocol, see
+ * SNDCTL_DSP_SETTRIGGER. The DMAC reads the buffer behind the
+ * application's back, so stores must reach memory without a cache flush.
+ */
+static int jz_audio_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct jz_i2s_controller_info *controller = the_i2s_controller;
+	audio_pipe *endpoint = controller->pout_endpoint;
+	unsigned long start, off, len;
+
+	if (!(file->f_mode & FMODE_WRITE) || !endpoint) {
+		return -EINVAL;
+	}
+
+	off = vma->vm_pgoff << PAGE_SHIFT;
+	start = virt_to_phys((void *)get_audio_fragmem(endpoint->mem));
+	len = PAGE_ALIGN(endpoint->fragstotal * endpoint->fragsize);
+	if ((vma->vm_end - vma->vm_start + off) > len) {
+		return -EINVAL;
+	}
+	off += start;
+
+	vma->vm_pgoff = off >> PAGE_SHIFT;
+	vma->vm_flags |= VM_IO;
+	pgprot_val(vma->vm_page_prot) &= ~_CACHE_MASK;
+	pgprot_val(vma->vm_page_prot) |= _CACHE_UNCACHED_ACCELERATED;
+
+	if (io_remap_pfn_range(vma, vma->vm_start, off >> PAGE_SHIFT,
+			       vma->vm_end - vma->vm_start, vma->vm_page_prot)) {
+		return -EAGAIN;
+	}
+
+	vma->vm_ops = &jz_audio_vm_ops;
+	vma->vm_private_data = endpoint;
+	jz_audio_vma_open(vma);
+	return 0;
+}
+
+static unsigned int jz_audio_poll(struct file *file, struct poll_table_struct *wait)
+{
+	struct jz_i2s_controller_info *controller = the_i2s_controller;
+	struct jz_mix_stream *stream = file->private_data;
+	audio_pipe *endpoint;
+	unsigned long flags;
+	unsigned int mask = 0;
+
+	if (controller == NULL) {
+		return POLLERR;
+	}
+
+	endpoint = controller->pout_endpoint;
+	if ((file->f_mode & FMODE_WRITE) && endpoint) {
+		poll_wait(file, &endpoint->q_full, wait);
+		if (stream) {
+			poll_wait(file, &stream->wait, wait);
+		}
+		AUDIO_LOCK(endpoint->lock, flags);
+		if (endpoint->ring_mmap) {
+			/* a period has been played since the last GETOPTR */
+			if (endpoint->ring_periods != endpoint->ring_reported) {
+				mask |= POLLOUT | POLLWRNORM;
+			}
+		} else if (stream && !jz_mix_direct(stream)) {
+			if (stream->count < JZ_MIX_FIFO_FRAMES) {
+				mask |= POLLOUT | POLLWRNORM;
+			}
+		} else if (get_audio_freenodecount(endpoint->mem)) {
+			mask |= POLLOUT | POLLWRNORM;
+		}
+		AUDIO_UNLOCK(endpoint->lock, flags);
+	}
+
+	endpoint = controller->pin_endpoint;
+	if ((file->f_mode & FMODE_READ) && endpoint) {
+		poll_wait(file, &endpoint->q_full, wait);
+		AUDIO_LOCK(endpoint->lock, flags);
+		if (!is_null_use_audio_node(endpoint->mem)) {
+			mask |= POLLIN | POLLRDNORM;
+		}
+		AUDIO_UNLOCK(endpoint->lock, flags);
+	}
+
+	return mask;
+}
+
 /* static struct file_operations jz_i2s_audio_fops */
 static struct file_operations jz_i2s_audio_fops = {
 	owner:		THIS_MODULE,
@@ -3113,7 +4353,9 @@ static struct file_operations jz_i2s_audio_fops = {
 	release:	jz_audio_release,
 	write:		jz_audio_write,
 	read:		jz_audio_read,
-	ioctl:		jz_audio_ioctl
+	ioctl:		jz_audio_ioctl,
+	mmap:		jz_audio_mmap,
+	poll:		jz_audio_poll
 };
 
 static void __init attach_jz_i2s(struct jz_i2s_controller_info *controller)
@@ -3276,6 +4518,12 @@ static int __init init_jz_i2s(struct platform_device *pdev)
 	audio_init_endpoint(&out_endpoint, fragsize, fragstotal);
 	audio_init_endpoint(&in_endpoint, fragsize, fragstotal);
 
+	mix_thread = kthread_run(jz_mix_thread, NULL, "kjzmix");
+	if (IS_ERR(mix_thread)) {
+		printk("JZ I2S: can't start the mixer thread, one writer only\n");
+		mix_thread = NULL;
+	}
+
 	printk("JZ I2S OSS audio driver initialized\n");
 
 	LEAVE();
@@ -3286,6 +4534,9 @@ static int __init init_jz_i2s(struct platform_device *pdev)
 static void __exit cleanup_jz_i2s(void)
 {
 	struct i2s_codec *default_codec = &the_codecs[0];
+	if (mix_thread) {
+		kthread_stop(mix_thread);
+	}
 	unload_jz_i2s(the_i2s_controller);
 	the_i2s_controller = NULL;
 	audio_deinit_endpoint(&out_endpoint);